@@ -3,6 +3,7 @@
 // Some potentially useful member functions.
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -11,9 +12,50 @@
 
 #include "DataType.hpp"
 #include "lexer.hpp"
+#include "tools.hpp"
+#include "WasmWriter.hpp"
 //#include "Function.hpp"
 
 using namespace emplex;
+
+// The type of a value in the generated code.
+inline WasmType ToWasmType(DataType type) {
+    return type == DataType::DOUBLE ? WasmType::F64 : WasmType::I32;
+}
+
+// Tag identifying the concrete class of every node, so code can switch on it
+// (or use NodeAs<T>) instead of relying on dynamic_cast.
+enum class NodeKind : uint8_t {
+    LITERAL_VALUE,
+    VARIABLE,
+    EXPRESSION,
+    RETURN,
+    LITERAL_STRING,
+    INDEX,
+    BINARY_OP,
+    UNARY_OP,
+    IF_ELSE,
+    BLOCK,
+    WHILE,
+    CONTINUE_BREAK,
+    FUNCTION_CALL,
+    NUM_KINDS
+};
+
+// How a function keeps the strings in one of its string variables alive (see
+// Function::CountReferences), from the cheapest to the most general.
+enum class StringOwnership : uint8_t {
+    NONE,     // it only ever holds strings in the data segment, so there's nothing to do
+    BORROWED, // a parameter that's never assigned or passed on: released when the function ends
+    OWNED,    // it's the only holder of every string it's given: freed when replaced
+    COUNTED,  // retained when assigned, and released when replaced
+};
+
+// A type error found while computing a node's type.
+struct TypeError {
+    std::string message;
+};
+
 class ASTNode {
 protected:
     /*
@@ -22,63 +64,123 @@ protected:
     to char, we will throw an error.
     */
     DataType type; 
+    bool typeKnown = false; // has type been computed (or set) yet?
+    const NodeKind kind;
+
+    ASTNode(NodeKind kind) : kind(kind) {}
 public:
-    virtual void GenerateCode() = 0;
+    virtual ~ASTNode() = default;
+
+    NodeKind Kind() const {
+        return kind;
+    }
+
+    virtual void GenerateCode(WasmWriter & out) = 0;
 
     /*
+    Work out the type of this node's result from its children, which already
+    have their types cached.  Throws TypeError if the types do not fit together.
     Not all nodes will need this function, for example if-else or while.
     In this case just provide empty implementation.
     */
-    virtual DataType GetDataType() = 0;
+    virtual DataType ComputeType() = 0;
+
+    // Type of this node's result.  It is computed once, on first use (by the
+    // TypeChecker pass, or the parser), and cached on the node after that.
+    DataType GetDataType() {
+        if (!typeKnown) {
+            try {
+                UpdateType(ComputeType());
+            } catch (const TypeError& error) {
+                Error(error.message);
+            }
+        }
+        return type;
+    }
+
+    // Compute and cache the type, letting any TypeError propagate.
+    DataType CheckType() {
+        if (!typeKnown) UpdateType(ComputeType());
+        return type;
+    }
 
     void UpdateType(DataType type) {
         this->type = type;
+        typeKnown = true;
     }
 };
 
+// Downcast using the kind tag; returns nullptr if node is not a T.
+template <typename T>
+T* NodeAs(ASTNode* node) {
+    return (node && node->Kind() == T::KIND) ? static_cast<T*>(node) : nullptr;
+}
+
 
 class LiteralValueNode : public ASTNode {
 private:
     int value_int; // for int and char (chars can be represented with ASCII indexes)
     double value_double; // for double
     char character; // for char
+    bool exact = false; // print the double in full, rather than to 6 digits
 public:
-    LiteralValueNode(const DataType& valueType, int value_int) : value_int(value_int) {
+    static constexpr NodeKind KIND = NodeKind::LITERAL_VALUE;
+
+    LiteralValueNode(const DataType& valueType, int value_int) : ASTNode(KIND), value_int(value_int) {
         this->type = valueType;
     }
-    LiteralValueNode(const DataType& valueType, double value_double) : value_double(value_double) {
+    LiteralValueNode(const DataType& valueType, double value_double) : ASTNode(KIND), value_double(value_double) {
         this->type = valueType;
     }
-    LiteralValueNode(const DataType& valueType, char value) : character(value) {
+    LiteralValueNode(const DataType& valueType, char value) : ASTNode(KIND), character(value) {
         this->type = valueType;
         this->value_int = int(character);
     }
 
-    void GenerateCode() {
+    void GenerateCode(WasmWriter & out) {
         if (type == DataType::INTEGER || type == DataType::CHAR)
-            std::cout << "(i32.const " << value_int << ")\n";
+            out.I32Const(value_int);
         else if (type == DataType::DOUBLE)
-            std::cout << "(f64.const " << value_double << ")\n";
+            out.F64Const(value_double, exact);
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return type;
     }
+
+    int GetIntValue() const {
+        return value_int;
+    }
+
+    double GetDoubleValue() const {
+        return value_double;
+    }
+
+    // Used for values computed by constant folding, which must not be rounded.
+    void SetExact(bool exact) {
+        this->exact = exact;
+    }
+
+    bool GetExact() const {
+        return exact;
+    }
 };
 
 class VariableNode : public ASTNode {
 private:
     int unique_id = 0;
 public:
-    VariableNode(int unique_id, DataType type) : unique_id(unique_id) {
+    static constexpr NodeKind KIND = NodeKind::VARIABLE;
+
+    VariableNode(int unique_id, DataType type) : ASTNode(KIND), unique_id(unique_id) {
         this->type = type;
     }
 
-    void GenerateCode() {
-        std::cout << "(local.get $var" << unique_id << ")\n";
+    void GenerateCode(WasmWriter & out) {
+        out.LocalGet({"var", unique_id});
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return type;
     }
 
@@ -92,16 +194,26 @@ class ExpressionNode : public ASTNode {
 private:
     ASTNode* expression;
 public:
-    ExpressionNode(ASTNode* expression) : expression(expression) {}
+    static constexpr NodeKind KIND = NodeKind::EXPRESSION;
+
+    ExpressionNode(ASTNode* expression) : ASTNode(KIND), expression(expression) {}
 
-    void GenerateCode(){
+    void GenerateCode(WasmWriter & out){
         // just put the result of the expression on top of the stack
-        expression->GenerateCode();
+        expression->GenerateCode(out);
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return expression->GetDataType();
     }
+
+    ASTNode* GetExpression() const {
+        return expression;
+    }
+
+    void SetExpression(ASTNode* expression) {
+        this->expression = expression;
+    }
 };
 
 class ReturnNode : public ASTNode {
@@ -109,28 +221,38 @@ private:
     ASTNode* expression = nullptr;
     bool insideIf = false;
 public:
-    ReturnNode(ASTNode* expression) : expression(expression) {}
-    void GenerateCode() {
-        expression->GenerateCode();
+    static constexpr NodeKind KIND = NodeKind::RETURN;
+
+    ReturnNode(ASTNode* expression) : ASTNode(KIND), expression(expression) {}
+    void GenerateCode(WasmWriter & out) {
+        expression->GenerateCode(out);
         if (insideIf) {
-            std::cout << "(return)\n";
+            out.Op(WasmOp::RETURN);
         }
     }
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return expression->GetDataType();
     }
+
+    ASTNode* GetExpression() const {
+        return expression;
+    }
+
+    void SetExpression(ASTNode* expression) {
+        this->expression = expression;
+    }
 };
 class LiteralStringNode : public ASTNode {
 private:
     int memoryPos; // index of a literal string in global memory
     int length;
 public:
-    void GenerateCode() {
-        // put the index of the start of the string onto a stack
-        std::cout << "(i32.const " << memoryPos << ")\n";
+    void GenerateCode(WasmWriter & out) {
+        // put the address of the string (its length header) onto a stack
+        out.I32Const(memoryPos);
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return DataType::STRING;
     }
 
@@ -138,11 +260,17 @@ public:
         return memoryPos;
     }
 
+    void SetMemoryPos(int pos) {
+        memoryPos = pos;
+    }
+
     int getLength() {
         return length;
     }
 
-    LiteralStringNode(int memoryPos, int length) : memoryPos(memoryPos), length(length) {} 
+    static constexpr NodeKind KIND = NodeKind::LITERAL_STRING;
+
+    LiteralStringNode(int memoryPos, int length) : ASTNode(KIND), memoryPos(memoryPos), length(length) {} 
 };
 
 class IndexNode : public ASTNode {
@@ -151,55 +279,83 @@ private:
     ASTNode* indexExpression; // Expression resulting in the index
 
 public:
+    static constexpr NodeKind KIND = NodeKind::INDEX;
+
     IndexNode(ASTNode* variableNode, ASTNode* indexExpression)
-        : variableNode(variableNode), indexExpression(indexExpression) {
+        : ASTNode(KIND), variableNode(variableNode), indexExpression(indexExpression) {
         this->type = DataType::CHAR; // Indexing a string results in a CHAR
     }
 
-    void GenerateCode() override {
+    void GenerateCode(WasmWriter & out) override {
         // Generate code to load the base address of the string variable
-        variableNode->GenerateCode(); // Pushes the base address onto the stack
+        variableNode->GenerateCode(out); // Pushes the base address onto the stack
 
         // Generate code for the index expression
-        indexExpression->GenerateCode(); // Pushes the index onto the stack
+        indexExpression->GenerateCode(out); // Pushes the index onto the stack
 
         // Add base address and index
-        std::cout << "(i32.add)\n";
+        out.Op(WasmOp::I32_ADD);
 
-        // Load the byte at the calculated address
-        std::cout << "(i32.load8_u)\n";
+        // Load the byte at the calculated address (past the length header)
+        out.Op(WasmOp::I32_LOAD8_U, STRING_HEADER_SIZE);
     }
 
-    void GenerateCodeAssignment() {
+    void GenerateCodeAssignment(WasmWriter & out) {
         // Generate code to load the base address of the string variable
-        variableNode->GenerateCode(); // Pushes the base address onto the stack
+        variableNode->GenerateCode(out); // Pushes the base address onto the stack
 
         // Generate code for the index expression
-        indexExpression->GenerateCode(); // Pushes the index onto the stack
+        indexExpression->GenerateCode(out); // Pushes the index onto the stack
 
         // Add base address and index
-        std::cout << "(i32.add)\n";
+        out.Op(WasmOp::I32_ADD);
+    }
+
+    ASTNode* GetVariable() const {
+        return variableNode;
     }
 
-    ASTNode* GetIndexExpression() {
+    ASTNode* GetIndexExpression() const {
         return indexExpression;
     }
 
-    DataType GetDataType() override {
+    void SetVariable(ASTNode* variableNode) {
+        this->variableNode = variableNode;
+    }
+
+    void SetIndexExpression(ASTNode* indexExpression) {
+        this->indexExpression = indexExpression;
+    }
+
+    DataType ComputeType() override {
         return DataType::CHAR;
     }
 };
 
 class BinaryOpNode : public ASTNode {
 private:
-    emplex::Token op;
+    int op; // token id of the operator
     ASTNode* lhs = nullptr;
     ASTNode* rhs = nullptr;
     ASTNode* index = nullptr;
     bool stack = false;
+    bool declaration = false; // an assignment that initializes a variable where it's declared
+    StringOwnership ownership = StringOwnership::NONE; // for an assignment to a string variable
+    int firstPart = 0;        // for a concatenation: the first of the $part locals its parts are kept in
+
+    // The strings and chars joined by this concatenation and any directly beneath it, left to right.
+    void AddConcatParts(std::vector<ASTNode*>& parts) {
+        for (ASTNode* side : {lhs, rhs}) {
+            auto* binary = NodeAs<BinaryOpNode>(side);
+            if (binary && binary->IsConcatenation()) binary->AddConcatParts(parts);
+            else parts.push_back(side);
+        }
+    }
 
 public:
-    BinaryOpNode(emplex::Token operation) : op(operation) {}
+    static constexpr NodeKind KIND = NodeKind::BINARY_OP;
+
+    BinaryOpNode(int operation) : ASTNode(KIND), op(operation) {}
 
     void SetLeft(ASTNode* left) {
         lhs = left;
@@ -217,251 +373,306 @@ public:
         this->stack = stack;
     }
 
-    bool GetStack() {
+    bool GetStack() const {
         return stack;
     }
 
+    void SetDeclaration(bool declaration) {
+        this->declaration = declaration;
+    }
+
+    bool IsDeclaration() const {
+        return declaration;
+    }
+
+    void SetOwnership(StringOwnership ownership) {
+        this->ownership = ownership;
+    }
+
+    // A + B where A and B are strings or chars (but not both chars) concatenates them.
+    bool IsConcatenation() {
+        if (op != Lexer::ID_add) return false;
+        const DataType left = lhs->GetDataType();
+        const DataType right = rhs->GetDataType();
+        return (left == DataType::STRING || left == DataType::CHAR) &&
+               (right == DataType::STRING || right == DataType::CHAR) &&
+               !(left == DataType::CHAR && right == DataType::CHAR);
+    }
+
+    std::vector<ASTNode*> GetConcatParts() {
+        std::vector<ASTNode*> parts;
+        AddConcatParts(parts);
+        return parts;
+    }
+
+    // Just two strings (with no further concatenations in the chain) are joined by
+    // $add_strings; anything longer, or with a char in it, by one $concat_n.
+    bool JoinsTwoStrings() {
+        for (ASTNode* side : {lhs, rhs}) {
+            if (side->GetDataType() != DataType::STRING) return false;
+            auto* binary = NodeAs<BinaryOpNode>(side);
+            if (binary && binary->IsConcatenation()) return false;
+        }
+        return true;
+    }
+
+    void SetFirstPart(int first) {
+        firstPart = first;
+    }
+
+    // Join the whole chain of concatenations at once: each part is kept in a local
+    // until they've all been computed, then $concat_n is given a list of them
+    // (allocated into $concat_list), with a char marked by setting the high bits above its byte.
+    void GenerateConcatenation(WasmWriter & out) {
+        if (JoinsTwoStrings()) {
+            lhs->GenerateCode(out);
+            rhs->GenerateCode(out);
+            out.Call("add_strings");
+            return;
+        }
+        const std::vector<ASTNode*> parts = GetConcatParts();
+        const int count = static_cast<int>(parts.size());
+        for (int i = 0; i < count; i++) {
+            parts[i]->GenerateCode(out);
+            if (parts[i]->GetDataType() == DataType::CHAR) out.I32Const(-256).Op(WasmOp::I32_OR);
+            out.LocalSet({"part", firstPart + i});
+        }
+        out.I32Const(8 * count).Call("alloc").GlobalSet("concat_list");
+        for (int i = 0; i < count; i++) {
+            out.GlobalGet("concat_list").LocalGet({"part", firstPart + i}).Op(WasmOp::I32_STORE, 8 * i);
+        }
+        out.GlobalGet("concat_list").I32Const(count).Call("concat_n");
+    }
+
+    int GetOp() const {
+        return op;
+    }
+
+    ASTNode* GetLeft() const {
+        return lhs;
+    }
+
+    ASTNode* GetRight() const {
+        return rhs;
+    }
+
+    ASTNode* GetIndex() const {
+        return index;
+    }
+
 
-    void GenerateCode() {
+    void GenerateCode(WasmWriter & out) {
         // Declare the variable outside the switch to avoid jump errors
         VariableNode* varNode = nullptr;
         IndexNode* indexNode = nullptr;
 
-        if (op.id != Lexer::ID_add && op.id != Lexer::ID_assignment && op.id != Lexer::ID_and && op.id != Lexer::ID_or && op.id != Lexer::ID_divide && op.id != Lexer::ID_multiply) {
-            lhs->GenerateCode();
-            rhs->GenerateCode();
+        // an int operand is converted to double if the other one is a double
+        const bool doubleOperands = lhs->GetDataType() == DataType::DOUBLE || rhs->GetDataType() == DataType::DOUBLE;
+        if (op != Lexer::ID_add && op != Lexer::ID_assignment && op != Lexer::ID_and && op != Lexer::ID_or && op != Lexer::ID_divide && op != Lexer::ID_multiply) {
+            lhs->GenerateCode(out);
+            if (doubleOperands && lhs->GetDataType() != DataType::DOUBLE) out.Op(WasmOp::F64_CONVERT_I32_S);
+            rhs->GenerateCode(out);
+            if (doubleOperands && rhs->GetDataType() != DataType::DOUBLE) out.Op(WasmOp::F64_CONVERT_I32_S);
         }
 
         DataType type = GetDataType();
-        std::string type_str = DataType_ToCode(type); // "i32" or "f64"
-
-        switch (op.id) {
+        // The i32 or f64 version of an instruction, to suit the type
+        auto Typed = [type](WasmOp i32_op, WasmOp f64_op) {
+            return type == DataType::DOUBLE ? f64_op : i32_op;
+        };
+        // Likewise for a comparison, which pushes an i32 whatever its operands are
+        auto Compare = [doubleOperands](WasmOp i32_op, WasmOp f64_op) {
+            return doubleOperands ? f64_op : i32_op;
+        };
+
+        switch (op) {
             case Lexer::ID_add:
-                if ((lhs->GetDataType() == DataType::STRING || lhs->GetDataType() == DataType::CHAR) &&
-                    (rhs->GetDataType() == DataType::STRING || rhs->GetDataType() == DataType::CHAR)) {
-                    
-                    lhs->GenerateCode();
-                    if (lhs->GetDataType() == DataType::CHAR && rhs->GetDataType() == DataType::STRING) {
-                        std::cout << "(call $char_to_string)\n"; // Convert to string
-                    }
-
-                    rhs->GenerateCode();
-                    if (rhs->GetDataType() == DataType::CHAR && lhs->GetDataType() == DataType::STRING) {
-                        std::cout << "(call $char_to_string)\n"; // Convert to string
-                    }
-
-                    // Concatenate lhs and rhs
-                    if (lhs->GetDataType() == DataType::CHAR && rhs->GetDataType() == DataType::CHAR) {
-                        std::cout << "(i32.add)\n";
-                    }
-                    else {
-                        std::cout << "(call $add_strings)\n";
-                    }
-
+                if (IsConcatenation()) {
+                    GenerateConcatenation(out);
                     return;
                 }
 
                 // Handle numerical addition
                 if (lhs->GetDataType() != DataType::STRING && rhs->GetDataType() != DataType::STRING) {
-                    lhs->GenerateCode();
-                    rhs->GenerateCode();
-                    std::cout << "(" << type_str << ".add)\n";
+                    lhs->GenerateCode(out);
+                    rhs->GenerateCode(out);
+                    out.Op(Typed(WasmOp::I32_ADD, WasmOp::F64_ADD));
                 }
                 break;
             case Lexer::ID_multiply:
                 
-                lhs->GenerateCode();
+                lhs->GenerateCode(out);
+
+                // a char or string repeated
+                if (type == DataType::STRING) {
+                    rhs->GenerateCode(out);
+                    out.Call(lhs->GetDataType() == DataType::CHAR ? "pad_char" : "repeat_string");
+                    break;
+                }
 
                 // conversion int to double if one of the operands is a double
                 if (lhs->GetDataType() != DataType::DOUBLE && rhs->GetDataType() == DataType::DOUBLE) {
-                    std::cout << "(f64.convert_i32_s)\n"; // convert to double
-                }
-                else if (lhs->GetDataType() == DataType::CHAR && rhs->GetDataType() == DataType::INTEGER) {
-                    std::cout << "(call $char_to_string)\n";
+                    out.Op(WasmOp::F64_CONVERT_I32_S); // convert to double
                 }
 
-                rhs->GenerateCode();
+                rhs->GenerateCode(out);
                 if (rhs->GetDataType() != DataType::DOUBLE && lhs->GetDataType() == DataType::DOUBLE) {
-                    std::cout << "(f64.convert_i32_s)\n"; // convert to double
-                }
-                else if (rhs->GetDataType() == DataType::INTEGER && lhs->GetDataType() == DataType::CHAR) {
-                    lhs->GenerateCode();
-                    std::cout << "(call $pad_char)\n";
-                    break;
+                    out.Op(WasmOp::F64_CONVERT_I32_S); // convert to double
                 }
-                std::cout << "(" << type_str << ".mul)\n";
+                out.Op(Typed(WasmOp::I32_MUL, WasmOp::F64_MUL));
                 break;
             case Lexer::ID_negation:
-                std::cout << "(" << type_str << ".sub)\n";
+                out.Op(Typed(WasmOp::I32_SUB, WasmOp::F64_SUB));
                 break;
             case Lexer::ID_modulus:
                 if (type == DataType::DOUBLE) {
                     Error("Modulus operation is not supported for doubles\n");
                 }
-                std::cout << "(" << type_str << ".rem_s)\n";
+                out.Op(WasmOp::I32_REM_S);
                 break;
             case Lexer::ID_less_than:
-                std::cout << "(" << type_str << ".lt";
-                if (type != DataType::DOUBLE) {
-                    std::cout << "_s";
-                }
-                std::cout << ")\n";
+                out.Op(Compare(WasmOp::I32_LT_S, WasmOp::F64_LT));
                 break;
             case Lexer::ID_greater_than:
-                std::cout << "(" << type_str << ".gt";
-                if (type != DataType::DOUBLE) {
-                    std::cout << "_s";
-                }
-                std::cout << ")\n";
+                out.Op(Compare(WasmOp::I32_GT_S, WasmOp::F64_GT));
                 break;
             case Lexer::ID_less_or_eq:
-                std::cout << "(" << type_str << ".le";
-                if (type != DataType::DOUBLE) {
-                    std::cout << "_s";
-                }
-                std::cout << ")\n";
+                out.Op(Compare(WasmOp::I32_LE_S, WasmOp::F64_LE));
                 break;
             case Lexer::ID_greater_or_eq:
-                std::cout << "(" << type_str << ".ge";
-                if (type != DataType::DOUBLE) {
-                    std::cout << "_s";
-                }
-                std::cout << ")\n";
+                out.Op(Compare(WasmOp::I32_GE_S, WasmOp::F64_GE));
                 break;
             case Lexer::ID_not_eq:
-                std::cout << "(" << type_str << ".ne)\n";
+                out.Op(Compare(WasmOp::I32_NE, WasmOp::F64_NE));
                 break;
 
             case Lexer::ID_and:
-                lhs->GenerateCode(); // test left side and then perform if
-
-                std::cout << "(if (result " << type_str << ")\n";
-                std::cout << "(then\n";
-                rhs->GenerateCode();
-
-                std::cout << "(i32.const 0)\n";
-                std::cout << "(i32.ne)\n";
-                std::cout << ")\n"; // close then
-
-                std::cout << "(else\n";
-                std::cout << "(i32.const 0)\n";
-                std::cout << ")\n"; // close else
-
-                std::cout << ")\n"; // close if
+                lhs->GenerateCode(out); // test left side and then perform if
+
+                out.If(ToWasmType(type));
+                rhs->GenerateCode(out);
+                out.I32Const(0).Op(WasmOp::I32_NE);
+                out.Else();
+                out.I32Const(0);
+                out.End();
                 break;
 
             case Lexer::ID_or:
-                lhs->GenerateCode(); // test left side and then perform if
-
-                std::cout << "(if (result " << type_str << ")\n";
-                std::cout << "(then\n";
-                std::cout << "(i32.const 1)\n";
-                std::cout << ")\n"; // close then
-
-                std::cout << "(else\n";
-                rhs->GenerateCode();
-
-                std::cout << "(i32.const 0)\n";
-                std::cout << "(i32.ne)\n";
-                std::cout << ")\n"; // close else
-
-                std::cout << ")\n"; // close if
+                lhs->GenerateCode(out); // test left side and then perform if
+
+                out.If(ToWasmType(type));
+                out.I32Const(1);
+                out.Else();
+                rhs->GenerateCode(out);
+                out.I32Const(0).Op(WasmOp::I32_NE);
+                out.End();
                 break;
 
             case Lexer::ID_assignment:
                 if (index == nullptr)
-                    rhs->GenerateCode();
+                    rhs->GenerateCode(out);
 
                 // Assign the variable
-                varNode = dynamic_cast<VariableNode*>(lhs);
+                varNode = NodeAs<VariableNode>(lhs);
                 if (!varNode) {
                     Error("Could not obtain a variable on the left side of assignment");
                 }
                 if (varNode->GetDataType() == DataType::DOUBLE && rhs->GetDataType() != DataType::DOUBLE) {
-                    std::cout << "(f64.convert_i32_s)\n"; // convert right hand side if needed
+                    out.Op(WasmOp::F64_CONVERT_I32_S); // convert right hand side if needed
                 }
 
                 // check for indexing, and if so, generate code for indexing
                 if (index == nullptr) {
-
-                    std::cout << "(local.set $var" << varNode->GetUniqueId() << ")\n";
-                    std::cout << "(local.get $var" << varNode->GetUniqueId() << ")\n";
+                    const WasmName var("var", varNode->GetUniqueId());
+                    // let go of the variable's old string, once the new one is held (literals aren't counted)
+                    if (ownership == StringOwnership::COUNTED) {
+                        if (!NodeAs<LiteralStringNode>(rhs)) out.Call("retain");
+                        out.LocalGet(var).Call("release");
+                    } else if (ownership == StringOwnership::OWNED) {
+                        out.LocalGet(var).Call("free");
+                    }
+                    out.LocalSet(var);
+                    out.LocalGet(var);
                     if (!stack)
-                        std::cout << "(drop)\n";
+                        out.Op(WasmOp::DROP);
                     break;
                 }
                 else {
                     // Assign the variable
-                    indexNode = dynamic_cast<IndexNode*>(index);
+                    indexNode = NodeAs<IndexNode>(index);
                     if (!indexNode) {
                         Error("Could not obtain an index");
                     }
                     else {
                         auto expression = indexNode->GetIndexExpression();
-                        expression->GenerateCode();
+                        expression->GenerateCode(out);
                     }
 
-                    std::cout << "(local.get $var" << varNode->GetUniqueId() << ")\n";
+                    out.LocalGet({"var", varNode->GetUniqueId()});
                     // Add base address and index
-                    std::cout << "(i32.add)\n";
-                    rhs->GenerateCode();
-                    std::cout << "(i32.store8)\n";
+                    out.Op(WasmOp::I32_ADD);
+                    rhs->GenerateCode(out);
+                    out.Op(WasmOp::I32_STORE8, STRING_HEADER_SIZE);
                     
                     break;
                 }
 
             case Lexer::ID_equality:
-                std::cout << "(i32.eq)\n";
+                out.Op(Compare(WasmOp::I32_EQ, WasmOp::F64_EQ));
                 break;
             case Lexer::ID_divide:
-                lhs->GenerateCode();
+                lhs->GenerateCode(out);
 
                 // conversion int to double if one of the operands is a double
                 if (lhs->GetDataType() != DataType::DOUBLE && rhs->GetDataType() == DataType::DOUBLE) {
-                    std::cout << "(f64.convert_i32_s)\n"; // convert to double
+                    out.Op(WasmOp::F64_CONVERT_I32_S); // convert to double
                 }
-                rhs->GenerateCode();
+                rhs->GenerateCode(out);
                 if (rhs->GetDataType() != DataType::DOUBLE && lhs->GetDataType() == DataType::DOUBLE) {
-                    std::cout << "(f64.convert_i32_s)\n"; // convert to double
+                    out.Op(WasmOp::F64_CONVERT_I32_S); // convert to double
                 }
-                if (type == DataType::DOUBLE) {
-                    std::cout << "(f64.div)\n";
-                } else 
-                    std::cout << "(i32.div_s)\n";
+                out.Op(Typed(WasmOp::I32_DIV_S, WasmOp::F64_DIV));
                 break;
             default:
-                Error("Encountered unknown operation in BinaryOpNode: ", op.lexeme, "\n");
+                Error("Encountered unknown operation in BinaryOpNode: ", Lexer::TokenName(op), "\n");
         }
     }
 
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         DataType left_type = lhs->GetDataType();
         DataType right_type = rhs->GetDataType();
         
-        switch (op.id) {
+        switch (op) {
             case Lexer::ID_add:
             case Lexer::ID_negation: {
                 if (left_type == DataType::CHAR && right_type == DataType::CHAR)
                     return DataType::CHAR;
                 if ((left_type == DataType::CHAR && right_type == DataType::DOUBLE) ||
                     (right_type == DataType::CHAR && left_type == DataType::DOUBLE))
-                    Error("CHAR can only be added or subtracted with CHAR or INT");
+                    throw TypeError{"CHAR can only be added or subtracted with CHAR or INT"};
                 return std::max(left_type, right_type);
             }
             
             case Lexer::ID_multiply:
             case Lexer::ID_divide: {
                 if (left_type == DataType::CHAR && right_type == DataType::CHAR)
-                    Error("Cannot perform multiplication/division with CHAR type");
+                    throw TypeError{"Cannot perform multiplication/division with CHAR type"};
+                // char * int and string * int repeat the char or string
+                if (op == Lexer::ID_multiply && right_type == DataType::INTEGER &&
+                    (left_type == DataType::CHAR || left_type == DataType::STRING))
+                    return DataType::STRING;
+                if (left_type == DataType::STRING || right_type == DataType::STRING)
+                    throw TypeError{op == Lexer::ID_multiply ? "A STRING can only be multiplied by an INT"
+                                                             : "Cannot perform division with STRING type"};
                 return std::max(left_type, right_type);
             }
             
             case Lexer::ID_modulus: {
                 if (left_type == DataType::CHAR || right_type == DataType::CHAR)
-                    Error("Cannot perform modulus with CHAR type");
+                    throw TypeError{"Cannot perform modulus with CHAR type"};
                 if (left_type == DataType::DOUBLE || right_type == DataType::DOUBLE)
-                    Error("Cannot perform modulus with DOUBLE type");
+                    throw TypeError{"Cannot perform modulus with DOUBLE type"};
                 return DataType::INTEGER;
             }
             
@@ -471,24 +682,24 @@ public:
             case Lexer::ID_greater_or_eq:
             case Lexer::ID_equality:
             case Lexer::ID_not_eq:
-                return std::max(lhs->GetDataType(), rhs->GetDataType());  // Comparison operators return int, double or char
+                return DataType::INTEGER;  // Comparisons push an i32 (0 or 1), even of doubles
                 
             case Lexer::ID_and:
             case Lexer::ID_or: {
                 if (left_type == DataType::DOUBLE || right_type == DataType::DOUBLE)
-                    Error("Logical operators can not be applied to double");
+                    throw TypeError{"Logical operators can not be applied to double"};
                 return DataType::INTEGER;
             }
             
             case Lexer::ID_assignment: {
-                //std::cout << "Left type: " << left_type << ", right type: " << right_type << "\n";
+                //out << "Left type: " << left_type << ", right type: " << right_type << "\n";
                 if (left_type < right_type)
-                    Error("Cannot assign higher precision type to lower precision variable");
+                    throw TypeError{"Cannot assign higher precision type to lower precision variable"};
                 return left_type;
             }
             
             default:
-                Error("Unknown operator in GetDataType");
+                throw TypeError{"Unknown operator in ComputeType"};
                 return DataType::INTEGER;  // To avoid compiler warning
         }
     }
@@ -496,37 +707,47 @@ public:
 
 class UnaryOpNode : public ASTNode {
 private:
-    emplex::Token op;
+    int op; // token id of the operator
     ASTNode* operand;
 
 public:
-    UnaryOpNode(emplex::Token operation) : op(operation) {}
+    static constexpr NodeKind KIND = NodeKind::UNARY_OP;
+
+    UnaryOpNode(int operation) : ASTNode(KIND), op(operation) {}
 
     void SetLeft(ASTNode* node) {
         operand = node;
     }
 
-void GenerateCode() {
-    if (op.id == Lexer::ID_negation) {
-        VariableNode* varNode = dynamic_cast<VariableNode*>(operand);
+    int GetOp() const {
+        return op;
+    }
+
+    ASTNode* GetOperand() const {
+        return operand;
+    }
+
+void GenerateCode(WasmWriter & out) {
+    if (op == Lexer::ID_negation) {
+        VariableNode* varNode = NodeAs<VariableNode>(operand);
         if (varNode) {
             // If the operand is a variable, generate code to negate it
-            std::cout << "(i32.const 0)\n";   // Push 0 onto the stack
-            std::cout << "(local.get $var" << varNode->GetUniqueId() << ")\n"; // Push variable onto the stack
-            std::cout << "(i32.sub)\n";       // Subtract to negate the value
+            out.I32Const(0);                                // Push 0 onto the stack
+            out.LocalGet({"var", varNode->GetUniqueId()});  // Push variable onto the stack
+            out.Op(WasmOp::I32_SUB);                        // Subtract to negate the value
         } else {
-            std::cout << "(i32.const 0)\n";   // Push 0 onto the stack
-            operand->GenerateCode(); // Generate code for the operand if it's not a variable
+            out.I32Const(0);            // Push 0 onto the stack
+            operand->GenerateCode(out); // Generate code for the operand if it's not a variable
             
-            std::cout << "(i32.sub)\n";       // Subtract to negate the value
+            out.Op(WasmOp::I32_SUB);    // Subtract to negate the value
         }
-    } else if (op.id == Lexer::ID_not) {
+    } else if (op == Lexer::ID_not) {
         // Perform logical NOT using (i32.eqz)
-        operand->GenerateCode();
-        std::cout << "(i32.eqz)\n";
+        operand->GenerateCode(out);
+        out.Op(WasmOp::I32_EQZ);
     }
 
-    else if (op.id == Lexer::ID_colon) {
+    else if (op == Lexer::ID_colon) {
         // Perform type conversion
         // (local.get $var0)    ;; Place var 'val' onto stack
         // (i32.trunc_f64_s) ;; Convert to int.
@@ -534,30 +755,30 @@ void GenerateCode() {
         // (local.get $var1)    ;; Place var 'floored' onto stack
         // (f64.convert_i32_s) ;; Convert to double.
 
-        operand->GenerateCode();
+        operand->GenerateCode(out);
         if (operand->GetDataType() == DataType::INTEGER) {
-            std::cout << "(i32.trunc_f64_s) ;; colon - convert to int\n";
+            out.Op(WasmOp::I32_TRUNC_F64_S).Note(" ;; colon - convert to int");
         } 
         else if (operand->GetDataType() == DataType::STRING) {
-            std::cout << "(call $char_to_string)\n";
+            out.Call("char_to_string");
         }
         else {
-            std::cout << "(f64.convert_i32_s) ;; colon - convert to double\n";
+            out.Op(WasmOp::F64_CONVERT_I32_S).Note(" ;; colon - convert to double");
         }
     }
 
-    else if (op.id == Lexer::ID_sqrt) {
-        operand->GenerateCode();
+    else if (op == Lexer::ID_sqrt) {
+        operand->GenerateCode(out);
         if (operand->GetDataType() == DataType::INTEGER) {
-            std::cout << "(f64.convert_i32_s)\n";
+            out.Op(WasmOp::F64_CONVERT_I32_S);
         }
         
-        std::cout << "(f64.sqrt)\n";
+        out.Op(WasmOp::F64_SQRT);
         //operand->UpdateType(DataType::DOUBLE);
     }
 }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return operand->GetDataType();
     }
 };
@@ -569,9 +790,13 @@ private:
     ASTNode* elseBlock = nullptr;
     bool returnInIf = false;
     bool returnInElse = false;
+    int functionId = 1; // id of the enclosing function, whose exit block a return branches to
 
 public:
-    IfElseNode(bool returnInIf, bool returnInElse) : returnInIf(returnInIf), returnInElse(returnInElse) {}
+    static constexpr NodeKind KIND = NodeKind::IF_ELSE;
+
+    IfElseNode(bool returnInIf, bool returnInElse, int functionId)
+        : ASTNode(KIND), returnInIf(returnInIf), returnInElse(returnInElse), functionId(functionId) {}
 
     void setCondition(ASTNode* condition) {
         this->condition = condition;
@@ -583,58 +808,67 @@ public:
         this->elseBlock = elseBlock;
     }
 
-    DataType GetDataType() {
+    ASTNode* GetCondition() const {
+        return condition;
+    }
+    ASTNode* GetIfBlock() const {
+        return ifBlock;
+    }
+    ASTNode* GetElseBlock() const {
+        return elseBlock;
+    }
+    bool GetReturnInIf() const {
+        return returnInIf;
+    }
+    bool GetReturnInElse() const {
+        return returnInElse;
+    }
+
+    DataType ComputeType() override {
         if (returnInElse && returnInIf) {
             // Ensure that both branches return the same type
             DataType thenType = ifBlock ? ifBlock->GetDataType() : DataType::INTEGER;
             DataType elseType = elseBlock ? elseBlock->GetDataType() : DataType::INTEGER;
             if (thenType != elseType) {
-                Error("Mismatched types in if-else branches");
+                throw TypeError{"Mismatched types in if-else branches"};
             }
             return thenType;
         }
-        Error("IfElseNode does not have a consistent data type");
+        throw TypeError{"IfElseNode does not have a consistent data type"};
         return DataType::INTEGER;
     }
 
-void GenerateCode() {
+void GenerateCode(WasmWriter & out) {
     // Generate the condition for the `if` statement
-    condition->GenerateCode();
+    condition->GenerateCode(out);
 
     // Check if the if statement returns a value
-    std::cout << "(if ";
     if ( returnInIf && returnInElse ) {
         // guaranteed return in both if and else
-        std::cout << "(result i32)\n";
+        out.If(WasmType::I32);
     }
     else
-        std::cout << "\n";
+        out.If();
 
-    std::cout << "(then\n";
     if (ifBlock) {
-        ifBlock->GenerateCode();
+        ifBlock->GenerateCode(out);
         if (returnInIf) {
-            std::cout << "(return)\n";
-        }
-        if (returnInIf && !returnInElse) {
-            // we don't have a guaranteed return because there is no return in else
-            std::cout << "(br $fun_exit1)\n";
+            // return through the end of the function, where its strings are released
+            out.Br({"fun_exit", functionId});
         }
     }
-    std::cout << ")\n"; // Close 'then' block
 
     // Generate code for the `else` block if it exists
     if (elseBlock) {
-        std::cout << "(else\n";
-        elseBlock->GenerateCode();
+        out.Else();
+        elseBlock->GenerateCode(out);
         if (returnInElse && !returnInIf) {
             // no guaranteed return because there is no return in if
-            std::cout << "(br $fun_exit1)\n";
+            out.Br({"fun_exit", functionId});
         }
-        std::cout << ")\n"; // Close 'else' block
     }
 
-    std::cout << ")\n"; // Close 'if' block
+    out.End(); // Close 'if' block
 }
 
 };
@@ -643,19 +877,29 @@ class BlockNode : public ASTNode {
 private:
     std::vector<ASTNode*> statements{};
 public:
-    BlockNode() {}
+    static constexpr NodeKind KIND = NodeKind::BLOCK;
+
+    BlockNode() : ASTNode(KIND) {}
 
     void addStatement(ASTNode* statement) {
         statements.push_back(statement);
     }
 
-    void GenerateCode() {
+    const std::vector<ASTNode*>& GetStatements() const {
+        return statements;
+    }
+
+    void SetStatement(size_t i, ASTNode* statement) {
+        statements[i] = statement;
+    }
+
+    void GenerateCode(WasmWriter & out) {
         for (const auto &s : statements)
-            s->GenerateCode();
+            s->GenerateCode(out);
     }
 
-    DataType GetDataType() {
-        Error("BlockNode does not have a data type");
+    DataType ComputeType() override {
+        throw TypeError{"BlockNode does not have a data type"};
         return DataType::CHAR; // to prevent compiler warnings
     }
 };
@@ -666,29 +910,47 @@ private:
     ASTNode* body;
 
 public:
-    WhileNode(ASTNode* condition, ASTNode* body) : condition(condition), body(body) {}
+    static constexpr NodeKind KIND = NodeKind::WHILE;
+
+    WhileNode(ASTNode* condition, ASTNode* body) : ASTNode(KIND), condition(condition), body(body) {}
 
-    void GenerateCode() override {
-        std::cout << "(block $exit1\n"; // Outer block for breaking the loop
-        std::cout << "(loop $loop1\n";  // Inner loop for continuing
+    ASTNode* GetCondition() const {
+        return condition;
+    }
+
+    ASTNode* GetBody() const {
+        return body;
+    }
+
+    void SetCondition(ASTNode* condition) {
+        this->condition = condition;
+    }
+
+    void SetBody(ASTNode* body) {
+        this->body = body;
+    }
+
+    void GenerateCode(WasmWriter & out) override {
+        out.Block("exit1"); // Outer block for breaking the loop
+        out.Loop("loop1");  // Inner loop for continuing
 
         // Generate code for the condition
-        condition->GenerateCode();
-        std::cout << "(i32.eqz)\n";      // Invert the condition (while condition is true, keep looping)
-        std::cout << "(br_if $exit1)\n"; // Exit loop if condition is false
+        condition->GenerateCode(out);
+        out.Op(WasmOp::I32_EQZ); // Invert the condition (while condition is true, keep looping)
+        out.BrIf("exit1");       // Exit loop if condition is false
 
         // Generate code for the body
         if (body) {
-            body->GenerateCode();
+            body->GenerateCode(out);
         }
 
         // Jump back to the start of the loop
-        std::cout << "(br $loop1)\n";
-        std::cout << ")\n"; // End of loop
-        std::cout << ")\n"; // End of block
+        out.Br("loop1");
+        out.End(); // End of loop
+        out.End(); // End of block
     }
 
-    DataType GetDataType() override {
+    DataType ComputeType() override {
         return DataType::INTEGER; // While loops do not return a specific type
     }
 };
@@ -697,42 +959,173 @@ class ContinueBreakNode : public ASTNode {
 private:
     bool isContinue;
 public:
-    ContinueBreakNode(bool isContinue) : isContinue(isContinue) {}
+    static constexpr NodeKind KIND = NodeKind::CONTINUE_BREAK;
 
-    void GenerateCode() {
+    ContinueBreakNode(bool isContinue) : ASTNode(KIND), isContinue(isContinue) {}
+
+    bool IsContinue() const {
+        return isContinue;
+    }
+
+    void GenerateCode(WasmWriter & out) {
         if (isContinue) {
-            std::cout << "(br $loop1)\n";
+            out.Br("loop1");
         } else {
-            std::cout << "(br $exit1)\n";
+            out.Br("exit1");
         }
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return DataType::INTEGER; // Continue/Break do not return a specific type
     }
 };
 
+// Where a STRING expression's value comes from, for reference counting.
+enum class StringSource : uint8_t {
+    LITERAL,  // the data segment
+    NEW,      // made by the expression itself, so nothing else holds it yet
+    VARIABLE, // a variable's string
+    OTHER,    // e.g., a function's result, which a variable may still hold
+};
+
+inline StringSource SourceOf(ASTNode* node) {
+    switch (node->Kind()) {
+        case NodeKind::LITERAL_STRING:
+            return StringSource::LITERAL;
+        case NodeKind::VARIABLE:
+            return StringSource::VARIABLE;
+        case NodeKind::EXPRESSION:
+            return SourceOf(static_cast<ExpressionNode*>(node)->GetExpression());
+        case NodeKind::BINARY_OP: {
+            // a concatenation, or a char or string repeated
+            auto* binary = static_cast<BinaryOpNode*>(node);
+            if ((binary->GetOp() == Lexer::ID_add || binary->GetOp() == Lexer::ID_multiply) &&
+                binary->GetDataType() == DataType::STRING)
+                return StringSource::NEW;
+            return StringSource::OTHER;
+        }
+        case NodeKind::UNARY_OP: // a char converted to a string
+            return node->GetDataType() == DataType::STRING ? StringSource::NEW : StringSource::OTHER;
+        default:
+            return StringSource::OTHER;
+    }
+}
+
 class FunctionCallNode : public ASTNode {
 private:
-    std::string functionName;
+    std::string_view functionName;
     std::vector<ASTNode*> args;
     
 public:
-    FunctionCallNode(std::string functionName, DataType returnType, std::vector<ASTNode*> args) :
-        functionName(functionName), args(args) {
+    static constexpr NodeKind KIND = NodeKind::FUNCTION_CALL;
+
+    FunctionCallNode(std::string_view functionName, DataType returnType, std::vector<ASTNode*> args) :
+        ASTNode(KIND), functionName(functionName), args(args) {
             this->type = returnType;
         }
 
-    void GenerateCode() {
+    std::string_view GetFunctionName() const {
+        return functionName;
+    }
+
+    const std::vector<ASTNode*>& GetArgs() const {
+        return args;
+    }
+
+    void SetArg(size_t i, ASTNode* arg) {
+        args[i] = arg;
+    }
+
+    void GenerateCode(WasmWriter & out) {
         for (auto& arg : args) {
-            arg->GenerateCode();
+            arg->GenerateCode(out);
+        }
+        if (functionName == "get_length") {
+            // size() is the string's length header; a string made just to be measured is then released
+            const StringSource source = SourceOf(args[0]);
+            if (source == StringSource::LITERAL || source == StringSource::VARIABLE) out.Op(WasmOp::I32_LOAD);
+            else out.Call("temp_length");
+            return;
         }
-        std::cout << "(call $" << functionName << ")\n";
+        out.Call(functionName);
     }
 
-    DataType GetDataType() {
+    DataType ComputeType() override {
         return type;
     }
 };
 
+// Call fn on each (non-null) child of node, in order.
+template <typename FN>
+void ForEachChild(ASTNode* node, FN&& fn) {
+    auto visit = [&fn](ASTNode* child) { if (child) fn(child); };
+    switch (node->Kind()) {
+        case NodeKind::EXPRESSION:
+            visit(static_cast<ExpressionNode*>(node)->GetExpression());
+            break;
+        case NodeKind::RETURN:
+            visit(static_cast<ReturnNode*>(node)->GetExpression());
+            break;
+        case NodeKind::INDEX:
+            visit(static_cast<IndexNode*>(node)->GetVariable());
+            visit(static_cast<IndexNode*>(node)->GetIndexExpression());
+            break;
+        case NodeKind::BINARY_OP:
+            visit(static_cast<BinaryOpNode*>(node)->GetLeft());
+            visit(static_cast<BinaryOpNode*>(node)->GetRight());
+            visit(static_cast<BinaryOpNode*>(node)->GetIndex());
+            break;
+        case NodeKind::UNARY_OP:
+            visit(static_cast<UnaryOpNode*>(node)->GetOperand());
+            break;
+        case NodeKind::IF_ELSE:
+            visit(static_cast<IfElseNode*>(node)->GetCondition());
+            visit(static_cast<IfElseNode*>(node)->GetIfBlock());
+            visit(static_cast<IfElseNode*>(node)->GetElseBlock());
+            break;
+        case NodeKind::WHILE:
+            visit(static_cast<WhileNode*>(node)->GetCondition());
+            visit(static_cast<WhileNode*>(node)->GetBody());
+            break;
+        case NodeKind::BLOCK:
+            for (ASTNode* child : static_cast<BlockNode*>(node)->GetStatements()) visit(child);
+            break;
+        case NodeKind::FUNCTION_CALL:
+            for (ASTNode* child : static_cast<FunctionCallNode*>(node)->GetArgs()) visit(child);
+            break;
+        default:
+            break; // leaves
+    }
+}
 
+// Statements have no type of their own; every other kind of node does.
+constexpr bool IsExpressionKind(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::IF_ELSE:
+        case NodeKind::BLOCK:
+        case NodeKind::WHILE:
+        case NodeKind::CONTINUE_BREAK:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Give each concatenation below node that uses $concat_n the $part locals to keep its
+// parts in, numbered from first; returns how many locals are needed.  While part i is
+// computed only the locals before it are in use, so its own concatenations start there.
+inline int PlaceConcatParts(ASTNode* node, int first) {
+    int needed = first;
+    auto* binary = NodeAs<BinaryOpNode>(node);
+    if (binary && binary->IsConcatenation() && !binary->JoinsTwoStrings()) {
+        const std::vector<ASTNode*> parts = binary->GetConcatParts();
+        binary->SetFirstPart(first);
+        needed = first + static_cast<int>(parts.size());
+        for (size_t i = 0; i < parts.size(); i++) {
+            needed = std::max(needed, PlaceConcatParts(parts[i], first + static_cast<int>(i)));
+        }
+        return needed;
+    }
+    ForEachChild(node, [&](ASTNode* child) { needed = std::max(needed, PlaceConcatParts(child, first)); });
+    return needed;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// A bump allocator for objects that live until the end of a compilation.
+//
+// AST nodes, Functions and other parse-time objects are carved, in the order
+// they are created, out of large chunks.  They end up packed close together in
+// memory, and are all destroyed at once by Reset() (or the arena's destructor)
+// rather than being deleted one at a time -- or leaked.
+//
+// Example usage:
+//   Arena arena;
+//   BlockNode * block = arena.Make<BlockNode>();  // Never delete block yourself.
+//   ...
+//   arena.Reset();  // Destroy everything; the chunks are kept for reuse.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class Arena {
+private:
+  struct Chunk {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  // How to destroy an object that has a non-trivial destructor.
+  struct Cleanup {
+    void * object;
+    void (*destroy)(void *);
+  };
+
+  size_t chunk_size;
+  std::vector<Chunk> chunks{};
+  std::vector<Cleanup> cleanups{};
+  size_t cur_chunk = 0;     // Chunk currently being filled.
+  size_t chunk_used = 0;    // Bytes used so far in the current chunk.
+  size_t bytes_used = 0;    // Bytes handed out since the last Reset.
+  size_t peak_bytes = 0;    // Most bytes ever in use at once.
+  size_t object_count = 0;  // Objects made since the last Reset.
+  size_t peak_objects = 0;  // Most objects ever alive at once.
+
+  void AddChunk(size_t min_size) {
+    const size_t size = std::max(chunk_size, min_size);
+    chunks.push_back(Chunk{std::make_unique_for_overwrite<std::byte[]>(size), size});
+    cur_chunk = chunks.size() - 1;
+    chunk_used = 0;
+  }
+
+public:
+  static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  explicit Arena(size_t chunk_size = DEFAULT_CHUNK_SIZE) : chunk_size(chunk_size) {}
+  Arena(const Arena &) = delete;
+  Arena & operator=(const Arena &) = delete;
+  ~Arena() { Reset(); }
+
+  // Get uninitialized memory for `bytes` bytes with the given alignment.
+  void * Allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    while (true) {
+      if (cur_chunk < chunks.size()) {
+        const auto base = reinterpret_cast<uintptr_t>(chunks[cur_chunk].data.get());
+        const size_t start = ((base + chunk_used + align - 1) & ~(uintptr_t{align} - 1)) - base;
+        if (start + bytes <= chunks[cur_chunk].size) {
+          chunk_used = start + bytes;
+          bytes_used += bytes;
+          peak_bytes = std::max(peak_bytes, bytes_used);
+          return chunks[cur_chunk].data.get() + start;
+        }
+        // Move on to a chunk left over from before the last Reset, if any.
+        if (cur_chunk + 1 < chunks.size()) { ++cur_chunk; chunk_used = 0; continue; }
+      }
+      AddChunk(bytes + align);
+    }
+  }
+
+  // Construct a T in the arena; it is destroyed on Reset.
+  template <typename T, typename... ARGS>
+  T * Make(ARGS &&... args) {
+    T * object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<ARGS>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      cleanups.push_back(Cleanup{object, [](void * ptr) { static_cast<T *>(ptr)->~T(); }});
+    }
+    peak_objects = std::max(peak_objects, ++object_count);
+    return object;
+  }
+
+  // Destroy every object (newest first) and rewind, keeping chunks for reuse.
+  void Reset() {
+    for (auto it = cleanups.rbegin(); it != cleanups.rend(); ++it) it->destroy(it->object);
+    cleanups.clear();
+    cur_chunk = 0;
+    chunk_used = 0;
+    bytes_used = 0;
+    object_count = 0;
+  }
+
+  size_t BytesUsed() const { return bytes_used; }
+  size_t PeakBytes() const { return peak_bytes; }
+  size_t PeakObjects() const { return peak_objects; }
+  size_t NumChunks() const { return chunks.size(); }
+  size_t BytesReserved() const {
+    size_t total = 0;
+    for (const auto & chunk : chunks) total += chunk.size;
+    return total;
+  }
+
+  // Summarize peak usage (e.g., to choose a chunk size).
+  void PrintReport(std::ostream & os) const {
+    os << "arena: peak " << PeakBytes() << " bytes in " << PeakObjects() << " objects; "
+       << NumChunks() << " chunk(s) of " << chunk_size << " bytes, "
+       << BytesReserved() << " bytes reserved\n";
+  }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+// An on-disk, content-addressed store of generated code.
+//
+// Each entry is keyed by a hash of everything its contents depend on (see
+// Tubular::FunctionKey), so entries never need invalidating: any change just
+// produces a different key.  Entries live in <dir>/<first 2 hex digits>/<rest>
+// and are written to a temporary file that is then renamed into place, so
+// several compilers (or threads) can share a directory safely.
+//
+// Example usage:
+//   CompileCache cache("build/.tubular-cache");
+//   CompileCache::Hasher hasher;
+//   hasher.Add(function_text);
+//   const CompileCache::Key key = hasher.Finish();
+//   std::string code;
+//   if (!cache.Load(key, code)) { code = ...; cache.Store(key, code); }
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+
+class CompileCache {
+public:
+  struct Key {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    std::string Hex() const {
+      static constexpr char digits[] = "0123456789abcdef";
+      std::string hex(32, '0');
+      for (size_t i = 0; i < 16; ++i) {
+        hex[15 - i] = digits[(high >> (4 * i)) & 15];
+        hex[31 - i] = digits[(low >> (4 * i)) & 15];
+      }
+      return hex;
+    }
+  };
+
+  // 128-bit FNV-1a.  Strings are added with their length, so that adjacent
+  // values can't run together (e.g., "ab","c" and "a","bc" hash differently).
+  class Hasher {
+  private:
+    static constexpr unsigned __int128 PRIME = (static_cast<unsigned __int128>(1) << 88) + 0x13B;
+    unsigned __int128 state = (static_cast<unsigned __int128>(0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL;
+
+    void AddBytes(const char * data, size_t size) {
+      for (size_t i = 0; i < size; ++i) {
+        state ^= static_cast<unsigned char>(data[i]);
+        state *= PRIME;
+      }
+    }
+
+  public:
+    Hasher & Add(std::string_view str) {
+      Add(str.size());
+      AddBytes(str.data(), str.size());
+      return *this;
+    }
+
+    template <typename T> requires std::is_integral_v<T> || std::is_enum_v<T>
+    Hasher & Add(T value) {
+      const uint64_t bits = static_cast<uint64_t>(value);
+      AddBytes(reinterpret_cast<const char *>(&bits), sizeof(bits));
+      return *this;
+    }
+
+    Key Finish() const { return Key{static_cast<uint64_t>(state >> 64), static_cast<uint64_t>(state)}; }
+  };
+
+private:
+  std::filesystem::path dir;
+  std::atomic<size_t> hits = 0;
+  std::atomic<size_t> misses = 0;
+  std::atomic<size_t> stores = 0;
+  std::atomic<size_t> failed_stores = 0;
+
+  std::filesystem::path PathFor(const Key & key) const {
+    const std::string hex = key.Hex();
+    return dir / hex.substr(0, 2) / hex.substr(2);
+  }
+
+public:
+  explicit CompileCache(std::filesystem::path dir) : dir(std::move(dir)) { }
+  CompileCache(const CompileCache &) = delete;
+  CompileCache & operator=(const CompileCache &) = delete;
+
+  // Get the entry for key into contents; false (a miss) if there is none.
+  bool Load(const Key & key, std::string & contents) {
+    std::ifstream file(PathFor(key), std::ios::binary);
+    if (!file) { ++misses; return false; }
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    ++hits;
+    return true;
+  }
+
+  // Save contents under key.  Failures are only counted: a cache that can't
+  // be written just means the next compile does the work again.
+  void Store(const Key & key, std::string_view contents) {
+    const std::filesystem::path path = PathFor(key);
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    // Unique per process and thread, so concurrent writers never share a temporary file.
+    std::filesystem::path temp = path;
+    temp += ".tmp" + std::to_string(getpid()) + "-" +
+            std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+      std::ofstream file(temp, std::ios::binary);
+      file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+      if (!file) error = std::make_error_code(std::errc::io_error);
+    }
+    if (!error) std::filesystem::rename(temp, path, error);
+    if (error) {
+      std::filesystem::remove(temp, error);
+      ++failed_stores;
+      return;
+    }
+    ++stores;
+  }
+
+  size_t Hits() const { return hits; }
+  size_t Misses() const { return misses; }
+  size_t Stores() const { return stores; }
+
+  void PrintReport(std::ostream & os) const {
+    const size_t lookups = hits + misses;
+    os << "cache: " << hits << " hit(s), " << misses << " miss(es)";
+    if (lookups) os << " (" << (100 * hits / lookups) << "% hits)";
+    os << "; " << stores << " entries stored";
+    if (failed_stores) os << ", " << failed_stores << " could not be stored";
+    os << "\n";
+  }
+};
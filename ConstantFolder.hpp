@@ -0,0 +1,511 @@
+#pragma once
+
+// Constant folding and propagation, run after type checking and before code generation.
+//
+// Expressions whose operands are all constant are replaced by a literal of the
+// result: arithmetic, comparisons, logical operators, :int, :double and :string
+// conversions, sqrt, size() and indexing of literal strings, and concatenation of
+// literal strings.  A local that is initialized where it's declared with a
+// constant, and never assigned again, is replaced by the constant wherever it's read.
+//
+// A node is only replaced if the code generated for the literal is equivalent:
+// the literal must have the node's DataType and put the same kind of value on
+// the stack, and operations that would trap at run time (division by zero,
+// out-of-range conversions) are left to do so.  Doubles are computed exactly as
+// the generated code would, from literals as they are printed (to 6 digits).
+//
+// Strings are only folded where their memory can't be seen by other code (as
+// operands of size(), + or indexing, or in locals only used that way), since a
+// folded string is made once, in the data segment, instead of every time the
+// expression runs.
+//
+// Example usage:
+//   ConstantFolder folder(arena);
+//   folder.Fold(functions);
+//   // ... then place each function's folded strings (see Function::PlaceFoldedStrings).
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Arena.hpp"
+#include "ASTNode.hpp"
+#include "Function.hpp"
+
+class ConstantFolder {
+private:
+    // The value a constant expression leaves on the stack.
+    struct Constant {
+        enum Kind { I32, F64, STRING } kind;
+        int32_t i = 0;
+        double d = 0.0;
+        std::string bytes{}; // the string's contents (never including a 0 byte)
+    };
+
+    // What one function does with a local variable (by unique id).
+    struct Local {
+        int assignments = 0;
+        BinaryOpNode* declaration = nullptr; // the initializing assignment, if there is one
+        bool indexed = false;                // assigned to through an index (s[i] = c)
+        bool escapes = false;                // read other than by size(), + or indexing
+    };
+
+    Arena& arena;
+    Function* function = nullptr;
+    std::unordered_map<int, Local> locals{};
+    std::unordered_map<int, ASTNode*> constants{}; // local id -> the literal it always holds
+    std::unordered_map<const ASTNode*, std::string_view> strings{}; // literal string -> its contents
+    std::unordered_set<const ASTNode*> madeStrings{}; // literal strings made by folding
+    size_t numFolded = 0;
+    size_t numPropagated = 0;
+
+    static Constant Int(int64_t value) {
+        return Constant{Constant::I32, static_cast<int32_t>(static_cast<uint32_t>(value))}; // wraps like i32
+    }
+    static Constant Double(double value) {
+        return Constant{Constant::F64, 0, value};
+    }
+    static Constant String(std::string bytes) {
+        return Constant{Constant::STRING, 0, 0.0, std::move(bytes)};
+    }
+
+    static Constant::Kind KindOf(DataType type) {
+        if (type == DataType::DOUBLE) return Constant::F64;
+        if (type == DataType::STRING) return Constant::STRING;
+        return Constant::I32;
+    }
+
+    static bool IsSize(FunctionCallNode* node) {
+        return node->GetFunctionName() == "get_length" && node->GetArgs().size() == 1;
+    }
+
+    // Record how node and everything below it uses each local.  contained is
+    // true if a string there can only be measured, indexed or copied.
+    void Scan(ASTNode* node, bool contained = false) {
+        if (!node) return;
+        switch (node->Kind()) {
+            case NodeKind::VARIABLE:
+                // Only a string's uses matter (see IsPropagated).
+                if (!contained && node->GetDataType() == DataType::STRING) locals[static_cast<VariableNode*>(node)->GetUniqueId()].escapes = true;
+                return;
+            case NodeKind::BINARY_OP: {
+                auto* binary = static_cast<BinaryOpNode*>(node);
+                if (binary->GetOp() == Lexer::ID_assignment) {
+                    if (auto* variable = NodeAs<VariableNode>(binary->GetLeft())) {
+                        Local& local = locals[variable->GetUniqueId()];
+                        local.assignments++;
+                        if (binary->IsDeclaration()) local.declaration = binary;
+                        if (binary->GetIndex()) local.indexed = true;
+                    }
+                    if (auto* index = NodeAs<IndexNode>(binary->GetIndex())) Scan(index->GetIndexExpression());
+                    Scan(binary->GetRight());
+                    return;
+                }
+                const bool concatenation = binary->IsConcatenation();
+                Scan(binary->GetLeft(), concatenation);
+                Scan(binary->GetRight(), concatenation);
+                return;
+            }
+            case NodeKind::INDEX:
+                Scan(static_cast<IndexNode*>(node)->GetVariable(), true);
+                Scan(static_cast<IndexNode*>(node)->GetIndexExpression());
+                return;
+            case NodeKind::FUNCTION_CALL: {
+                auto* call = static_cast<FunctionCallNode*>(node);
+                for (ASTNode* arg : call->GetArgs()) Scan(arg, IsSize(call));
+                return;
+            }
+            default:
+                ForEachChild(node, [this](ASTNode* child) { Scan(child); });
+                return;
+        }
+    }
+
+    // Can reads of this local be replaced by the value it's declared with?
+    bool IsPropagated(int id) const {
+        auto it = locals.find(id);
+        if (it == locals.end()) return false;
+        const Local& local = it->second;
+        if (!local.declaration || local.assignments != 1 || local.indexed) return false;
+        return local.declaration->GetLeft()->GetDataType() != DataType::STRING || !local.escapes;
+    }
+
+    // The value a leaf (or an unfolded sqrt) puts on the stack, if it's constant.
+    std::optional<Constant> RawValueOf(ASTNode* node) {
+        switch (node->Kind()) {
+            case NodeKind::LITERAL_VALUE: {
+                auto* literal = static_cast<LiteralValueNode*>(node);
+                if (literal->GetDataType() != DataType::DOUBLE) return Int(literal->GetIntValue());
+                if (literal->GetExact()) return Double(literal->GetDoubleValue());
+                // The literal is printed to 6 significant digits; use the value that text stands for.
+                char text[32];
+                const char* end = std::to_chars(text, text + sizeof(text), literal->GetDoubleValue(),
+                                                std::chars_format::general, 6).ptr;
+                double printed = 0.0;
+                std::from_chars(text, end, printed);
+                return Double(printed);
+            }
+            case NodeKind::LITERAL_STRING: {
+                auto it = strings.find(node);
+                if (it == strings.end()) return std::nullopt;
+                return String(std::string(it->second));
+            }
+            case NodeKind::VARIABLE: {
+                auto it = constants.find(static_cast<VariableNode*>(node)->GetUniqueId());
+                if (it == constants.end()) return std::nullopt;
+                return RawValueOf(it->second);
+            }
+            case NodeKind::UNARY_OP:
+                if (static_cast<UnaryOpNode*>(node)->GetOp() != Lexer::ID_sqrt) return std::nullopt;
+                return Compute(node);
+            default:
+                return std::nullopt; // anything else constant has already been replaced by a literal
+        }
+    }
+
+    // Likewise, but only if the value is the kind node's type says it is (as code generation assumes).
+    std::optional<Constant> ValueOf(ASTNode* node) {
+        std::optional<Constant> value = RawValueOf(node);
+        if (value && value->kind != KindOf(node->GetDataType())) return std::nullopt;
+        return value;
+    }
+
+    // The contents of a string made from a char (as $char_to_string does).
+    static std::string CharBytes(int32_t value) {
+        const char byte = static_cast<char>(value);
+        return byte ? std::string(1, byte) : std::string();
+    }
+
+    // The i32 that comparison op gives for x and y, or nothing if op isn't a comparison.
+    template <typename T>
+    static std::optional<Constant> Compare(int op, T x, T y) {
+        switch (op) {
+            case Lexer::ID_less_than: return Int(x < y);
+            case Lexer::ID_greater_than: return Int(x > y);
+            case Lexer::ID_less_or_eq: return Int(x <= y);
+            case Lexer::ID_greater_or_eq: return Int(x >= y);
+            case Lexer::ID_equality: return Int(x == y);
+            case Lexer::ID_not_eq: return Int(x != y);
+            default: return std::nullopt;
+        }
+    }
+
+    std::optional<Constant> ComputeBinary(BinaryOpNode* node) {
+        const int op = node->GetOp();
+        if (op == Lexer::ID_assignment) return std::nullopt;
+        const DataType type = node->GetDataType();
+        std::optional<Constant> a = ValueOf(node->GetLeft());
+        std::optional<Constant> b = ValueOf(node->GetRight());
+
+        if (op == Lexer::ID_and || op == Lexer::ID_or) {
+            // The right side is only run if the left side doesn't decide the result.
+            if (!a || a->kind != Constant::I32) return std::nullopt;
+            if (op == Lexer::ID_and && a->i == 0) return Int(0);
+            if (op == Lexer::ID_or && a->i != 0) return Int(1);
+            if (!b || b->kind != Constant::I32) return std::nullopt;
+            return Int(b->i != 0);
+        }
+        if (!a || !b) return std::nullopt;
+
+        if (node->IsConcatenation()) {
+            std::string bytes = (a->kind == Constant::STRING) ? std::move(a->bytes) : CharBytes(a->i);
+            bytes += (b->kind == Constant::STRING) ? b->bytes : CharBytes(b->i);
+            return String(std::move(bytes));
+        }
+        if (a->kind == Constant::STRING || b->kind == Constant::STRING) return std::nullopt;
+
+        if (type == DataType::DOUBLE) {
+            // Only * and / convert an int operand to double first.
+            if (op == Lexer::ID_multiply || op == Lexer::ID_divide) {
+                if (a->kind == Constant::I32) a = Double(a->i);
+                if (b->kind == Constant::I32) b = Double(b->i);
+            }
+            if (a->kind != Constant::F64 || b->kind != Constant::F64) return std::nullopt;
+            switch (op) {
+                case Lexer::ID_add: return Double(a->d + b->d);
+                case Lexer::ID_negation: return Double(a->d - b->d);
+                case Lexer::ID_multiply: return Double(a->d * b->d);
+                case Lexer::ID_divide: return Double(a->d / b->d);
+                default: return std::nullopt;
+            }
+        }
+        if (a->kind == Constant::F64 || b->kind == Constant::F64) {
+            // A comparison with a double operand converts an int one (and is false for NaN, except !=).
+            const double x = (a->kind == Constant::F64) ? a->d : a->i;
+            const double y = (b->kind == Constant::F64) ? b->d : b->i;
+            return Compare(op, x, y);
+        }
+
+        if (a->kind != Constant::I32 || b->kind != Constant::I32) return std::nullopt;
+        if (type != DataType::INTEGER && type != DataType::CHAR) return std::nullopt;
+        const int64_t x = a->i;
+        const int64_t y = b->i;
+        switch (op) {
+            case Lexer::ID_add: return Int(x + y);
+            case Lexer::ID_negation: return Int(x - y);
+            case Lexer::ID_multiply:
+                if (type == DataType::CHAR || node->GetLeft()->GetDataType() == DataType::CHAR ||
+                    node->GetRight()->GetDataType() == DataType::CHAR) return std::nullopt; // repeats a char
+                return Int(x * y);
+            case Lexer::ID_divide:
+                if (y == 0 || (x == std::numeric_limits<int32_t>::min() && y == -1)) return std::nullopt; // traps
+                return Int(x / y);
+            case Lexer::ID_modulus:
+                if (y == 0) return std::nullopt; // traps
+                return Int(x % y);
+            default: return Compare(op, x, y);
+        }
+    }
+
+    std::optional<Constant> ComputeUnary(UnaryOpNode* node) {
+        ASTNode* operand = node->GetOperand();
+        switch (node->GetOp()) {
+            case Lexer::ID_negation:
+            case Lexer::ID_not: {
+                // Both work on i32s (0 - x, and x == 0).
+                std::optional<Constant> value = ValueOf(operand);
+                if (!value || value->kind != Constant::I32) return std::nullopt;
+                if (node->GetOp() == Lexer::ID_not) return Int(value->i == 0);
+                return Int(-static_cast<int64_t>(value->i));
+            }
+            case Lexer::ID_colon: {
+                // The operand's type has been replaced by the one converted to; its value hasn't.
+                std::optional<Constant> value = RawValueOf(operand);
+                if (!value) return std::nullopt;
+                const DataType to = node->GetDataType();
+                if (to == DataType::INTEGER && value->kind == Constant::F64) {
+                    // i32.trunc_f64_s traps on NaN and on anything out of range.
+                    if (!(value->d > -2147483649.0 && value->d < 2147483648.0)) return std::nullopt;
+                    return Int(static_cast<int32_t>(value->d));
+                }
+                if (to == DataType::DOUBLE && value->kind == Constant::I32) return Double(value->i);
+                if (to == DataType::STRING && value->kind == Constant::I32) return String(CharBytes(value->i));
+                return std::nullopt;
+            }
+            case Lexer::ID_sqrt: {
+                std::optional<Constant> value = ValueOf(operand);
+                if (!value) return std::nullopt;
+                if (value->kind == Constant::I32 && operand->GetDataType() == DataType::INTEGER) return Double(std::sqrt(double(value->i)));
+                if (value->kind == Constant::F64) return Double(std::sqrt(value->d));
+                return std::nullopt;
+            }
+            default:
+                return std::nullopt;
+        }
+    }
+
+    // The value of node, given its (already folded) children; nothing if it isn't constant.
+    std::optional<Constant> Compute(ASTNode* node) {
+        switch (node->Kind()) {
+            case NodeKind::BINARY_OP:
+                return ComputeBinary(static_cast<BinaryOpNode*>(node));
+            case NodeKind::UNARY_OP:
+                return ComputeUnary(static_cast<UnaryOpNode*>(node));
+            case NodeKind::INDEX: {
+                // i32.load8_u of a byte of the string (or its terminating 0).
+                auto* index = static_cast<IndexNode*>(node);
+                std::optional<Constant> str = ValueOf(index->GetVariable());
+                std::optional<Constant> position = ValueOf(index->GetIndexExpression());
+                if (!str || !position || position->i < 0 || static_cast<size_t>(position->i) > str->bytes.size()) return std::nullopt;
+                if (static_cast<size_t>(position->i) == str->bytes.size()) return Int(0);
+                return Int(static_cast<unsigned char>(str->bytes[position->i]));
+            }
+            case NodeKind::FUNCTION_CALL: {
+                auto* call = static_cast<FunctionCallNode*>(node);
+                if (!IsSize(call)) return std::nullopt;
+                std::optional<Constant> str = ValueOf(call->GetArgs()[0]);
+                if (!str) return std::nullopt;
+                return Int(static_cast<int64_t>(str->bytes.size()));
+            }
+            default:
+                return std::nullopt;
+        }
+    }
+
+    // Escape a string's bytes for a WAT data segment.
+    static std::string Escape(std::string_view bytes) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string text;
+        for (char c : bytes) {
+            const unsigned char byte = static_cast<unsigned char>(c);
+            if (byte >= 0x20 && byte < 0x7f && c != '"' && c != '\\') {
+                text += c;
+            } else {
+                text += '\\';
+                text += digits[byte >> 4];
+                text += digits[byte & 15];
+            }
+        }
+        return text;
+    }
+
+    // A literal with the given type and value; nullptr if there isn't an equivalent one.
+    ASTNode* MakeLiteral(DataType type, Constant& value, bool contained) {
+        if (value.kind == Constant::I32 && (type == DataType::INTEGER || type == DataType::CHAR)) {
+            return arena.Make<LiteralValueNode>(type, static_cast<int>(value.i));
+        }
+        if (value.kind == Constant::F64 && type == DataType::DOUBLE && std::isfinite(value.d)) {
+            LiteralValueNode* literal = arena.Make<LiteralValueNode>(type, value.d);
+            literal->SetExact(true);
+            return literal;
+        }
+        if (value.kind == Constant::STRING && type == DataType::STRING && contained) {
+            const std::string* bytes = arena.Make<std::string>(std::move(value.bytes));
+            LiteralStringNode* literal = arena.Make<LiteralStringNode>(0, static_cast<int>(bytes->size()));
+            strings[literal] = *bytes;
+            madeStrings.insert(literal);
+            return literal;
+        }
+        return nullptr;
+    }
+
+    // Remember the constant a propagated local is declared with.
+    void RecordConstant(VariableNode* variable, ASTNode* value) {
+        std::optional<Constant> constant = ValueOf(value);
+        if (!constant) return;
+        const DataType type = variable->GetDataType();
+        if (type == DataType::DOUBLE && constant->kind == Constant::I32) {
+            constant = Double(constant->i); // the assignment converts it
+        }
+        if (value->GetDataType() == type && (value->Kind() == NodeKind::LITERAL_VALUE || value->Kind() == NodeKind::LITERAL_STRING)) {
+            constants[variable->GetUniqueId()] = value;
+        } else if (ASTNode* literal = MakeLiteral(type, *constant, false)) {
+            constants[variable->GetUniqueId()] = literal;
+        }
+    }
+
+    // Fold everything below node; returns what to use in its place (node itself, unless it is a constant expression).
+    ASTNode* Fold(ASTNode* node, bool contained = false) {
+        if (!node) return nullptr;
+        switch (node->Kind()) {
+            case NodeKind::VARIABLE: {
+                auto it = constants.find(static_cast<VariableNode*>(node)->GetUniqueId());
+                if (it == constants.end() || it->second->GetDataType() != node->GetDataType()) return node;
+                numPropagated++;
+                return it->second;
+            }
+            case NodeKind::EXPRESSION: {
+                auto* expression = static_cast<ExpressionNode*>(node);
+                expression->SetExpression(Fold(expression->GetExpression()));
+                break;
+            }
+            case NodeKind::RETURN: {
+                auto* ret = static_cast<ReturnNode*>(node);
+                ret->SetExpression(Fold(ret->GetExpression()));
+                break;
+            }
+            case NodeKind::INDEX: {
+                auto* index = static_cast<IndexNode*>(node);
+                index->SetVariable(Fold(index->GetVariable(), true));
+                index->SetIndexExpression(Fold(index->GetIndexExpression()));
+                break;
+            }
+            case NodeKind::BINARY_OP: {
+                auto* binary = static_cast<BinaryOpNode*>(node);
+                if (binary->GetOp() == Lexer::ID_assignment) {
+                    if (auto* index = NodeAs<IndexNode>(binary->GetIndex())) {
+                        index->SetIndexExpression(Fold(index->GetIndexExpression()));
+                    }
+                    auto* variable = NodeAs<VariableNode>(binary->GetLeft());
+                    const bool propagated = variable && binary->IsDeclaration() && IsPropagated(variable->GetUniqueId());
+                    // A propagated string's only uses are contained, so its value is too.
+                    binary->SetRight(Fold(binary->GetRight(), propagated && variable->GetDataType() == DataType::STRING));
+                    if (propagated) RecordConstant(variable, binary->GetRight());
+                    return node;
+                }
+                const bool concatenation = binary->IsConcatenation();
+                binary->SetLeft(Fold(binary->GetLeft(), concatenation));
+                binary->SetRight(Fold(binary->GetRight(), concatenation));
+                break;
+            }
+            case NodeKind::UNARY_OP: {
+                auto* unary = static_cast<UnaryOpNode*>(node);
+                unary->SetLeft(Fold(unary->GetOperand()));
+                break;
+            }
+            case NodeKind::IF_ELSE: {
+                auto* if_else = static_cast<IfElseNode*>(node);
+                if_else->setCondition(Fold(if_else->GetCondition()));
+                Fold(if_else->GetIfBlock());
+                Fold(if_else->GetElseBlock());
+                return node;
+            }
+            case NodeKind::WHILE: {
+                auto* loop = static_cast<WhileNode*>(node);
+                loop->SetCondition(Fold(loop->GetCondition()));
+                Fold(loop->GetBody());
+                return node;
+            }
+            case NodeKind::BLOCK: {
+                auto* block = static_cast<BlockNode*>(node);
+                for (ASTNode* statement : block->GetStatements()) Fold(statement);
+                return node;
+            }
+            case NodeKind::FUNCTION_CALL: {
+                auto* call = static_cast<FunctionCallNode*>(node);
+                const bool size = IsSize(call);
+                for (size_t i = 0; i < call->GetArgs().size(); i++) call->SetArg(i, Fold(call->GetArgs()[i], size));
+                break;
+            }
+            default:
+                return node; // literals, continue and break
+        }
+
+        std::optional<Constant> value = Compute(node);
+        if (!value) return node;
+        ASTNode* literal = MakeLiteral(node->GetDataType(), *value, contained);
+        if (!literal) return node;
+        numFolded++;
+        return literal;
+    }
+
+    // Give the function the strings that folding made and its code still uses (in the order they're used).
+    void AddMadeStrings(ASTNode* node) {
+        if (!node) return;
+        if (madeStrings.erase(node)) {
+            function->addFoldedString(static_cast<LiteralStringNode*>(node), *arena.Make<std::string>(Escape(strings[node])));
+        }
+        ForEachChild(node, [this](ASTNode* child) { AddMadeStrings(child); });
+    }
+
+public:
+    explicit ConstantFolder(Arena& arena) : arena(arena) {}
+
+    void Fold(Function* function) {
+        this->function = function;
+        locals.clear();
+        constants.clear();
+        strings.clear();
+        madeStrings.clear();
+        for (const auto& [node, str] : function->GetLiteralStrings()) {
+            // Only strings without escapes; their contents are exactly as written.
+            if (node && str.find('\\') == std::string_view::npos) strings[node] = str;
+        }
+
+        for (ASTNode* node : function->GetNodes()) Scan(node);
+        for (ASTNode* node : function->GetNodes()) Fold(node);
+        if (madeStrings.empty()) return;
+        for (ASTNode* node : function->GetNodes()) AddMadeStrings(node);
+    }
+
+    void Fold(const std::vector<Function*>& functions) {
+        for (Function* function : functions) Fold(function);
+    }
+
+    // Number of expressions replaced by their value.
+    size_t NumFolded() const {
+        return numFolded;
+    }
+
+    // Number of reads of a local replaced by the constant it holds.
+    size_t NumPropagated() const {
+        return numPropagated;
+    }
+};
@@ -1,14 +1,19 @@
 #pragma once
 
-#include <iostream>
+#include <assert.h>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-#include "SymbolTable.hpp"
+#include "DataType.hpp"
+#include "Emitter.hpp"
 
 // A struct that contains all of the state information to control compilation.
+// Lines of code are collected (so comments can be aligned) and then printed
+// through an Emitter.
 
 struct Control {
-  SymbolTable symbols{};
   int indent = 0;
   size_t wat_mem_pos = 0;   // Position for generating fixed data in WAT memory.
 
@@ -25,6 +30,16 @@ struct Control {
   };
   std::vector<WAT_Line> code;
 
+  // Concatenate args into a string, formatting numbers as an Emitter does.
+  template <typename... Ts>
+  static std::string Format(Ts &&... args) {
+    std::string str;
+    Emitter out(str, 256);
+    (out << ... << std::forward<Ts>(args));
+    out.Flush();
+    return str;
+  }
+
 public:  // Member functions.
   // Change the amount of indent used.
   Control &  Indent(int diff) {
@@ -34,9 +49,7 @@ public:  // Member functions.
 
   template <typename... Ts>
   Control & Code(Ts &&... args) {
-    std::stringstream ss;
-    (ss << ... << std::forward<Ts>(args));
-    code.emplace_back(indent, ss.str(), "");
+    code.push_back(WAT_Line{indent, Format(std::forward<Ts>(args)...), ""});
     return *this;
   }
 
@@ -54,7 +67,7 @@ public:  // Member functions.
     if (code.back().code.starts_with("(local.get")) {
       code.pop_back();
     } else {
-      code.emplace_back(indent, "(drop)", "Remove unneeded value from stack.");
+      code.push_back(WAT_Line{indent, "(drop)", "Remove unneeded value from stack."});
     }
     return *this;
   }
@@ -62,20 +75,18 @@ public:  // Member functions.
   // Append a comment after the current line of code.
   template <typename... Ts>
   Control & Comment(Ts &&... args) {
-    std::stringstream ss;
-    (ss << ... << std::forward<Ts>(args));
-    code.back().comment = ss.str();
+    code.back().comment = Format(std::forward<Ts>(args)...);
     return *this;
   }
 
   // Special command for a whole-line comment that should indent with the code.
   template <typename... Ts>
   Control & CommentLine(Ts &&... args) {
-    code.emplace_back(indent, "", "");
+    code.push_back(WAT_Line{indent, "", ""});
     return Comment(std::forward<Ts>(args)...);
   }
 
-  void PrintCode(std::ostream & os=std::cout) const {
+  void PrintCode(Emitter & out) const {
     // First, process code to identify the widest line with a comment.
     size_t max_width = 0;
     for (const auto & line : code) {
@@ -86,16 +97,16 @@ public:  // Member functions.
 
     // Print code, line by line.
     for (const auto & line : code) {
-      os << std::string(line.indent, ' '); // Tabbing
-      os << line.code;
+      out << std::string(line.indent, ' '); // Tabbing
+      out << line.code;
       if (line.comment.size()) {
         if (line.code.size()) { // If there is code on this line, align comments.
           size_t gap = max_width - line.code.size() + 2;
-          os << std::string(gap, ' ');
+          out << std::string(gap, ' ');
         }
-        os << ";; " << line.comment;
+        out << ";; " << line.comment;
       }
-      os << std::endl;
+      out << '\n';
     }
   }
 
@@ -131,17 +142,13 @@ public:  // Member functions.
 
   // ----------  Symbol Table Management --------------
 
-  // Declare the set of variable ID's provided here.
-  void WATDeclareSymbols(std::vector<size_t> var_ids) {
+  // Declare the set of variables (type and unique ID) provided here.
+  void WATDeclareSymbols(const std::vector<std::pair<DataType, int>> & vars) {
     // All local symbols must be declared at the beginning of the function.
     CommentLine("Variables");
-    for (size_t i : var_ids) {
-      Code("(local $var", i, " ", WATType(i), ")").Comment("Variable: ", symbols.GetName(i));
+    for (const auto & [type, id] : vars) {
+      Code("(local $var", id, " ", DataType_ToCode(type), ")");
     }
     Code("");
   }
-
-  std::string WATType(size_t var_id) const {
-    return symbols.GetType(var_id).ToWAT();
-  }
 };
@@ -13,3 +13,7 @@ std::string DataType_ToCode(DataType type)
         return "i32"; // for char or int
     return "f64"; // for double
 }
+
+// A STRING is the address of its length (a 32-bit header), which is followed by
+// its bytes and then a 0 byte (so the bytes can also be read as a C string).
+constexpr int STRING_HEADER_SIZE = 4;
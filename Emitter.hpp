@@ -0,0 +1,125 @@
+#pragma once
+
+// A buffered sink for generated code.
+//
+// Code generation produces thousands of tiny fragments; rather than sending
+// each through an ostream, they are copied into one large contiguous buffer
+// (numbers are formatted in place with std::to_chars) and handed to the target
+// a whole chunk at a time -- a single write() per chunk for a file descriptor.
+// The target can be a file descriptor (stdout by default) or a string in memory.
+//
+// Example usage:
+//   Emitter out;                    // Write to stdout.
+//   out << "(i32.const " << 42 << ")\n";
+//   out.Flush();                    // Also done by the destructor.
+//
+//   std::string wat;
+//   Emitter to_memory(wat);         // Append to wat instead.
+
+#include <cerrno>
+#include <charconv>
+#include <concepts>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+class Emitter {
+private:
+  std::unique_ptr<char[]> buffer;
+  size_t used = 0;                    // Bytes waiting in buffer.
+  size_t chunk_size;
+  int fd = -1;                        // Target file descriptor, or -1...
+  std::string * memory = nullptr;     // ...if writing to memory instead.
+  size_t bytes_flushed = 0;
+  size_t num_flushes = 0;
+  bool failed = false;
+
+  // Pass size bytes at data on to the target.
+  void WriteOut(const char * data, size_t size) {
+    if (size == 0) return;
+    ++num_flushes;
+    bytes_flushed += size;
+    if (memory) { memory->append(data, size); return; }
+    while (size > 0 && !failed) {
+      const ssize_t written = ::write(fd, data, size);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        failed = true;
+        break;
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+  }
+
+  // Make sure at least `size` bytes are free at the end of the buffer.
+  void Reserve(size_t size) {
+    if (used + size > chunk_size) Flush();
+  }
+
+public:
+  static constexpr size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+  static constexpr size_t MAX_NUMBER_CHARS = 32;  // Longest number to_chars may produce.
+
+  explicit Emitter(int fd = STDOUT_FILENO, size_t chunk_size = DEFAULT_CHUNK_SIZE)
+    : buffer(std::make_unique_for_overwrite<char[]>(chunk_size)), chunk_size(chunk_size), fd(fd) { }
+  explicit Emitter(std::string & target, size_t chunk_size = DEFAULT_CHUNK_SIZE)
+    : buffer(std::make_unique_for_overwrite<char[]>(chunk_size)), chunk_size(chunk_size), memory(&target) { }
+  Emitter(const Emitter &) = delete;
+  Emitter & operator=(const Emitter &) = delete;
+  ~Emitter() { Flush(); }
+
+  void Flush() {
+    WriteOut(buffer.get(), used);
+    used = 0;
+  }
+
+  // Drop whatever is still buffered (e.g., after a compile error), so it is never written.
+  void Discard() { used = 0; }
+
+  Emitter & Write(const char * data, size_t size) {
+    if (used + size > chunk_size) {
+      Flush();
+      // Too big to be worth copying; pass it straight through.
+      if (size >= chunk_size) { WriteOut(data, size); return *this; }
+    }
+    std::memcpy(buffer.get() + used, data, size);
+    used += size;
+    return *this;
+  }
+
+  Emitter & operator<<(std::string_view str) { return Write(str.data(), str.size()); }
+  Emitter & operator<<(const char * str) { return Write(str, std::strlen(str)); }
+
+  Emitter & operator<<(char c) {
+    Reserve(1);
+    buffer[used++] = c;
+    return *this;
+  }
+
+  template <std::integral T>
+  Emitter & operator<<(T value) {
+    Reserve(MAX_NUMBER_CHARS);
+    char * start = buffer.get() + used;
+    used += static_cast<size_t>(std::to_chars(start, start + MAX_NUMBER_CHARS, value).ptr - start);
+    return *this;
+  }
+
+  // Formatted the same as an ostream's default (6 significant digits, like %g).
+  template <std::floating_point T>
+  Emitter & operator<<(T value) {
+    Reserve(MAX_NUMBER_CHARS);
+    char * start = buffer.get() + used;
+    used += static_cast<size_t>(
+      std::to_chars(start, start + MAX_NUMBER_CHARS, value, std::chars_format::general, 6).ptr - start);
+    return *this;
+  }
+
+  // Total bytes emitted so far, including any still in the buffer.
+  size_t BytesWritten() const { return bytes_flushed + used; }
+  size_t NumFlushes() const { return num_flushes; }
+  // True if a write to the file descriptor failed (e.g., a closed pipe).
+  bool Failed() const { return failed; }
+};
@@ -0,0 +1,352 @@
+#pragma once
+
+// A flat, contiguous copy of a program's AST.
+//
+// Nodes live in a single vector in post-order (every child comes before its
+// parent).  Each one has a kind tag, a cached type and 32-bit child indices, so
+// a pass over the program is a loop over that vector with a switch on the kind
+// rather than a walk through pointers and virtual calls.  A FlatAST can also be
+// written out as bytes and read back.
+//
+// Example usage:
+//   FlatAST flat = FlatAST::Flatten(functions);
+//   size_t depth = flat.MaxDepth();
+//   std::string bytes = flat.Serialize();
+//   FlatAST copy = FlatAST::Deserialize(bytes);
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "DataType.hpp"
+#include "Function.hpp"
+#include "tools.hpp"
+
+// A single node.  Which fields are used depends on its kind:
+//   LITERAL_VALUE   value (int or char), or number (double); flags = exact
+//   VARIABLE        value = the variable's unique id
+//   LITERAL_STRING  value = memory position, op = length
+//   EXPRESSION      child[0] = expression
+//   RETURN          child[0] = expression
+//   INDEX           child[0] = variable, child[1] = index expression
+//   BINARY_OP       op; child[0] = lhs, child[1] = rhs, child[2] = index;
+//                   flags = stack | declaration << 1
+//   UNARY_OP        op; child[0] = operand
+//   IF_ELSE         child[0] = condition, child[1] = if block, child[2] = else block;
+//                   flags = returnInIf | returnInElse << 1
+//   WHILE           child[0] = condition, child[1] = body
+//   CONTINUE_BREAK  flags = isContinue
+//   BLOCK           statements are lists[child[0]] .. lists[child[0] + child[1] - 1]
+//   FUNCTION_CALL   arguments are stored like BLOCK statements; value = index in names
+struct FlatNode {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    NodeKind kind = NodeKind::BLOCK;
+    uint8_t flags = 0;
+    uint8_t type = DataType::INTEGER; // cached result type of an expression
+    uint8_t reserved = 0;
+    int32_t op = 0;
+    int32_t value = 0;
+    uint32_t child[3] = {NONE, NONE, NONE};
+    double number = 0.0;
+
+    DataType Type() const {
+        return static_cast<DataType>(type);
+    }
+};
+static_assert(sizeof(FlatNode) == 32, "FlatNode should fit two to a cache line");
+
+class FlatAST {
+public:
+    struct FlatFunction {
+        uint32_t name; // index in names
+        uint32_t body; // BLOCK node holding the function's statements
+    };
+
+private:
+    std::vector<FlatNode> nodes{};
+    std::vector<uint32_t> lists{};      // children of BLOCK and FUNCTION_CALL nodes
+    std::vector<std::string> names{};   // called function names
+    std::vector<FlatFunction> functions{};
+
+    std::unordered_map<std::string, uint32_t> name_ids{}; // only used while flattening
+
+    static constexpr uint32_t MAGIC = 0x54414c46;  // "FLAT"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t AddName(std::string_view name) {
+        auto [it, inserted] = name_ids.try_emplace(std::string(name), static_cast<uint32_t>(names.size()));
+        if (inserted) names.emplace_back(name);
+        return it->second;
+    }
+
+    // Add the nodes in a list (post-order), then record their ids together.
+    void AddList(const std::vector<ASTNode*>& items, FlatNode& flat) {
+        std::vector<uint32_t> ids;
+        ids.reserve(items.size());
+        for (ASTNode* item : items) ids.push_back(Add(item));
+        flat.child[0] = static_cast<uint32_t>(lists.size());
+        flat.child[1] = static_cast<uint32_t>(ids.size());
+        lists.insert(lists.end(), ids.begin(), ids.end());
+    }
+
+    uint32_t Push(const FlatNode& flat) {
+        nodes.push_back(flat);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    // Add a node and everything below it; returns its index.
+    uint32_t Add(ASTNode* node) {
+        if (!node) return FlatNode::NONE;
+
+        FlatNode flat;
+        flat.kind = node->Kind();
+        switch (node->Kind()) {
+            case NodeKind::LITERAL_VALUE: {
+                auto* literal = static_cast<LiteralValueNode*>(node);
+                if (literal->GetDataType() == DataType::DOUBLE) flat.number = literal->GetDoubleValue();
+                else flat.value = literal->GetIntValue();
+                flat.flags = literal->GetExact();
+                break;
+            }
+            case NodeKind::VARIABLE:
+                flat.value = static_cast<VariableNode*>(node)->GetUniqueId();
+                break;
+            case NodeKind::LITERAL_STRING: {
+                auto* literal = static_cast<LiteralStringNode*>(node);
+                flat.value = literal->getMemoryPos();
+                flat.op = literal->getLength();
+                break;
+            }
+            case NodeKind::EXPRESSION:
+                flat.child[0] = Add(static_cast<ExpressionNode*>(node)->GetExpression());
+                break;
+            case NodeKind::RETURN:
+                flat.child[0] = Add(static_cast<ReturnNode*>(node)->GetExpression());
+                break;
+            case NodeKind::INDEX: {
+                auto* index = static_cast<IndexNode*>(node);
+                flat.child[0] = Add(index->GetVariable());
+                flat.child[1] = Add(index->GetIndexExpression());
+                break;
+            }
+            case NodeKind::BINARY_OP: {
+                auto* binary = static_cast<BinaryOpNode*>(node);
+                flat.op = binary->GetOp();
+                flat.flags = binary->GetStack() | (binary->IsDeclaration() << 1);
+                flat.child[0] = Add(binary->GetLeft());
+                flat.child[1] = Add(binary->GetRight());
+                flat.child[2] = Add(binary->GetIndex());
+                break;
+            }
+            case NodeKind::UNARY_OP: {
+                auto* unary = static_cast<UnaryOpNode*>(node);
+                flat.op = unary->GetOp();
+                flat.child[0] = Add(unary->GetOperand());
+                break;
+            }
+            case NodeKind::IF_ELSE: {
+                auto* if_else = static_cast<IfElseNode*>(node);
+                flat.flags = if_else->GetReturnInIf() | (if_else->GetReturnInElse() << 1);
+                flat.child[0] = Add(if_else->GetCondition());
+                flat.child[1] = Add(if_else->GetIfBlock());
+                flat.child[2] = Add(if_else->GetElseBlock());
+                break;
+            }
+            case NodeKind::WHILE: {
+                auto* loop = static_cast<WhileNode*>(node);
+                flat.child[0] = Add(loop->GetCondition());
+                flat.child[1] = Add(loop->GetBody());
+                break;
+            }
+            case NodeKind::CONTINUE_BREAK:
+                flat.flags = static_cast<ContinueBreakNode*>(node)->IsContinue();
+                break;
+            case NodeKind::BLOCK:
+                AddList(static_cast<BlockNode*>(node)->GetStatements(), flat);
+                break;
+            case NodeKind::FUNCTION_CALL: {
+                auto* call = static_cast<FunctionCallNode*>(node);
+                AddList(call->GetArgs(), flat);
+                flat.value = static_cast<int32_t>(AddName(call->GetFunctionName()));
+                break;
+            }
+            default:
+                Error("Unknown node kind while flattening the AST");
+        }
+
+        if (IsExpressionKind(flat.kind)) flat.type = static_cast<uint8_t>(node->GetDataType());
+        return Push(flat);
+    }
+
+public:
+    // Build a flat copy of the AST of every function.
+    static FlatAST Flatten(const std::vector<Function*>& program) {
+        FlatAST out;
+        for (Function* function : program) {
+            FlatNode body;
+            out.AddList(function->GetNodes(), body);
+            const uint32_t name = out.AddName(function->GetFunctionName());
+            out.functions.push_back({name, out.Push(body)});
+        }
+        out.name_ids.clear();
+        return out;
+    }
+
+    const std::vector<FlatNode>& Nodes() const { return nodes; }
+    const std::vector<uint32_t>& Lists() const { return lists; }
+    const std::vector<std::string>& Names() const { return names; }
+    const std::vector<FlatFunction>& Functions() const { return functions; }
+    size_t Size() const { return nodes.size(); }
+
+    // Call fn(child_id) for each child of node id, in order.
+    template <typename FN>
+    void ForEachChild(uint32_t id, FN&& fn) const {
+        const FlatNode& node = nodes[id];
+        switch (node.kind) {
+            case NodeKind::BLOCK:
+            case NodeKind::FUNCTION_CALL:
+                for (uint32_t i = 0; i < node.child[1]; ++i) fn(lists[node.child[0] + i]);
+                break;
+            default:
+                for (uint32_t child : node.child) {
+                    if (child != FlatNode::NONE) fn(child);
+                }
+        }
+    }
+
+    // Number of nodes of each kind.
+    std::array<size_t, static_cast<size_t>(NodeKind::NUM_KINDS)> CountKinds() const {
+        std::array<size_t, static_cast<size_t>(NodeKind::NUM_KINDS)> counts{};
+        for (const FlatNode& node : nodes) counts[static_cast<size_t>(node.kind)]++;
+        return counts;
+    }
+
+    // Height of the deepest node tree (children always precede their parents,
+    // so one forward pass sees every child before its parent).
+    size_t MaxDepth() const {
+        std::vector<uint32_t> height(nodes.size());
+        uint32_t max_height = 0;
+        for (uint32_t id = 0; id < nodes.size(); ++id) {
+            uint32_t below = 0;
+            ForEachChild(id, [&](uint32_t child) { below = std::max(below, height[child]); });
+            height[id] = below + 1;
+            max_height = std::max(max_height, height[id]);
+        }
+        return max_height;
+    }
+
+    // Structural hash (FNV-1a) of every node, list and name.
+    uint64_t Hash() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) {
+            for (int i = 0; i < 8; ++i) {
+                hash ^= (value >> (8 * i)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        };
+        for (const FlatNode& node : nodes) {
+            uint64_t bits;
+            std::memcpy(&bits, &node.number, sizeof(bits));
+            mix(static_cast<uint64_t>(node.kind) | uint64_t{node.flags} << 8 | uint64_t{node.type} << 16 |
+                static_cast<uint64_t>(static_cast<uint32_t>(node.op)) << 32);
+            mix(static_cast<uint32_t>(node.value));
+            mix(uint64_t{node.child[0]} << 32 | node.child[1]);
+            mix(node.child[2]);
+            mix(bits);
+        }
+        for (uint32_t id : lists) mix(id);
+        for (const std::string& name : names) {
+            for (char c : name) mix(static_cast<unsigned char>(c));
+            mix(name.size());
+        }
+        for (const FlatFunction& function : functions) mix(uint64_t{function.name} << 32 | function.body);
+        return hash;
+    }
+
+    // Write the AST as bytes (in host byte order).
+    std::string Serialize() const {
+        std::string out;
+        auto write = [&out](const void* data, size_t bytes) {
+            out.append(static_cast<const char*>(data), bytes);
+        };
+        const uint32_t header[] = { MAGIC, VERSION, static_cast<uint32_t>(nodes.size()),
+                                    static_cast<uint32_t>(lists.size()), static_cast<uint32_t>(names.size()),
+                                    static_cast<uint32_t>(functions.size()) };
+        write(header, sizeof(header));
+        write(nodes.data(), nodes.size() * sizeof(FlatNode));
+        write(lists.data(), lists.size() * sizeof(uint32_t));
+        write(functions.data(), functions.size() * sizeof(FlatFunction));
+        for (const std::string& name : names) {
+            const uint32_t length = static_cast<uint32_t>(name.size());
+            write(&length, sizeof(length));
+            write(name.data(), name.size());
+        }
+        return out;
+    }
+
+    // Rebuild an AST written by Serialize, checking that it is well formed.
+    static FlatAST Deserialize(std::string_view bytes) {
+        FlatAST out;
+        size_t pos = 0;
+        auto read = [&](void* data, size_t size) {
+            if (bytes.size() - pos < size) Error("Truncated flat AST");
+            std::memcpy(data, bytes.data() + pos, size);
+            pos += size;
+        };
+
+        uint32_t header[6];
+        read(header, sizeof(header));
+        if (header[0] != MAGIC || header[1] != VERSION) Error("Not a flat AST (or wrong version)");
+        // Check sizes against the input before allocating anything.
+        if (header[2] > bytes.size() / sizeof(FlatNode) || header[3] > bytes.size() / sizeof(uint32_t) ||
+            header[4] > bytes.size() || header[5] > bytes.size() / sizeof(FlatFunction)) {
+            Error("Truncated flat AST");
+        }
+        out.nodes.resize(header[2]);
+        out.lists.resize(header[3]);
+        out.names.resize(header[4]);
+        out.functions.resize(header[5]);
+        read(out.nodes.data(), out.nodes.size() * sizeof(FlatNode));
+        read(out.lists.data(), out.lists.size() * sizeof(uint32_t));
+        read(out.functions.data(), out.functions.size() * sizeof(FlatFunction));
+        for (std::string& name : out.names) {
+            uint32_t length = 0;
+            read(&length, sizeof(length));
+            if (bytes.size() - pos < length) Error("Truncated flat AST");
+            name.assign(bytes.substr(pos, length));
+            pos += length;
+        }
+        if (pos != bytes.size()) Error("Unexpected data after flat AST");
+
+        // Children must come before their parents, and lists and names must exist.
+        for (uint32_t id = 0; id < out.nodes.size(); ++id) {
+            const FlatNode& node = out.nodes[id];
+            if (node.kind >= NodeKind::NUM_KINDS) Error("Bad node kind in flat AST");
+            if (node.kind == NodeKind::BLOCK || node.kind == NodeKind::FUNCTION_CALL) {
+                if (node.child[0] > out.lists.size() || node.child[1] > out.lists.size() - node.child[0]) {
+                    Error("Bad child list in flat AST");
+                }
+            }
+            if (node.kind == NodeKind::FUNCTION_CALL && static_cast<uint32_t>(node.value) >= out.names.size()) {
+                Error("Bad function name in flat AST");
+            }
+            out.ForEachChild(id, [&](uint32_t child) {
+                if (child >= id) Error("Bad child index in flat AST");
+            });
+        }
+        for (const FlatFunction& function : out.functions) {
+            if (function.name >= out.names.size() || function.body >= out.nodes.size() ||
+                out.nodes[function.body].kind != NodeKind::BLOCK) {
+                Error("Bad function in flat AST");
+            }
+        }
+        return out;
+    }
+};
@@ -1,9 +1,14 @@
 #pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include "DataType.hpp"
+#include "WasmWriter.hpp"
 #include <vector>
 #include "lexer.hpp"
-//#include "ASTNode.hpp"
+#include "ASTNode.hpp"
 
 
 
@@ -11,38 +16,244 @@
 class Function{
 private:
     int id = 0;
-    emplex::Token identifier;
+    std::string_view name; // view into the source text
+    int symbol = -1;       // interned name (see InternTable)
     DataType returnType;
     std::vector<std::pair<DataType, int>> args{}; // pairs of function arguments in function signature: <DataType, unique id in the SymbolTable>
     std::vector<std::pair<DataType, int>> localVars{}; // local variables declared in function body
     std::vector<ASTNode*> nodes{};
+    // literal strings used in this function, in order; they're placed in memory once every function is parsed
+    std::vector<std::pair<LiteralStringNode*, std::string_view>> literalStrings{};
+    // strings made by constant folding; they go after every function's literal strings, so
+    // folding never moves the strings that (possibly cached) code for other functions uses
+    std::vector<std::pair<LiteralStringNode*, std::string_view>> foldedStrings{};
+    bool usesConcatN = false; // has a concatenation joined by $concat_n (so it needs $part locals)
 
-    static std::vector<std::string> literalStrings;
+    // What the body does with one of its string variables, to choose its StringOwnership.
+    struct StringVar {
+        int id;
+        bool param;
+        bool assigned = false;    // given a new string in the body
+        bool holdsNew = false;    // ... that was made just for it
+        bool holdsShared = false; // ... that something else may hold
+        bool passedOn = false;    // its string is given to a function or concatenation, another variable, or the caller
+        StringOwnership ownership = StringOwnership::NONE;
+    };
+
+    struct StringUses {
+        std::vector<StringVar> vars;
+        std::vector<std::pair<BinaryOpNode*, size_t>> assignments; // to each of vars
+        bool sharedReturn = false; // may return a string that one of its variables holds
+
+        StringVar* Find(int id, size_t* index = nullptr) {
+            for (size_t i = 0; i < vars.size(); i++) {
+                if (vars[i].id != id) continue;
+                if (index) *index = i;
+                return &vars[i];
+            }
+            return nullptr;
+        }
+    };
+
+    // Note how node uses string variables; passedOn is whether the value node
+    // makes is given to code that may keep or release it.
+    static void NoteStringUses(ASTNode* node, bool passedOn, StringUses& uses) {
+        switch (node->Kind()) {
+            case NodeKind::VARIABLE: {
+                StringVar* var = uses.Find(static_cast<VariableNode*>(node)->GetUniqueId());
+                if (var && passedOn) var->passedOn = true;
+                return;
+            }
+            case NodeKind::EXPRESSION:
+                NoteStringUses(static_cast<ExpressionNode*>(node)->GetExpression(), passedOn, uses);
+                return;
+            case NodeKind::RETURN: {
+                ASTNode* expression = static_cast<ReturnNode*>(node)->GetExpression();
+                const StringSource source = SourceOf(expression);
+                if (source == StringSource::VARIABLE || source == StringSource::OTHER) uses.sharedReturn = true;
+                NoteStringUses(expression, true, uses);
+                return;
+            }
+            case NodeKind::BINARY_OP: {
+                auto* binary = static_cast<BinaryOpNode*>(node);
+                if (binary->GetOp() == Lexer::ID_assignment) {
+                    auto* variable = NodeAs<VariableNode>(binary->GetLeft());
+                    size_t index = 0;
+                    StringVar* var = variable ? uses.Find(variable->GetUniqueId(), &index) : nullptr;
+                    if (var && !binary->GetIndex()) {
+                        const StringSource source = SourceOf(binary->GetRight());
+                        var->assigned = true;
+                        var->holdsNew |= source == StringSource::NEW;
+                        var->holdsShared |= source == StringSource::VARIABLE || source == StringSource::OTHER;
+                        uses.assignments.push_back({binary, index});
+                    }
+                    NoteStringUses(binary->GetRight(), true, uses);
+                    if (binary->GetIndex()) NoteStringUses(binary->GetIndex(), false, uses);
+                    return;
+                }
+                // concatenations and repeats release strings that nothing holds
+                const bool joins = SourceOf(binary) == StringSource::NEW;
+                NoteStringUses(binary->GetLeft(), joins, uses);
+                NoteStringUses(binary->GetRight(), joins, uses);
+                return;
+            }
+            case NodeKind::FUNCTION_CALL: {
+                auto* call = static_cast<FunctionCallNode*>(node);
+                for (ASTNode* arg : call->GetArgs()) NoteStringUses(arg, call->GetFunctionName() != "get_length", uses);
+                return;
+            }
+            default:
+                ForEachChild(node, [&uses](ASTNode* child) { NoteStringUses(child, false, uses); });
+                return;
+        }
+    }
+
+    // Choose how each string variable's strings are kept alive, and tell its assignments.
+    StringUses CountReferences() {
+        StringUses uses;
+        for (auto& arg : args) {
+            if (arg.first == DataType::STRING) uses.vars.push_back({arg.second, true});
+        }
+        for (auto& var : localVars) {
+            if (var.first == DataType::STRING) uses.vars.push_back({var.second, false});
+        }
+        if (uses.vars.empty()) return uses;
+
+        for (auto& node : nodes) NoteStringUses(node, false, uses);
+        for (StringVar& var : uses.vars) {
+            if (var.param) {
+                // the caller's string may be new, and it's this function's to release
+                var.ownership = (var.assigned || var.passedOn) ? StringOwnership::COUNTED : StringOwnership::BORROWED;
+            } else if (!var.holdsNew && !var.holdsShared) {
+                var.ownership = StringOwnership::NONE;
+            } else {
+                var.ownership = (var.holdsShared || var.passedOn) ? StringOwnership::COUNTED : StringOwnership::OWNED;
+            }
+        }
+        for (auto& [assignment, index] : uses.assignments) assignment->SetOwnership(uses.vars[index].ownership);
+        return uses;
+    }
 public:
-    Function(int id, const emplex::Token& identifier, const DataType& returnType, const std::vector<std::pair<DataType, int>>& arguments)
-        : id(id), identifier(identifier), returnType(returnType), args(arguments) {}
+    Function(int id, std::string_view name, int symbol, const DataType& returnType, const std::vector<std::pair<DataType, int>>& arguments)
+        : id(id), name(name), symbol(symbol), returnType(returnType), args(arguments) {}
+
+    void SetUsesConcatN() {
+        usesConcatN = true;
+    }
 
     void AddNode(ASTNode* node) {
         nodes.push_back(node);
     }
 
-    std::string GetFunctionName() {
-        return identifier.lexeme;
+    const std::vector<ASTNode*>& GetNodes() const {
+        return nodes;
+    }
+
+    int GetId() const {
+        return id;
     }
 
-    static void addLiteralString(std::string str) {
-        Function::literalStrings.push_back(str);
+    std::string_view GetFunctionName() {
+        return name;
     }
 
-    static void GenerateLiteralStrings() {
+    int GetSymbol() {
+        return symbol;
+    }
+
+    // node may be null when the function's code is reused rather than generated.
+    void addLiteralString(LiteralStringNode* node, std::string_view str) {
+        literalStrings.push_back({node, str});
+    }
+
+    const std::vector<std::pair<LiteralStringNode*, std::string_view>>& GetLiteralStrings() const {
+        return literalStrings;
+    }
+
+    // str is as it appears in the WAT data segment (escaped, without quotes).
+    void addFoldedString(LiteralStringNode* node, std::string_view str) {
+        foldedStrings.push_back({node, str});
+    }
+
+    bool HasFoldedStrings() const {
+        return !foldedStrings.empty();
+    }
+
+    // Number of bytes in a string as written in a WAT data segment (with its escapes decoded).
+    static int StringSize(std::string_view str) {
+        size_t i = str.find('\\');
+        if (i == std::string_view::npos) return static_cast<int>(str.size());
+        int size = static_cast<int>(i);
+        for (; i < str.size(); i++, size++) {
+            if (str[i] != '\\') continue;
+            i++;
+            if (i < str.size() && str[i] == 'u') { // \u{hex}: a code point, in UTF-8
+                const size_t end = str.find('}', i);
+                const uint32_t code = static_cast<uint32_t>(std::stoul(std::string(str.substr(i + 2, end - i - 2)), nullptr, 16));
+                size += (code >= 0x80) + (code >= 0x800) + (code >= 0x10000);
+                i = end;
+            } else if (i < str.size() && std::isxdigit(static_cast<unsigned char>(str[i]))) {
+                i++; // two hex digits
+            }
+        }
+        return size;
+    }
+
+    // Memory a string takes: its length header, its bytes and a 0 byte.
+    static int StringFootprint(std::string_view str) {
+        return STRING_HEADER_SIZE + StringSize(str) + 1;
+    }
+
+    // Give this function's literal strings memory positions starting at memoryPos; returns the next free position.
+    int PlaceLiteralStrings(int memoryPos) {
+        for (auto& [node, str] : literalStrings) {
+            if (node) node->SetMemoryPos(memoryPos); // no node if the code came from a cache
+            memoryPos += StringFootprint(str);
+        }
+        return memoryPos;
+    }
+
+    // Likewise for the strings made by constant folding, once every function's literal strings are placed.
+    int PlaceFoldedStrings(int memoryPos) {
+        for (auto& [node, str] : foldedStrings) {
+            node->SetMemoryPos(memoryPos);
+            memoryPos += StringFootprint(str);
+        }
+        return memoryPos;
+    }
+
+    // One string in the data segment: its length (little-endian), then its bytes and a 0;
+    // returns the position after it.
+    static int GenerateString(WasmWriter & out, int memoryPos, std::string_view str) {
+        static constexpr char digits[] = "0123456789abcdef";
+        const int size = StringSize(str);
+        char header[3 * STRING_HEADER_SIZE];
+        for (int i = 0; i < STRING_HEADER_SIZE; i++) {
+            const uint32_t byte = (static_cast<uint32_t>(size) >> (8 * i)) & 0xff;
+            header[3 * i] = '\\';
+            header[3 * i + 1] = digits[byte >> 4];
+            header[3 * i + 2] = digits[byte & 15];
+        }
+        out.Data(memoryPos, std::string_view(header, sizeof(header)), str, "\\00");
+        return memoryPos + STRING_HEADER_SIZE + size + 1;
+    }
+
+    // Every function's literal strings, then the strings folding made; returns where they end.
+    static int GenerateLiteralStrings(WasmWriter & out, const std::vector<Function*>& functions) {
         int memoryPos = 0;
 
-        for (auto& str : Function::literalStrings) {
-            std::cout << "(data (i32.const " << memoryPos << ") \"" << str << "\\00\")\n";
-            memoryPos += str.length() + 1;
+        for (Function* function : functions) {
+            for (auto& [node, str] : function->literalStrings) {
+                memoryPos = GenerateString(out, memoryPos, str);
+            }
+        }
+        for (Function* function : functions) {
+            for (auto& [node, str] : function->foldedStrings) {
+                memoryPos = GenerateString(out, memoryPos, str);
+            }
         }
 
-        std::cout << "(global $free_mem (mut i32) (i32.const " << memoryPos << "))\n";
+        return memoryPos;
     }
 
     DataType GetReturnType() {
@@ -60,43 +271,72 @@ public:
         return args;
     }
 
-    void GenerateCode() {
+    void GenerateCode(WasmWriter & out) {
         // function name
-        std::cout << "(func $" << identifier.lexeme << " ";
+        out.Func(name);
 
         // function arguments
         for (auto& arg : args)
         {
-            std::cout << "(param $var" << arg.second << " " << DataType_ToCode(arg.first) << ") ";
+            out.Param({"var", arg.second}, ToWasmType(arg.first));
         }
 
         // return type
-        std::cout << "(result " << DataType_ToCode(returnType) << ")\n";
+        out.Result(ToWasmType(returnType));
 
         //local variables 
         for (auto& var : localVars) {
-            std::cout << "(local $var" << var.second <<" " << DataType_ToCode(var.first) << ")\n";
+            out.Local({"var", var.second}, ToWasmType(var.first));
+        }
+
+        // locals holding the parts of string concatenations until they're joined
+        int numParts = 0;
+        if (usesConcatN) {
+            for (auto& node : nodes) numParts = std::max(numParts, PlaceConcatParts(node, 0));
+        }
+        for (int i = 0; i < numParts; i++) {
+            out.Local({"part", i}, WasmType::I32);
         }
 
 
+        // a string parameter that's kept or passed on is held for as long as the function runs
+        StringUses uses = CountReferences();
+        for (StringVar& var : uses.vars) {
+            if (var.param && var.ownership == StringOwnership::COUNTED)
+                out.LocalGet({"var", var.id}).Call("retain").Op(WasmOp::DROP);
+        }
+
         // block
-        std::cout << "(block $fun_exit" << id << " (result " << DataType_ToCode(returnType) << ")\n";
+        out.Block({"fun_exit", id}, ToWasmType(returnType));
 
 
         // nodes
         for (auto& node : nodes)
-            node->GenerateCode();
+            node->GenerateCode(out);
 
         // close block
-        std::cout << ")   ;; end of function block.\n";
+        out.End().Note("   ;; end of function block.");
+
+        // let go of the strings in its variables; a result one of them holds is kept
+        // (with a count that doesn't include them) for the caller
+        const bool keepResult = returnType == DataType::STRING && uses.sharedReturn &&
+            std::any_of(uses.vars.begin(), uses.vars.end(), [](const StringVar& var) {
+                return var.ownership != StringOwnership::NONE;
+            });
+        if (keepResult) out.Call("retain");
+        for (StringVar& var : uses.vars) {
+            if (var.ownership == StringOwnership::NONE) continue;
+            out.LocalGet({"var", var.id});
+            if (var.ownership == StringOwnership::BORROWED) out.Call("release_temp");
+            else if (var.ownership == StringOwnership::OWNED) out.Call("free");
+            else out.Call("release");
+        }
+        if (keepResult) out.Call("disown");
 
-        std::cout << ")   ;; end of function definition\n";
+        out.EndFunc().Note("   ;; end of function definition");
 
         // export function
 
-        std::cout << "(export \"" << identifier.lexeme << "\" (func $" << identifier.lexeme << "))\n"; 
+        out.Export(name, name);
     }
 };
-
-
-std::vector<std::string> Function::literalStrings;
\ No newline at end of file
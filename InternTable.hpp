@@ -0,0 +1,43 @@
+#pragma once
+
+// Maps identifier names to small, dense integer symbols.
+//
+// Each distinct name is stored once; after lexing, the parser, SymbolTable and
+// function lookups compare these integers instead of strings.  Names are views
+// into the source text, so the source must outlive the table.
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class InternTable {
+private:
+  std::unordered_map<std::string_view, int> ids{};
+  std::vector<std::string_view> names{};
+
+public:
+  // Return the symbol for a name, adding it if it is new.
+  int Intern(std::string_view name) {
+    auto [it, inserted] = ids.try_emplace(name, static_cast<int>(names.size()));
+    if (inserted) names.push_back(name);
+    return it->second;
+  }
+
+  // Return the symbol for a name, or -1 if it has never been seen.
+  int Find(std::string_view name) const {
+    auto it = ids.find(name);
+    return (it == ids.end()) ? -1 : it->second;
+  }
+
+  std::string_view Name(int symbol) const {
+    if (symbol < 0 || symbol >= static_cast<int>(names.size())) return "";
+    return names[static_cast<size_t>(symbol)];
+  }
+
+  size_t Size() const { return names.size(); }
+
+  void Clear() {
+    ids.clear();
+    names.clear();
+  }
+};
@@ -1,21 +1,49 @@
 #pragma once
 #include "TokenQueue.hpp"
 #include <vector>
+#include "Arena.hpp"
 #include "ASTNode.hpp"
 #include "Function.hpp"
 #include "SymbolTable.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 using namespace emplex;
 
 // source - https://github.com/MSU-CSE450/project-3-tubular-icterines/
 
+// Parsing happens in two phases.  First, the token stream is skimmed for
+// function signatures; each is added to a table (so calls can refer to any
+// function, including ones defined later), along with the range of tokens its
+// body covers.  Then every body is parsed on its own, by a Parser with its own
+// SymbolTable over just that range -- in parallel, if there are threads to
+// spare.  If the tokens are streamed rather than loaded, there are no ranges to
+// slice, so the bodies are parsed in order on a second pass over the stream.
+
 class Parser {
+public:
+    // a function found by the first pass, and the tokens it spans
+    struct FunctionRange {
+        Function* function;
+        size_t begin;
+        size_t end;
+    };
+
 private:
-    TokenQueue tokens;
+    using FunctionTable = std::unordered_map<int, Function*>; // keyed by the function's interned name
+
+    TokenQueue & tokens;
+    Arena & arena; // owns every node and Function made while parsing
     std::vector<Function*> functions{};
-    SymbolTable* symbols = nullptr;
+    std::vector<FunctionRange> ranges{};
+    FunctionTable functionTable{};
+    const FunctionTable* calls = &functionTable; // table used to resolve calls (shared with body parsers)
+    SymbolTable symbols; // reset for every function
     Function* currentFunction = nullptr;
 
     bool pastReturnInMainScope = false; // for error test case 7 (project 4)
@@ -36,9 +64,6 @@ private:
     // counts number of returns help with knowing if there is a guaranteed return in a function
     int numReturns = 0;
 
-    // index to a free memory position
-    int memoryPos = 0;
-
     void addReturnIfElse() {
         if (!returnInIf) {
             returnInIf = true;
@@ -47,24 +72,109 @@ private:
         returnInElse = true;
     }
 
-    void parseFunction() {
-        symbols = new SymbolTable(); // create new SymbolTable for every function
+    // First pass: read one function's signature and skip over its body.
+    void scanFunction() {
+        symbols.Reset(); // each function starts with no variables
+        const size_t begin = tokens.Position();
         tokens.Use(Lexer::ID_function, "Expected function declaration");
+        const size_t line = tokens.CurLine();
+
+        Function* function = parseFunctionSignature();
+
+        // skip the body, matching up braces
+        tokens.Use(Lexer::ID_open_brace);
+        for (int depth = 1; depth > 0; ) {
+            if (tokens.None()) Error(tokens.CurLine(), "Expected '}' at the end of function ", function->GetFunctionName());
+            const int id = tokens.Use().id;
+            if (id == Lexer::ID_open_brace) depth++;
+            else if (id == Lexer::ID_close_brace) depth--;
+        }
+
+        if (!functionTable.emplace(function->GetSymbol(), function).second)
+            Error(line, "Function ", function->GetFunctionName(), " is defined more than once");
+        functions.push_back(function);
+        ranges.push_back({function, begin, tokens.Position()});
+    }
+
+    // Second pass: parse the body of a function whose signature has been scanned.
+    void parseFunction(Function* function) {
+        symbols.Reset(); // each function starts with no variables
+        currentFunction = function;
 
-        currentFunction = parseFunctionSignature();
+        // declare the arguments again, in this parser's SymbolTable
+        tokens.Use(Lexer::ID_function);
+        tokens.Use(Lexer::ID_identifier);
+        parseParameters();
+        tokens.Use(Lexer::ID_colon);
+        UseDataType();
 
         tokens.Use(Lexer::ID_open_brace);
         parseFunctionBody(currentFunction); // parse everything between { }
         tokens.Use(Lexer::ID_close_brace);
         if (returnInIf && numReturns < 2)
             Error("Function does not have a guaranteed return");
+    }
 
-        functions.push_back(currentFunction);
-        pastReturnInMainScope = false; // reset for a new function
+    // Parse the body in tokens [begin, end) with a new Parser, allocating from bodyArena.
+    void parseBody(const FunctionRange& range, Arena& bodyArena) const {
+        TokenQueue bodyTokens = tokens.Slice(range.begin, range.end);
+        Parser bodyParser(bodyTokens, bodyArena, *calls);
+        bodyParser.parseFunction(range.function);
+    }
+
+    void parseBodies(size_t numThreads, const std::vector<bool>& skip) {
+        auto skipped = [&](size_t i) { return i < skip.size() && skip[i]; };
+        if (tokens.IsStreaming()) {
+            tokens.Restart();
+            for (size_t i = 0; i < ranges.size(); i++) {
+                if (skipped(i)) {
+                    while (tokens.Position() < ranges[i].end) tokens.Use();
+                    continue;
+                }
+                Parser bodyParser(tokens, arena, *calls);
+                bodyParser.parseFunction(ranges[i].function);
+                assert(tokens.Position() == ranges[i].end);
+            }
+            return;
+        }
+        if (numThreads == 1) {
+            for (size_t i = 0; i < ranges.size(); i++) {
+                if (!skipped(i)) parseBody(ranges[i], arena);
+            }
+            return;
+        }
+
+        // Split the functions into contiguous batches, each with its own arena, since
+        // arenas are not thread-safe.  There are several batches per thread to balance the load.
+        ThreadPool pool(numThreads);
+        const size_t numBatches = std::min(ranges.size(), pool.NumThreads() * 4);
+        std::vector<Arena*> batchArenas;
+        for (size_t batch = 0; batch < numBatches; batch++) {
+            batchArenas.push_back(arena.Make<Arena>()); // freed along with the main arena
+        }
+        pool.ParallelFor(numBatches, [&](size_t batch) {
+            const size_t first = batch * ranges.size() / numBatches;
+            const size_t last = (batch + 1) * ranges.size() / numBatches;
+            for (size_t i = first; i < last; i++) {
+                if (!skipped(i)) parseBody(ranges[i], *batchArenas[batch]);
+            }
+        });
     }
 
     Function* parseFunctionSignature() {
         auto function_identifier = tokens.Use(Lexer::ID_identifier, "Expected function identifier");
+        std::vector<std::pair<DataType, int>> args = parseParameters();
+        tokens.Use(Lexer::ID_colon);
+
+        DataType returnType = UseDataType();
+
+        Function* currentFunction = arena.Make<Function>(functions.size()+1, tokens.Lexeme(function_identifier),
+                                                 function_identifier.symbol, returnType, args);
+        return currentFunction;
+    }
+
+    // Parse "(type name, ...)", declaring each argument as a variable.
+    std::vector<std::pair<DataType, int>> parseParameters() {
         tokens.Use(Lexer::ID_open_parenthesis);
         
         // arguments
@@ -73,18 +183,13 @@ private:
         {
             DataType type = UseDataType();
             Token identifier = tokens.Use(Lexer::ID_identifier);
-            int variable_unique_id = symbols->InitializeVar(identifier.lexeme, type);
+            int variable_unique_id = symbols.InitializeVar(identifier.symbol, type);
             args.push_back({type, variable_unique_id});
             tokens.UseIf(Lexer::ID_comma); 
         }
 
         tokens.Use(Lexer::ID_close_parenthesis);
-        tokens.Use(Lexer::ID_colon);
-
-        DataType returnType = UseDataType();
-
-        Function* currentFunction = new Function(functions.size()+1, function_identifier, returnType, args);
-        return currentFunction;
+        return args;
     }
 
     void parseFunctionBody(Function* currentFunction) {
@@ -111,15 +216,15 @@ private:
         if (tokens.Peek().id == Lexer::ID_open_brace) {
             body = parseBlock(); // Block enclosed in braces
         } else {
-            symbols->PushScope();
+            symbols.PushScope();
             body = ParseStatement(); // Single statement as body
-            symbols->PopScope();
+            symbols.PopScope();
         }
 
         insideWhileStack.pop_back();
 
         // Create a WhileNode with the condition and body
-        return new WhileNode(condition, body);
+        return arena.Make<WhileNode>(condition, body);
     }
 
     ASTNode* parseIndexing(VariableNode* variable = nullptr) {
@@ -128,8 +233,8 @@ private:
 
         if (variable == nullptr) {
             Token variableToken = tokens.Use(Lexer::ID_identifier);
-            unique_id = symbols->GetUniqueId(variableToken.lexeme);
-            varType = symbols->GetDataType(unique_id);
+            unique_id = symbols.GetUniqueId(variableToken.symbol);
+            varType = symbols.GetDataType(unique_id);
         }
         else {
             unique_id = variable->GetUniqueId();
@@ -154,8 +259,8 @@ private:
         tokens.Use(Lexer::ID_close_bracket); // Consume ']'
 
         // Create and return an IndexNode
-        VariableNode* variableNode = new VariableNode(unique_id, varType);
-        return new IndexNode(variableNode, indexExpression);
+        VariableNode* variableNode = arena.Make<VariableNode>(unique_id, varType);
+        return arena.Make<IndexNode>(variableNode, indexExpression);
     }
 
 
@@ -206,7 +311,7 @@ private:
                     Error("Continue statement outside of a loop");
                     return nullptr;
                 }
-                ASTNode* node = new ContinueBreakNode(true);
+                ASTNode* node = arena.Make<ContinueBreakNode>(true);
                 tokens.Use(Lexer::ID_continue);
                 tokens.Use(Lexer::ID_semicolon);
                 return node;
@@ -216,13 +321,13 @@ private:
                     Error("Break statement outside of a loop");
                     return nullptr;
                 }
-                ASTNode* node = new ContinueBreakNode(false);
+                ASTNode* node = arena.Make<ContinueBreakNode>(false);
                 tokens.Use(Lexer::ID_break);
                 tokens.Use(Lexer::ID_semicolon);
                 return node;
             }
             default:
-                Error("Encountered inappropriate lexeme in ParseStatement: " + tokens.Peek().lexeme + "\n");
+                Error("Encountered inappropriate lexeme in ParseStatement: ", tokens.CurLexeme(), "\n");
                 return nullptr;
 
         }
@@ -233,9 +338,9 @@ private:
         // for return we just need to put the result of the expression on top of the stack
         tokens.Use();
         ASTNode* expression = parseLogical();
-        ReturnNode* node = new ReturnNode(expression);
+        ReturnNode* node = arena.Make<ReturnNode>(expression);
 
-        if (!symbols->InsideTheScope())
+        if (!symbols.InsideTheScope())
             pastReturnInMainScope = true;
         return node;
     }
@@ -243,17 +348,11 @@ private:
     ASTNode* parseFunctionCall() {
         Token identifier = tokens.Use(Lexer::ID_identifier);
         
-        Function* functionToCall = nullptr;
-        for (auto func : functions) {
-            if (func->GetFunctionName() == identifier.lexeme) {
-                functionToCall = func;
-                break;
-            }
-        }
-
-        if (functionToCall == nullptr) {
-            Error("Function " + identifier.lexeme + " does not exist");
+        auto found = calls->find(identifier.symbol);
+        if (found == calls->end()) {
+            Error("Function ", tokens.Lexeme(identifier), " does not exist");
         }
+        Function* functionToCall = found->second;
         
         tokens.Use(Lexer::ID_open_parenthesis);
         
@@ -268,11 +367,11 @@ private:
 
         auto functionArgs = functionToCall->getArgs();
         if (args.size() != static_cast<std::size_t>(functionToCall->GetNumberOfArguments())) {
-            Error("Incorrect number of arguments were provided to the function " + functionToCall->GetFunctionName());
+            Error("Incorrect number of arguments were provided to the function ", functionToCall->GetFunctionName());
         }
 
         // type checking (doesn't work properly)
-        for (int i = 0; i < args.size(); i++) {
+        for (size_t i = 0; i < args.size(); i++) {
             if (args[i]->GetDataType() != functionArgs[i].first) {
                 Error("Argument type mismatch in a function call");
             }
@@ -280,7 +379,7 @@ private:
 
         tokens.Use(Lexer::ID_close_parenthesis);
         
-        return new FunctionCallNode(functionToCall->GetFunctionName(), functionToCall->GetReturnType(), args);
+        return arena.Make<FunctionCallNode>(functionToCall->GetFunctionName(), functionToCall->GetReturnType(), args);
     }
 
     ASTNode* parseIdentifier() {
@@ -292,8 +391,8 @@ private:
 
         // otherwise parse it as a variable
         Token variable = tokens.Use(Lexer::ID_identifier);
-        int unique_id = symbols->GetUniqueId(variable.lexeme);
-        VariableNode* variableNode = new VariableNode(unique_id, symbols->GetDataType(unique_id));
+        int unique_id = symbols.GetUniqueId(variable.symbol);
+        VariableNode* variableNode = arena.Make<VariableNode>(unique_id, symbols.GetDataType(unique_id));
 
         return variableNode;
 
@@ -304,7 +403,7 @@ private:
         while (tokens.Peek().id == Lexer::ID_and) {
             emplex::Token and_op = tokens.Use();
             ASTNode* right_node = parseComparison();
-            BinaryOpNode* and_node = new BinaryOpNode(and_op);
+            BinaryOpNode* and_node = arena.Make<BinaryOpNode>(and_op);
             and_node->SetLeft(node);
             and_node->SetRight(right_node);
             node = and_node;
@@ -313,10 +412,10 @@ private:
     }
 
 
-    ASTNode* parseAssignment() {
+    BinaryOpNode* parseAssignment() {
         Token variable = tokens.Use(Lexer::ID_identifier);
-        int unique_id = symbols->GetUniqueId(variable.lexeme);
-        VariableNode* variableNode = new VariableNode(unique_id, symbols->GetDataType(unique_id));
+        int unique_id = symbols.GetUniqueId(variable.symbol);
+        VariableNode* variableNode = arena.Make<VariableNode>(unique_id, symbols.GetDataType(unique_id));
 
         ASTNode* indexNode = nullptr;
 
@@ -326,7 +425,7 @@ private:
 
         Token equalityOp = tokens.Use(Lexer::ID_assignment);
         ASTNode* expression = parseLogical();
-        BinaryOpNode* assignmentNode = new BinaryOpNode(equalityOp);
+        BinaryOpNode* assignmentNode = arena.Make<BinaryOpNode>(equalityOp);
         
         assignmentNode->SetLeft(variableNode);
         assignmentNode->SetRight(expression);
@@ -337,17 +436,17 @@ private:
     }
 
     ASTNode* parseBlock() {
-        symbols->PushScope();
+        symbols.PushScope();
 
         tokens.Use(Lexer::ID_open_brace);
-        BlockNode* block = new BlockNode();
+        BlockNode* block = arena.Make<BlockNode>();
         while (tokens.Peek().id != Lexer::ID_close_brace) {
             ASTNode* statement = ParseStatement();
             block->addStatement(statement);
         }
         tokens.Use(Lexer::ID_close_brace);
 
-        symbols->PopScope();
+        symbols.PopScope();
         return block;
     }
     ASTNode* parseIf() {
@@ -370,10 +469,10 @@ private:
             }
         } else {
             // single-line if
-            symbols->PushScope();
+            symbols.PushScope();
             
             ifBlock = ParseStatement();
-            symbols->PopScope();
+            symbols.PopScope();
         }
 
         ASTNode* elseBlock = nullptr;
@@ -383,14 +482,14 @@ private:
             if (tokens.Peek().id == Lexer::ID_open_brace) {
                 elseBlock = parseBlock();
             } else {
-                symbols->PushScope();
+                symbols.PushScope();
                 elseBlock = ParseStatement();
-                symbols->PopScope();
+                symbols.PopScope();
             }
             
         }
 
-        IfElseNode* node = new IfElseNode(returnInIf, returnInElse);
+        IfElseNode* node = arena.Make<IfElseNode>(returnInIf, returnInElse, currentFunction->GetId());
         node->setCondition(condition);
         node->setIfBlock(ifBlock);
         node->setElseBlock(elseBlock);
@@ -407,7 +506,7 @@ private:
         while (tokens.Peek().id == Lexer::ID_or) {
             emplex::Token or_op = tokens.Use();
             ASTNode* right_node = parseAnd();
-            BinaryOpNode* or_node = new BinaryOpNode(or_op);
+            BinaryOpNode* or_node = arena.Make<BinaryOpNode>(or_op);
             or_node->SetLeft(node);
             or_node->SetRight(right_node);
             node = or_node;
@@ -432,7 +531,7 @@ private:
             emplex::Token comparison_op = tokens.Use();
             ASTNode* right_node = parseExpression();
             
-            BinaryOpNode* binary_op_node = new BinaryOpNode(comparison_op);
+            BinaryOpNode* binary_op_node = arena.Make<BinaryOpNode>(comparison_op);
             binary_node_count++;
 
             if (binary_node_count > 1) {
@@ -460,9 +559,12 @@ private:
                 return nullptr;
             }
 
-            BinaryOpNode* binary_op_node = new BinaryOpNode(binary_op);
+            BinaryOpNode* binary_op_node = arena.Make<BinaryOpNode>(binary_op);
             binary_op_node->SetLeft(node);
             binary_op_node->SetRight(right_node);
+            if (binary_op_node->IsConcatenation() && !binary_op_node->JoinsTwoStrings()) {
+                currentFunction->SetUsesConcatN(); // code generation will need $part locals
+            }
             node = binary_op_node;
         }
 
@@ -525,7 +627,7 @@ private:
                 }
             }
 
-            BinaryOpNode* binary_op_node = new BinaryOpNode(binary_op);
+            BinaryOpNode* binary_op_node = arena.Make<BinaryOpNode>(binary_op);
             binary_op_node->SetLeft(node);
             binary_op_node->SetRight(right_node);
             node = binary_op_node;
@@ -540,7 +642,7 @@ private:
         if (tokens.Peek().id == Lexer::ID_not) {
             emplex::Token not_token = tokens.Use();
             ASTNode* operand = parseFactor();
-            UnaryOpNode* not_node = new UnaryOpNode(not_token);
+            UnaryOpNode* not_node = arena.Make<UnaryOpNode>(not_token);
             not_node->SetLeft(operand);
             return not_node;
         }
@@ -553,7 +655,7 @@ private:
         if (tokens.Peek().id == Lexer::ID_negation) {
             emplex::Token negation_token = tokens.Use();
             ASTNode* operand = parsePrimary();
-            UnaryOpNode* negation_node = new UnaryOpNode(negation_token);
+            UnaryOpNode* negation_node = arena.Make<UnaryOpNode>(negation_token);
             negation_node->SetLeft(operand);
             return negation_node;
         }
@@ -562,7 +664,7 @@ private:
         if (tokens.Peek().id == Lexer::ID_not) {
             emplex::Token not_token = tokens.Use();
             ASTNode* operand = parsePrimary();
-            UnaryOpNode* not_node = new UnaryOpNode(not_token);
+            UnaryOpNode* not_node = arena.Make<UnaryOpNode>(not_token);
             not_node->SetLeft(operand);
             return not_node;
         }
@@ -575,7 +677,7 @@ private:
             return expression;
         }
 
-        if (tokens.Peek().lexeme == "size" && tokens.PeekByIndex(1).id == Lexer::ID_open_parenthesis) {
+        if (tokens.Peek().id == Lexer::ID_size && tokens.PeekByIndex(1).id == Lexer::ID_open_parenthesis) {
             tokens.Use(); // Consume "size"
             tokens.Use(Lexer::ID_open_parenthesis); // Consume '('
 
@@ -590,7 +692,7 @@ private:
             tokens.Use(Lexer::ID_close_parenthesis); // Consume ')'
 
             // Create a FunctionCallNode for $get_length
-            return new FunctionCallNode("get_length", DataType::INTEGER, {arg});
+            return arena.Make<FunctionCallNode>("get_length", DataType::INTEGER, std::vector<ASTNode*>{arg});
         }
 
         // Handle variables and assignments
@@ -602,11 +704,11 @@ private:
 
             // if not a function call
             if (tokens.PeekByIndex(1).id != Lexer::ID_open_parenthesis) {
-                int unique_id = symbols->GetUniqueId(tokens.Peek().lexeme);
+                int unique_id = symbols.GetUniqueId(tokens.Peek().symbol);
                 tokens.Use();
 
                 // handle conversions between int, char, and double before anything else happens
-                return parseConversion(new VariableNode(unique_id, symbols->GetDataType(unique_id)));
+                return parseConversion(arena.Make<VariableNode>(unique_id, symbols.GetDataType(unique_id)));
             }
 
             // if a function call
@@ -628,16 +730,16 @@ private:
         if (tokens.Peek().id == Lexer::ID_sqrt) {
             Token sqrt_op = tokens.Use(Lexer::ID_sqrt);
             tokens.Use(Lexer::ID_open_parenthesis);
-            Token token = tokens.Use();
-            int unique_id = symbols->GetUniqueId(token.lexeme);
-            auto variable = new VariableNode(unique_id, symbols->GetDataType(unique_id));
+            Token token = tokens.Use(Lexer::ID_identifier);
+            int unique_id = symbols.GetUniqueId(token.symbol);
+            auto variable = arena.Make<VariableNode>(unique_id, symbols.GetDataType(unique_id));
             tokens.Use(Lexer::ID_close_parenthesis);
-            UnaryOpNode* SqrtNode = new UnaryOpNode(sqrt_op);
+            UnaryOpNode* SqrtNode = arena.Make<UnaryOpNode>(sqrt_op);
             SqrtNode->SetLeft(variable);
             return parseConversion(SqrtNode);
         }
 
-        Error("Unexpected token in parsePrimary ", tokens.Peek().lexeme);
+        Error("Unexpected token in parsePrimary ", tokens.CurLexeme());
         return nullptr;
     }
 
@@ -650,7 +752,7 @@ private:
                 tokens.Peek().id == Lexer::ID_string_keyword) {
                 DataType conversion = UseDataType();
 
-                UnaryOpNode* conversionNode = new UnaryOpNode(colon_token);
+                UnaryOpNode* conversionNode = arena.Make<UnaryOpNode>(colon_token);
 
                 
                 node->UpdateType(conversion);
@@ -661,22 +763,34 @@ private:
         }
         return node; // no conversion
     }
+    // Convert the text of a numeric literal, failing on out-of-range values.
+    template <typename T>
+    T ParseNumber(std::string_view text) {
+        T value{};
+        auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (result.ec != std::errc()) {
+            Error("Invalid numeric literal: ", text);
+        }
+        return value;
+    }
+
     ASTNode* MakeLiteralValueNode(Token token) {
+        std::string_view lexeme = tokens.Lexeme(token);
         switch (token.id) {
             case Lexer::ID_integer: {
-                int value = std::stoi(token.lexeme);
-                return new LiteralValueNode(DataType::INTEGER, value);
+                int value = ParseNumber<int>(lexeme);
+                return arena.Make<LiteralValueNode>(DataType::INTEGER, value);
             }
             case Lexer::ID_float: {
-                double value = std::stod(token.lexeme);
-                return new LiteralValueNode(DataType::DOUBLE, value);
+                double value = ParseNumber<double>(lexeme);
+                return arena.Make<LiteralValueNode>(DataType::DOUBLE, value);
             }
             case Lexer::ID_character: {
-                char value = token.lexeme[1];
-                return new LiteralValueNode(DataType::CHAR, value);
+                char value = lexeme[1];
+                return arena.Make<LiteralValueNode>(DataType::CHAR, value);
             }
             default:
-                Error("Unknown token in MakeLiteralValueNode", token.lexeme, "\n");
+                Error("Unknown token in MakeLiteralValueNode", lexeme, "\n");
                 return nullptr;
         }
     }
@@ -709,13 +823,12 @@ private:
     }
 
     ASTNode* MakeLiteralStringNode() {
-        std::string str = tokens.Use().lexeme;
+        std::string_view str = tokens.Lexeme(tokens.Use());
         str = str.substr(1, str.length() - 2); // remove ""
         
-        ASTNode* stringNode = new LiteralStringNode(memoryPos, str.length());
-        memoryPos += str.length() + 1; // update free memory index
-
-        Function::addLiteralString(str);
+        // the memory position is set once every function has been parsed (see Parse)
+        LiteralStringNode* stringNode = arena.Make<LiteralStringNode>(0, str.length());
+        currentFunction->addLiteralString(stringNode, str);
         return stringNode;
     }
 
@@ -725,7 +838,7 @@ private:
             case Lexer::ID_int: {
                 tokens.Use(Lexer::ID_int);
                 Token identifier = tokens.Peek();
-                int unique_id = symbols->InitializeVar(identifier.lexeme, DataType::INTEGER);
+                int unique_id = symbols.InitializeVar(identifier.symbol, DataType::INTEGER);
 
                 // add a new variable to the function local variables list
                 currentFunction->AddLocalVar({DataType::INTEGER, unique_id});
@@ -739,7 +852,8 @@ private:
                 }
 
                 // if declaration - call parseAssignment
-                ASTNode* assignment = parseAssignment();
+                BinaryOpNode* assignment = parseAssignment();
+                assignment->SetDeclaration(true);
                 return assignment;
 
 
@@ -748,7 +862,7 @@ private:
             case Lexer::ID_double: {
                 tokens.Use(Lexer::ID_double);
                 Token identifier = tokens.Peek();
-                int unique_id = symbols->InitializeVar(identifier.lexeme, DataType::DOUBLE);
+                int unique_id = symbols.InitializeVar(identifier.symbol, DataType::DOUBLE);
 
                 // add a new variable to the function local variables list
                 currentFunction->AddLocalVar({DataType::DOUBLE, unique_id});
@@ -762,14 +876,15 @@ private:
                 }
 
                 // if declaration - call parseAssignment
-                ASTNode* assignment = parseAssignment();
+                BinaryOpNode* assignment = parseAssignment();
+                assignment->SetDeclaration(true);
                 return assignment;
             }
 
             case Lexer::ID_string_keyword: {
                 tokens.Use(Lexer::ID_string_keyword);
                 Token identifier = tokens.Peek();
-                int unique_id = symbols->InitializeVar(identifier.lexeme, DataType::STRING);
+                int unique_id = symbols.InitializeVar(identifier.symbol, DataType::STRING);
 
                 currentFunction->AddLocalVar({DataType::STRING, unique_id});
 
@@ -783,11 +898,12 @@ private:
                     }
 
                     // Create assignment node
-                    VariableNode* variableNode = new VariableNode(unique_id, DataType::STRING);
+                    VariableNode* variableNode = arena.Make<VariableNode>(unique_id, DataType::STRING);
                     Token assignmentToken = tokens.Peek();
-                    BinaryOpNode* assignmentNode = new BinaryOpNode(assignmentToken);
+                    BinaryOpNode* assignmentNode = arena.Make<BinaryOpNode>(assignmentToken);
                     assignmentNode->SetLeft(variableNode);
                     assignmentNode->SetRight(expression);
+                    assignmentNode->SetDeclaration(true);
                     tokens.Use(Lexer::ID_semicolon);
                     return assignmentNode;
                 }
@@ -801,7 +917,8 @@ private:
                 }
 
                 // if declaration - call parseAssignment
-                ASTNode* assignment = parseAssignment();
+                BinaryOpNode* assignment = parseAssignment();
+                assignment->SetDeclaration(true);
                 return assignment;
             }
         
@@ -812,12 +929,55 @@ private:
         }
     }
 
+    // A parser for a single function body, resolving calls through an existing table.
+    Parser(TokenQueue & tokens, Arena & arena, const FunctionTable & calls)
+        : tokens(tokens), arena(arena), calls(&calls), symbols(tokens.Interns()) {}
+
 public:
-    Parser(TokenQueue tokens) : tokens(tokens) {}
-    std::vector<Function*> Parse() {
+    Parser(TokenQueue & tokens, Arena & arena) : tokens(tokens), arena(arena), symbols(tokens.Interns()) {}
+
+    // Parse the whole program, using numThreads threads for function bodies
+    // (0 means one per hardware thread; streamed tokens are always parsed on one).
+    std::vector<Function*> Parse(size_t numThreads = 1) {
+        ScanSignatures();
+        ParseBodies(numThreads);
+        PlaceLiteralStrings();
+        return functions;
+    }
+
+    // The phases of Parse, for callers that need to step in between them
+    // (e.g., to skip bodies whose code is already in a cache).
+
+    // First phase: find every function and its signature.
+    const std::vector<Function*>& ScanSignatures() {
         while (tokens.Any()) {
-            parseFunction();
+            scanFunction();
         }
         return functions;
     }
+
+    // The tokens each function spans (in source order), once the signatures are scanned.
+    const std::vector<FunctionRange>& Ranges() const {
+        return ranges;
+    }
+
+    // The function a call to symbol would go to, or nullptr if there is none.
+    Function* FindFunction(int symbol) const {
+        auto it = calls->find(symbol);
+        return (it == calls->end()) ? nullptr : it->second;
+    }
+
+    // Second phase: parse the bodies, except those of functions i where skip[i] is true.
+    void ParseBodies(size_t numThreads, const std::vector<bool>& skip = {}) {
+        parseBodies(numThreads, skip);
+    }
+
+    // Finally, lay the literal strings out in memory, in source order; returns where they end.
+    int PlaceLiteralStrings() {
+        int memoryPos = 0;
+        for (Function* function : functions) {
+            memoryPos = function->PlaceLiteralStrings(memoryPos);
+        }
+        return memoryPos;
+    }
 };
\ No newline at end of file
@@ -1,5 +1,12 @@
 #include <assert.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <filesystem>
 #include <fstream>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -7,372 +14,768 @@
 #include <iostream>
 // UNCOMMENT THESE IF YOU WANT TO USE THEM
 // #include "ASTNode.hpp"
+#include "Arena.hpp"
+#include "CompileCache.hpp"
+#include "ConstantFolder.hpp"
+#include "Emitter.hpp"
 #include "Parser.hpp"
+#include "ServeProtocol.hpp"
+#include "SourceFile.hpp"
+#include "ThreadPool.hpp"
+#include "TimeReport.hpp"
+#include "TypeChecker.hpp"
+#include "WasmWriter.hpp"
 #include "lexer.hpp"
 // #include "SymbolTable.hpp"
 #include "TokenQueue.hpp"  // A fully-implemented token manager
 // #include "tools.hpp"       // A few helpful functions
 
-void CharToStringFunction() {
+// The runtime functions below are written one instruction at a time (see WasmWriter).
+using enum WasmOp;
+using enum WasmType;
+using enum WasmLayout;
+using enum WasmBranch;
+
+// Strings in memory are a 32-bit length header, the bytes, and a 0 byte (see
+// STRING_HEADER_SIZE); a string's address is that of its header.  Strings made
+// at run time are allocated by $alloc (see HeapFunctions) and freed once nothing
+// holds them (see RefCountFunctions).
+
+// Optional wasm features the runtime functions may use (--features=simd,bulk-memory).
+// Without them the runtime moves one byte at a time, and runs on any engine.
+struct RuntimeFeatures {
+  bool simd = false;         // 128-bit vectors: copy and scan 16 bytes at a time
+  bool bulk_memory = false;  // memory.copy for copies
+
+  // Turn on each feature in a comma-separated list; false if one is unknown.
+  bool Parse(std::string_view list) {
+    while (true) {
+      const size_t comma = list.find(',');
+      const std::string_view name = list.substr(0, comma);
+      if (name == "simd") simd = true;
+      else if (name == "bulk-memory") bulk_memory = true;
+      else return false;
+      if (comma == std::string_view::npos) return true;
+      list.remove_prefix(comma + 1);
+    }
+  }
+};
+
+// How much linear memory a module starts with and may grow to, in 64 KiB pages.
+struct MemoryPages {
+  // Addresses must stay below 2^31: $concat_n tells a char from a string by its sign.
+  static constexpr uint32_t LIMIT = 32768;
+  static constexpr uint32_t PAGE_SIZE = 65536;
+
+  uint32_t initial = 10;
+  uint32_t max = LIMIT;
+};
+
+void HeapFunctions(WasmWriter & out, int literal_end, const MemoryPages & pages) {
+  // hard coded allocator for every string made at run time.  A block is an 8-byte
+  // header (a reference count, see RefCountFunctions, then the block's size) and the
+  // memory handed out; blocks start 4 bytes past a multiple of 8, so string bytes
+  // are 8-byte aligned.  Blocks up to 2 KiB are a power of two in size, with a free
+  // list for each size; larger ones share one list, searched for the first block
+  // that fits (without wasting more than half of it).  Anything else comes from
+  // the top of the heap ($free_mem), growing memory as needed; a block freed at the
+  // top is given back to it.  Each list's head is in memory at $heap_lists
+  // (the large list last), and a free block's payload holds the next block in its list.
+  const int heap_lists = (literal_end + 7) & ~7;
+  const int heap_base = heap_lists + 36;
+  if (static_cast<int64_t>(heap_base) > static_cast<int64_t>(pages.initial) * MemoryPages::PAGE_SIZE) {
+    Error("The program's strings need ", (heap_base + MemoryPages::PAGE_SIZE - 1) / MemoryPages::PAGE_SIZE,
+          " pages of memory, but it starts with ", pages.initial, ".");
+  }
+  out.Global("heap_lists", I32, heap_lists);
+  out.Global("heap_base", I32, heap_base);
+  out.MutableGlobal("free_mem", I32, heap_base);
+  out.MutableGlobal("concat_list", I32, 0);
+  out.MutableGlobal("heap_in_use", I32, 0);
+  out.MutableGlobal("heap_peak", I32, 0);
+  out.MutableGlobal("heap_allocations", I32, 0);
+  out.MutableGlobal("heap_frees", I32, 0);
+
+  out.Func("alloc", FOLDED).Param("size", I32).Result(I32);
+  out.Local("block", I32).Local("list", I32).Local("result", I32).Local("end", I32);
+  out.LocalGet("size").I32Const(15).Op(I32_ADD).I32Const(-8).Op(I32_AND).LocalSet("block");
+  out.Block("found");
+  out.LocalGet("block").I32Const(2048).Op(I32_LE_U).If();
+  // round up to a power of two (at least 16), and use its list
+  out.I32Const(1).Wrap(10).I32Const(32).LocalGet("block").I32Const(1).Op(I32_SUB).I32Const(15).Op(I32_OR).Op(I32_CLZ)
+     .Op(I32_SUB).Op(I32_SHL).LocalSet("block");
+  out.GlobalGet("heap_lists").I32Const(27).LocalGet("block").Op(I32_CLZ).Op(I32_SUB).I32Const(2).Op(I32_SHL)
+     .Op(I32_ADD).LocalSet("list");
+  out.LocalGet("list").Op(I32_LOAD).LocalSet("result");
+  out.LocalGet("result").Op(I32_EQZ).BrIf("found");
+  out.LocalGet("list").LocalGet("result").Op(I32_LOAD).Op(I32_STORE);
+  out.Br("found");
+  out.End();
+  // first fit in the large list; $list is the address of the link to the block being tried
+  out.GlobalGet("heap_lists").I32Const(32).Op(I32_ADD).LocalSet("list");
+  out.Loop("search");
+  out.LocalGet("list").Op(I32_LOAD).LocalSet("result");
+  out.LocalGet("result").Op(I32_EQZ).BrIf("found");
+  out.LocalGet("result").I32Const(4).Op(I32_SUB).Op(I32_LOAD).LocalSet("end");
+  out.LocalGet("end").LocalGet("block").Op(I32_GE_U);
+  out.Wrap(19).LocalGet("end").LocalGet("block").I32Const(1).Op(I32_SHL).Op(I32_LE_U).Op(I32_AND).If();
+  out.LocalGet("list").LocalGet("result").Op(I32_LOAD).Op(I32_STORE);
+  out.LocalGet("end").LocalSet("block");
+  out.Br("found");
+  out.End();
+  out.LocalGet("result").LocalSet("list");
+  out.Br("search");
+  out.End();
+  out.End();
+  // nothing free fits: take it from the top of the heap, growing memory if need be
+  out.LocalGet("result").Op(I32_EQZ).If();
+  out.GlobalGet("free_mem").I32Const(8).Op(I32_ADD).LocalSet("result");
+  out.GlobalGet("free_mem").LocalGet("block").Op(I32_ADD).LocalSet("end");
+  out.LocalGet("end").GlobalGet("free_mem").Op(I32_LT_U).If(INLINE).Op(UNREACHABLE).End();
+  out.LocalGet("end").Op(MEMORY_SIZE).I32Const(16).Op(I32_SHL).Op(I32_GT_U).If();
+  out.LocalGet("end").I32Const(65535).Op(I32_ADD).I32Const(16).Op(I32_SHR_U).Wrap(45).Op(MEMORY_SIZE).Op(I32_SUB)
+     .Op(MEMORY_GROW).Wrap(24).I32Const(0).Op(I32_LT_S).If(OWN_LINE).Op(UNREACHABLE).End();
+  out.End();
+  out.LocalGet("end").GlobalSet("free_mem");
+  out.End();
+  out.LocalGet("result").I32Const(8).Op(I32_SUB).I32Const(0).Op(I32_STORE);
+  out.LocalGet("result").I32Const(4).Op(I32_SUB).LocalGet("block").Op(I32_STORE);
+  out.GlobalGet("heap_in_use").LocalGet("block").Op(I32_ADD).GlobalSet("heap_in_use");
+  out.GlobalGet("heap_in_use").GlobalGet("heap_peak").Op(I32_GT_U).If(OWN_LINE);
+  out.GlobalGet("heap_in_use").GlobalSet("heap_peak");
+  out.End();
+  out.GlobalGet("heap_allocations").I32Const(1).Op(I32_ADD).GlobalSet("heap_allocations");
+  out.LocalGet("result");
+  out.EndFunc().Export("alloc", "alloc");
+
+  // hard coded function to give back a block from $alloc; strings in the data segment are
+  // ignored.  A freed block's count is -1, so a string isn't released again once it's freed.
+  out.Func("free", FOLDED).Param("ptr", I32);
+  out.Local("block", I32).Local("list", I32);
+  out.LocalGet("ptr").GlobalGet("heap_base").Op(I32_LT_U).If(INLINE).Op(RETURN).End();
+  out.LocalGet("ptr").I32Const(8).Op(I32_SUB).I32Const(-1).Op(I32_STORE);
+  out.LocalGet("ptr").I32Const(4).Op(I32_SUB).Op(I32_LOAD).LocalSet("block");
+  out.GlobalGet("heap_in_use").LocalGet("block").Op(I32_SUB).GlobalSet("heap_in_use");
+  out.GlobalGet("heap_frees").I32Const(1).Op(I32_ADD).GlobalSet("heap_frees");
+  out.LocalGet("ptr").LocalGet("block").I32Const(8).Op(I32_SUB).Op(I32_ADD).GlobalGet("free_mem").Op(I32_EQ).If();
+  out.LocalGet("ptr").I32Const(8).Op(I32_SUB).GlobalSet("free_mem");
+  out.Op(RETURN);
+  out.End();
+  out.LocalGet("block").I32Const(2048).Op(I32_LE_U).If(OWN_LINE);
+  out.GlobalGet("heap_lists").I32Const(27).LocalGet("block").Op(I32_CLZ).Op(I32_SUB).I32Const(2).Op(I32_SHL)
+     .Op(I32_ADD).LocalSet("list");
+  out.Else(OWN_LINE);
+  out.GlobalGet("heap_lists").I32Const(32).Op(I32_ADD).LocalSet("list");
+  out.End();
+  out.LocalGet("ptr").LocalGet("list").Op(I32_LOAD).Op(I32_STORE);
+  out.LocalGet("list").LocalGet("ptr").Op(I32_STORE);
+  out.EndFunc().Export("free", "free");
+
+  // statistics for hosts: bytes in blocks in use (now, and at most), and calls to $alloc and $free
+  static constexpr std::string_view STATS[][2] = {
+    {"heap_in_use", "get_heap_in_use"}, {"heap_peak", "get_heap_peak"},
+    {"heap_allocations", "get_heap_allocations"}, {"heap_frees", "get_heap_frees"},
+  };
+  for (const auto & [stat, getter] : STATS) {
+    out.Func(getter, ONE_LINE).Result(I32).GlobalGet(stat).EndFunc().Export(stat, getter);
+  }
+}
+
+void RefCountFunctions(WasmWriter & out) {
+  // hard coded reference counting for strings made at run time (see Function::GenerateCode).
+  // A block's count is how many variables hold it; a new string has none, and a function
+  // that takes a string releases it once it's done with it if nothing holds it then.
+  // Strings in the data segment aren't counted.
+  out.Func("retain", FOLDED).Param("str", I32).Result(I32);
+  out.LocalGet("str").GlobalGet("heap_base").Op(I32_GE_U).If(OWN_LINE);
+  out.LocalGet("str").I32Const(8).Op(I32_SUB);
+  out.Wrap(6).LocalGet("str").I32Const(8).Op(I32_SUB).Op(I32_LOAD).I32Const(1).Op(I32_ADD).Op(I32_STORE);
+  out.End();
+  out.LocalGet("str");
+  out.EndFunc().Export("retain", "retain");
+
+  // one fewer holder: the string is freed when the last lets go (or if it had none)
+  out.Func("release", FOLDED).Param("str", I32);
+  out.Local("count", I32);
+  out.LocalGet("str").GlobalGet("heap_base").Op(I32_LT_U).If(INLINE).Op(RETURN).End();
+  out.LocalGet("str").I32Const(8).Op(I32_SUB).Op(I32_LOAD).LocalSet("count");
+  out.LocalGet("count").I32Const(1).Op(I32_GT_S).If(OWN_LINE);
+  out.LocalGet("str").I32Const(8).Op(I32_SUB).LocalGet("count").I32Const(1).Op(I32_SUB).Op(I32_STORE);
+  out.Else(OWN_LINE);
+  out.LocalGet("count").I32Const(0).Op(I32_GE_S).If(INLINE).LocalGet("str").Call("free").End();
+  out.End();
+  out.EndFunc().Export("release", "release");
+
+  // free a temporary: a string that nothing holds
+  out.Func("release_temp", FOLDED).Param("str", I32);
+  out.LocalGet("str").GlobalGet("heap_base").Op(I32_GE_U).If(OWN_LINE);
+  out.LocalGet("str").I32Const(8).Op(I32_SUB).Op(I32_LOAD).Op(I32_EQZ).If(INLINE).LocalGet("str").Call("free").End();
+  out.End();
+  out.EndFunc();
+
+  // one fewer holder, without freeing: a function's result, handed on to its caller
+  out.Func("disown", FOLDED).Param("str", I32).Result(I32);
+  out.LocalGet("str").GlobalGet("heap_base").Op(I32_GE_U).If(OWN_LINE);
+  out.LocalGet("str").I32Const(8).Op(I32_SUB);
+  out.Wrap(6).LocalGet("str").I32Const(8).Op(I32_SUB).Op(I32_LOAD).I32Const(1).Op(I32_SUB).Op(I32_STORE);
+  out.End();
+  out.LocalGet("str");
+  out.EndFunc();
+
+  // size() of a temporary, which is released once it's measured
+  out.Func("temp_length", FOLDED).Param("str", I32).Result(I32);
+  out.Local("length", I32);
+  out.LocalGet("str").Op(I32_LOAD).LocalSet("length");
+  out.LocalGet("str").Call("release_temp");
+  out.LocalGet("length");
+  out.EndFunc();
+}
+
+void CopyBytesFunction(WasmWriter & out, const RuntimeFeatures & features) {
+  // hard coded function to copy $length bytes from $src to $dest
+  out.Func("copy_bytes", FOLDED).Param("dest", I32).Param("src", I32).Param("length", I32);
+  if (features.bulk_memory) {
+    out.LocalGet("dest").LocalGet("src").LocalGet("length").Op(MEMORY_COPY);
+    out.EndFunc();
+    return;
+  }
+  out.Local("i", I32);
+  if (features.simd) {
+    // 16 bytes at a time, then the bytes left over
+    out.Block("done16").Loop("copy16");
+    out.LocalGet("i").I32Const(16).Op(I32_ADD).LocalGet("length").Op(I32_GT_U).BrIf("done16");
+    out.LocalGet("dest").LocalGet("i").Op(I32_ADD);
+    out.Wrap(8).LocalGet("src").LocalGet("i").Op(I32_ADD).Op(V128_LOAD).Op(V128_STORE);
+    out.LocalGet("i").I32Const(16).Op(I32_ADD).LocalSet("i");
+    out.Br("copy16");
+    out.End().End();
+  }
+  out.Block("done").Loop("copy");
+  out.LocalGet("i").LocalGet("length").Op(I32_GE_U).BrIf("done");
+  out.LocalGet("dest").LocalGet("i").Op(I32_ADD);
+  out.Wrap(8).LocalGet("src").LocalGet("i").Op(I32_ADD).Op(I32_LOAD8_U).Op(I32_STORE8);
+  out.LocalGet("i").I32Const(1).Op(I32_ADD).LocalSet("i");
+  out.Br("copy");
+  out.End().End();
+  out.EndFunc();
+}
+
+void FillBytesFunction(WasmWriter & out, const RuntimeFeatures & features) {
+  // hard coded function to set $length bytes from $dest on to $value
+  out.Func("fill_bytes", FOLDED).Param("dest", I32).Param("value", I32).Param("length", I32);
+  if (features.bulk_memory) {
+    out.LocalGet("dest").LocalGet("value").LocalGet("length").Op(MEMORY_FILL);
+    out.EndFunc();
+    return;
+  }
+  out.Local("i", I32);
+  if (features.simd) {
+    // 16 bytes at a time, then the bytes left over
+    out.Block("done16").Loop("fill16");
+    out.LocalGet("i").I32Const(16).Op(I32_ADD).LocalGet("length").Op(I32_GT_U).BrIf("done16");
+    out.LocalGet("dest").LocalGet("i").Op(I32_ADD).LocalGet("value").Op(I8X16_SPLAT).Op(V128_STORE);
+    out.LocalGet("i").I32Const(16).Op(I32_ADD).LocalSet("i");
+    out.Br("fill16");
+    out.End().End();
+  }
+  out.Block("done").Loop("fill");
+  out.LocalGet("i").LocalGet("length").Op(I32_GE_U).BrIf("done");
+  out.LocalGet("dest").LocalGet("i").Op(I32_ADD).LocalGet("value").Op(I32_STORE8);
+  out.LocalGet("i").I32Const(1).Op(I32_ADD).LocalSet("i");
+  out.Br("fill");
+  out.End().End();
+  out.EndFunc();
+}
+
+void CharToStringFunction(WasmWriter & out) {
     // Hard coded function to convert a CHAR to a STRING in memory
-    std::cout << "(func $char_to_string (param $char i32) (result i32)\n";
-    std::cout << "  (local $address i32)\n"; // Local variable to hold the memory address
-    std::cout << "  ;; Allocate memory for the string\n";
-    std::cout << "  (global.get $free_mem)\n";
-    std::cout << "  (local.set $address)\n";
-    std::cout << "  ;; Store the char as a single-character string\n";
-    std::cout << "  (local.get $address)\n";
-    std::cout << "  (local.get $char)\n";
-    std::cout << "  (i32.store8)\n";
-    std::cout << "  ;; Null-terminate the string\n";
-    std::cout << "  (local.get $address)\n";
-    std::cout << "  (i32.const 1)\n";
-    std::cout << "  (i32.add)\n";
-    std::cout << "  (i32.const 0)\n";
-    std::cout << "  (i32.store8)\n";
-    std::cout << "  ;; Update free_mem\n";
-    std::cout << "  (local.get $address)\n";
-    std::cout << "  (i32.const 2)\n";
-    std::cout << "  (i32.add)\n";
-    std::cout << "  (global.set $free_mem)\n";
-    std::cout << "  ;; Return the address of the string\n";
-    std::cout << "  (local.get $address)\n";
-    std::cout << ")\n";
-    std::cout << "(export \"char_to_string\" (func $char_to_string))\n";
+    out.Func("char_to_string", INDENTED).Param("char", I32).Result(I32);
+    out.Local("address", I32); // Local variable to hold the memory address
+    out.Comment("Allocate memory for the string");
+    out.I32Const(6).Call("alloc").LocalSet("address");
+    out.Comment("Its length is 1 (or 0 for a 0 char, which ends the string)");
+    out.LocalGet("address").LocalGet("char").I32Const(0).Op(I32_NE).Op(I32_STORE);
+    out.Comment("Store the char as a single-character string");
+    out.LocalGet("address").LocalGet("char").Op(I32_STORE8, 4);
+    out.Comment("Null-terminate the string");
+    out.LocalGet("address").I32Const(0).Op(I32_STORE8, 5);
+    out.Comment("Return the address of the string");
+    out.LocalGet("address");
+    out.EndFunc().Export("char_to_string", "char_to_string");
 }
 
-void GetSizeFunction() {
-  // hard coded function to get the length of a string
-  // HAS NOT BEEN TESTED
-  std::cout << "(func $get_length (param $str i32) (result i32) \n";
-  std::cout << "  (local $length i32)\n";
-  std::cout << "  (local $current i32)\n";
-  std::cout << "  (block $fun_exit1 (result i32)\n";
-  std::cout << "    (local.set $length (i32.const 0))\n";
-  std::cout << "    (block $exit1\n";
-  std::cout << "    (loop $loop1\n";
-  std::cout << "      (local.get $str)\n";
-  std::cout << "      (local.get $length)\n";
-  std::cout << "      (i32.add)\n";
-  std::cout << "      (i32.load8_u) ;; access the character\n ";
-  std::cout << "      (local.set $current)\n\n";
-  std::cout << "      (local.get $current)\n";
-  std::cout << "      (i32.eqz) ;; check if the character is null terminator\n";
-  std::cout << "      (br_if $exit1)\n";
-  std::cout << "      (local.get $length)\n";
-  std::cout << "      (i32.const 1)\n";
-  std::cout << "      (i32.add) ;; add 1 to the length of a string\n";
-  std::cout << "      (local.set $length)\n";
-  std::cout << "      (br $loop1)\n";
-  std::cout << "    )\n";
-  std::cout << "    )\n";
-  std::cout << "  (local.get $length)\n";
-  std::cout << "  )\n";
-  std::cout << ")\n";
-  std::cout << "(export \"get_length\" (func $get_length))\n";
+void GetSizeFunction(WasmWriter & out) {
+  // hard coded function to get the length of a string (its header); size() loads it directly
+  out.Func("get_length", FOLDED).Param("str", I32).Result(I32);
+  out.LocalGet("str").Op(I32_LOAD);
+  out.EndFunc().Export("get_length", "get_length");
 }
 
-void AddStringsFunction() {
-  // hard coded function to add two strings
-  std::cout << "(func $add_strings (param $str1 i32) (param $str2 i32) (result i32)\n";
-  std::cout << "  (local $old_free_mem i32)\n";
-  std::cout << "  (local $count i32)\n"; // total offset from the beginning
-  std::cout << "  (local $current i32)\n";
-  std::cout << "  (local $i i32)\n"; // offset in the second string
-
-  std::cout << "  (global.get $free_mem)\n";
-  std::cout << "  (local.set $old_free_mem)\n";
-  std::cout << "  (i32.const 0)\n";
-  std::cout << "  (local.set $count)\n";
-  std::cout << "    (i32.const 0)\n";
-  std::cout << "    (local.set $i)\n";
-
-  std::cout << "  (block $fun_exit1 (result i32)\n";
-
-// loop through the first string
-  std::cout << "    (block $exit1\n";
-  std::cout << "      (loop $loop1\n";
-
-  std::cout << "        (local.get $str1)\n";
-  std::cout << "        (local.get $count)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (i32.load8_u)\n";
-  std::cout << "        (local.set $current)\n"; // load current character
-
-  std::cout << "        (local.get $current)\n"; // check if it's not zero
-  std::cout << "        (i32.eqz)\n";
-  std::cout << "        (br_if $exit1)\n";
-
-  std::cout << "        (local.get $old_free_mem)\n";
-  std::cout << "        (local.get $count)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.get $current)\n";
-  std::cout << "        (i32.store8)\n"; // copy to a new string
-
-  std::cout << "        (local.get $count)\n"; 
-  std::cout << "        (i32.const 1)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.set $count)\n"; // update count
-  std::cout << "        (br $loop1)\n";
-  std::cout << "      )\n";
-  std::cout << "    )\n";
-
-
-  std::cout << "    (block $exit2\n";
-  std::cout << "      (loop $loop2\n";
-
-
-// do the same for the second string
-  std::cout << "        (local.get $str2)\n";
-  std::cout << "        (local.get $i)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (i32.load8_u)\n";
-  std::cout << "        (local.set $current)\n"; // load current character
-
-  std::cout << "        (local.get $current)\n"; // check if not zero
-  std::cout << "        (i32.eqz)\n";
-  std::cout << "        (br_if $exit2)\n";
-
-  std::cout << "        (local.get $old_free_mem)\n";
-  std::cout << "        (local.get $count)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.get $current)\n";
-  std::cout << "        (i32.store8)\n"; // copy to a new string
-
-  std::cout << "        (local.get $count)\n";
-  std::cout << "        (i32.const 1)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.set $count)\n";
-  std::cout << "        (local.get $i)\n";
-  std::cout << "        (i32.const 1)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.set $i)\n";
-  std::cout << "        (br $loop2)\n"; // update count and i
-  std::cout << "      )\n";
-  std::cout << "    )\n";
+void HostStringFunctions(WasmWriter & out, const RuntimeFeatures & features) {
+  // hard coded functions for hosts that work with C strings (0-terminated bytes):
+  // $string_from_c copies one into a new string, and $c_string gives a string's bytes as one
+  out.Func("string_from_c", FOLDED).Param("cstr", I32).Result(I32);
+  out.Local("length", I32).Local("result", I32);
+  if (features.simd) {
+    out.Local("last", I32).Local("zeros", I32);
+  }
+  out.Block("measured");
+  if (features.simd) {
+    // look for the terminator 16 bytes at a time (a bit set in $zeros for each 0 byte),
+    // while a whole vector fits in memory; the byte loop finishes the rest
+    out.Op(MEMORY_SIZE).I32Const(16).Op(I32_SHL).I32Const(16).Op(I32_SUB).LocalSet("last");
+    out.Block("near_end").Loop("measure16");
+    out.LocalGet("cstr").LocalGet("length").Op(I32_ADD).LocalGet("last").Op(I32_GT_U).BrIf("near_end");
+    out.LocalGet("cstr").LocalGet("length").Op(I32_ADD).Op(V128_LOAD);
+    out.Wrap(10).I32Const(0).Op(I8X16_SPLAT).Op(I8X16_EQ).Op(I8X16_BITMASK).LocalSet("zeros");
+    out.LocalGet("zeros").If();
+    out.LocalGet("length").LocalGet("zeros").Op(I32_CTZ).Op(I32_ADD).LocalSet("length");
+    out.Br("measured");
+    out.End();
+    out.LocalGet("length").I32Const(16).Op(I32_ADD).LocalSet("length");
+    out.Br("measure16");
+    out.End().End();
+  }
+  out.Loop("measure");
+  out.LocalGet("cstr").LocalGet("length").Op(I32_ADD).Op(I32_LOAD8_U).Op(I32_EQZ).BrIf("measured");
+  out.LocalGet("length").I32Const(1).Op(I32_ADD).LocalSet("length");
+  out.Br("measure");
+  out.End();
+  out.End();
+  out.LocalGet("length").I32Const(5).Op(I32_ADD).Call("alloc").LocalSet("result");
+  out.LocalGet("result").LocalGet("length").Op(I32_STORE);
+  out.LocalGet("result").I32Const(4).Op(I32_ADD).LocalGet("cstr").LocalGet("length").Call("copy_bytes");
+  out.LocalGet("result").LocalGet("length").Op(I32_ADD).I32Const(0).Op(I32_STORE8, 4);
+  out.LocalGet("result");
+  out.EndFunc().Export("string_from_c", "string_from_c");
+  out.Func("c_string", FOLDED).Param("str", I32).Result(I32);
+  out.LocalGet("str").I32Const(4).Op(I32_ADD);
+  out.EndFunc().Export("c_string", "c_string");
+}
+
+void AddStringsFunction(WasmWriter & out) {
+  // hard coded function to add two strings (releasing either if nothing holds it)
+  out.Func("add_strings", FOLDED).Param("str1", I32).Param("str2", I32).Result(I32);
+  out.Local("result", I32).Local("length1", I32).Local("length2", I32);
+  out.LocalGet("str1").Op(I32_LOAD).LocalSet("length1");
+  out.LocalGet("str2").Op(I32_LOAD).LocalSet("length2");
+  out.LocalGet("length1").LocalGet("length2").Op(I32_ADD).I32Const(5).Op(I32_ADD).Call("alloc").LocalSet("result");
+
+  // the new length, then the bytes of both strings
+  out.LocalGet("result").LocalGet("length1").LocalGet("length2").Op(I32_ADD).Op(I32_STORE);
+  out.LocalGet("result").I32Const(4).Op(I32_ADD);
+  out.Wrap(4).LocalGet("str1").I32Const(4).Op(I32_ADD).LocalGet("length1").Call("copy_bytes");
+  out.LocalGet("result").I32Const(4).Op(I32_ADD).LocalGet("length1").Op(I32_ADD);
+  out.Wrap(4).LocalGet("str2").I32Const(4).Op(I32_ADD).LocalGet("length2").Call("copy_bytes");
 
   // null character
-  std::cout << "    (local.get $old_free_mem)\n";
-  std::cout << "    (local.get $count)\n";
-  std::cout << "    (i32.add)\n";
-  std::cout << "    (i32.const 0)\n";
-  std::cout << "    (i32.store8)\n";
-
-  //update free mem
-  std::cout << "    (local.get $old_free_mem)\n";
-  std::cout << "    (local.get $count)\n";
-  std::cout << "    (i32.add)\n";
-  std::cout << "    (i32.const 1)\n";
-  std::cout << "    (i32.add)\n";
-  std::cout << "    (global.set $free_mem)\n";
-
-  // return
-  std::cout << "    (local.get $old_free_mem)\n";
-  std::cout << "  )\n";
-  std::cout << ")\n";
-  std::cout << "(export \"add_strings\" (func $add_strings))\n";
+  out.LocalGet("result").LocalGet("length1").Op(I32_ADD).LocalGet("length2").Op(I32_ADD).I32Const(0).Op(I32_STORE8, 4);
+  out.LocalGet("str1").Call("release_temp");
+  out.LocalGet("str2").Call("release_temp");
+  out.LocalGet("result");
+  out.EndFunc().Export("add_strings", "add_strings");
 }
 
-void PadCharFunction() {
-  
-  // std::cout << "(func $pad_char\n";
-  // std::cout << "  (param $repeat i32)    ;; Input character as ASCII\n";
-  // std::cout << "  (param $char i32)  ;; Number of repetitions\n";
-  // std::cout << "  (result i32)         ;; Address of the resulting string\n\n";
-  // std::cout << "  (local $offset i32)  ;; Offset to track writing position\n";
-  // std::cout << "  (local $free_mem_copy i32) ;; Copy of $free_mem for returning the start address\n" << "\n";
-
-  // std::cout << "  ;; Initialize $free_mem_copy with the current $free_mem\n";
-  // std::cout << "  (global.get $free_mem)\n";
-  // std::cout << "  (local.set $free_mem_copy)\n" << "\n";
-
-  // std::cout << "  ;; Initialize $offset to 0\n";
-  // std::cout << "  (i32.const 0)\n";
-  // std::cout << "  (local.set $offset)\n" << "\n";
-
-  // std::cout << "  ;; While loop: offset < repeat\n";
-  // std::cout << "  (block $loop_exit\n";
-  // std::cout << "    (loop $loop\n";
-  // std::cout << "      ;; Break the loop if offset >= repeat\n";
-  // std::cout << "      (local.get $offset)\n";
-  // std::cout << "      (local.get $repeat)\n";
-  // std::cout << "      (i32.ge_u)\n";
-  // std::cout << "      (br_if $loop_exit)\n" << "\n";
-
-  // std::cout << "      ;; Store $char at address $free_mem + $offset\n";
-  // std::cout << "      (global.get $free_mem)\n";
-  // std::cout << "      (local.get $offset)\n";
-  // std::cout << "      (i32.add)\n";
-  // std::cout << "      (local.get $char)\n";
-  // std::cout << "      (i32.store8)\n" << "\n";
-
-  // std::cout << "      ;; Increment $offset\n";
-  // std::cout << "      (local.get $offset)\n";
-  // std::cout << "      (i32.const 1)\n";
-  // std::cout << "      (i32.add)\n";
-  // std::cout << "      (local.set $offset)\n" << "\n";
-
-  // std::cout << "      ;; Continue the loop\n";
-  // std::cout << "      (br $loop)\n";
-  // std::cout << "    )\n";
-  // std::cout << "  )\n" << "\n";
-
-  // std::cout << "  ;; Add null terminator at the end ($free_mem + $offset)\n";
-  // std::cout << "  (global.get $free_mem)\n";
-  // std::cout << "  (local.get $offset)\n";
-  // std::cout << "  (i32.add)\n";
-  // std::cout << "  (i32.const 0)\n";
-  // std::cout << "  (i32.store8)\n" << "\n";
-
-  // std::cout << "  ;; Update $free_mem: $free_mem + $offset + 2\n";
-  // std::cout << "  (global.get $free_mem)\n";
-  // std::cout << "  (local.get $offset)\n";
-  // std::cout << "  (i32.add)\n";
-  // std::cout << "  (i32.const 2)\n";
-  // std::cout << "  (i32.add)\n";
-  // std::cout << "  (global.set $free_mem)\n" << "\n";
-
-  // std::cout << "  ;; Return the start address of the string\n";
-  // std::cout << "  (local.get $free_mem_copy)\n";
-  // std::cout << ")\n" << "\n";
-
-  // std::cout << ";; Export the pad_char function\n";
-  // std::cout << "  (export \"pad_char\" (func $pad_char))\n\n";
-
-  std::cout << "(func $pad_char (param $repeat i32) (param $char i32) (result i32)\n";
-  std::cout << "  (local $char_str i32)\n";
-  std::cout << "  (local $result i32)\n";
-  std::cout << "  (local $i i32)\n";
-
-  std::cout << "    (block $empty_string_block\n";
-  std::cout << "      (local.get $repeat)\n";
-  std::cout << "      (i32.eqz)\n";
-  std::cout << "      (if\n";
-  std::cout << "        (then\n";
-  std::cout << "          (global.get $free_mem)\n";
-  std::cout << "          (i32.const 0)\n";
-  std::cout << "          (i32.store8)\n";
-  std::cout << "          (global.get $free_mem)\n";
-  std::cout << "          (i32.const 1)\n";
-  std::cout << "          (i32.add)\n";
-  std::cout << "          (global.set $free_mem)\n";
-  std::cout << "          (global.get $free_mem)\n";
-  std::cout << "          (return)\n";
-  std::cout << "        )\n";
-  std::cout << "      )\n";
-  std::cout << "    )\n";
-  std::cout << "\n";
-  std::cout << "    ;; Convert char to string\n";
-  std::cout << "    (local.get $char)\n";
-  std::cout << "    (call $char_to_string)\n";
-  std::cout << "    (local.set $char_str)\n";
-  std::cout << "\n";
-  std::cout << "    (local.get $char_str)\n";
-  std::cout << "    (local.set $result)\n";
-  std::cout << "\n";
-  std::cout << "    (local.set $i (i32.const 1))\n";
-  std::cout << "    (block $exit_block\n";
-  std::cout << "      (loop $loop\n";
-  std::cout << "        ;; Break if $i >= $repeat\n";
-  std::cout << "        (local.get $i)\n";
-  std::cout << "        (local.get $repeat)\n";
-  std::cout << "        (i32.ge_u)\n";
-  std::cout << "        (br_if $exit_block)\n";
-  std::cout << "\n";
-  std::cout << "        ;; Concatenate $result with $char_str\n";
-  std::cout << "        (local.get $result)\n";
-  std::cout << "        (local.get $char_str)\n";
-  std::cout << "        (call $add_strings)\n";
-  std::cout << "        (local.set $result) ;; Update result after concatenation\n";
-  std::cout << "\n";
-  std::cout << "        ;; Increment $i\n";
-  std::cout << "        (local.get $i)\n";
-  std::cout << "        (i32.const 1)\n";
-  std::cout << "        (i32.add)\n";
-  std::cout << "        (local.set $i)\n";
-  std::cout << "\n";
-  std::cout << "        ;; Repeat the loop\n";
-  std::cout << "        (br $loop)\n";
-  std::cout << "      )\n";
-  std::cout << "    )\n";
-  std::cout << "\n";
-  std::cout << "    ;; Return the final string address\n";
-  std::cout << "    (local.get $result)\n";
-  std::cout << "  )\n";
-  std::cout << "\n";
-  std::cout << "  (export \"pad_char\" (func $pad_char))\n";
+void ConcatFunction(WasmWriter & out) {
+  // hard coded function to join any number of strings and chars at once.  $list holds
+  // $count 8-byte entries: a part, then room for its length.  A part is a string's
+  // address, or a char with every bit above its byte set (so it's negative).
+  out.Func("concat_n", FOLDED).Param("list", I32).Param("count", I32).Result(I32);
+  out.Local("i", I32).Local("part", I32).Local("length", I32);
+  out.Local("total", I32).Local("result", I32).Local("dest", I32);
+
+  // measure every part once, keeping its length in its entry
+  out.Block("measured").Loop("measure");
+  out.LocalGet("i").LocalGet("count").Op(I32_GE_U).BrIf("measured");
+  out.LocalGet("list").LocalGet("i").I32Const(3).Op(I32_SHL).Op(I32_ADD).Op(I32_LOAD).LocalSet("part");
+  out.LocalGet("part").I32Const(0).Op(I32_LT_S).If(OWN_LINE);
+  out.LocalGet("part").I32Const(255).Op(I32_AND).I32Const(0).Op(I32_NE).LocalSet("length");
+  out.Else(OWN_LINE);
+  out.LocalGet("part").Op(I32_LOAD).LocalSet("length");
+  out.End();
+  out.LocalGet("list").LocalGet("i").I32Const(3).Op(I32_SHL).Op(I32_ADD).LocalGet("length").Op(I32_STORE, 4);
+  out.LocalGet("total").LocalGet("length").Op(I32_ADD).LocalSet("total");
+  out.LocalGet("i").I32Const(1).Op(I32_ADD).LocalSet("i");
+  out.Br("measure");
+  out.End().End();
+
+  // copy every part once, releasing strings that nothing holds
+  out.LocalGet("total").I32Const(5).Op(I32_ADD).Call("alloc").LocalSet("result");
+  out.LocalGet("result").I32Const(4).Op(I32_ADD).LocalSet("dest");
+  out.I32Const(0).LocalSet("i");
+  out.Block("copied").Loop("copy");
+  out.LocalGet("i").LocalGet("count").Op(I32_GE_U).BrIf("copied");
+  out.LocalGet("list").LocalGet("i").I32Const(3).Op(I32_SHL).Op(I32_ADD).Op(I32_LOAD).LocalSet("part");
+  out.LocalGet("list").LocalGet("i").I32Const(3).Op(I32_SHL).Op(I32_ADD).Op(I32_LOAD, 4).LocalSet("length");
+  out.LocalGet("part").I32Const(0).Op(I32_LT_S).If(OWN_LINE);
+  out.LocalGet("dest").LocalGet("part").Op(I32_STORE8);
+  out.Else();
+  out.LocalGet("dest").LocalGet("part").I32Const(4).Op(I32_ADD).LocalGet("length").Call("copy_bytes");
+  out.LocalGet("part").Call("release_temp");
+  out.End();
+  out.LocalGet("dest").LocalGet("length").Op(I32_ADD).LocalSet("dest");
+  out.LocalGet("i").I32Const(1).Op(I32_ADD).LocalSet("i");
+  out.Br("copy");
+  out.End().End();
+
+  // length and null terminator; the list is done with
+  out.LocalGet("result").LocalGet("total").Op(I32_STORE);
+  out.LocalGet("dest").I32Const(0).Op(I32_STORE8);
+  out.LocalGet("list").Call("free");
+  out.LocalGet("result");
+  out.EndFunc().Export("concat_n", "concat_n");
 }
 
-void SetAtFunction() {
-  std::cout << "  ;; Function to reassign a specific index of a string\n";
-  std::cout << "  (func $set_at\n";
-  std::cout << "    (param $str i32)    ;; Address of the string\n";
-  std::cout << "    (param $index i32)  ;; Index to modify\n";
-  std::cout << "    (param $char i32)   ;; ASCII value of the character\n";
-  std::cout << "    (result i32)        ;; Return the updated string address\n";
-  std::cout << "    (local $target_addr i32) ;; Address of the target index\n";
-  std::cout << "    (local $current_char i32) ;; Char at the current index (optional null-check)\n\n";
-
-  std::cout << "    ;; Calculate the target address: $str + $index\n";
-  std::cout << "    (local.get $str)\n";
-  std::cout << "    (local.get $index)\n";
-  std::cout << "    (i32.add)\n";
-  std::cout << "    (local.set $target_addr)\n\n";
-
-  std::cout << "    ;; Store the new character at the target address\n";
-  std::cout << "    (local.get $target_addr)\n";
-  std::cout << "    (local.get $char)\n";
-  std::cout << "    (i32.store8)\n\n";
-
-  std::cout << "    ;; Return the start of the string address\n";
-  std::cout << "    (local.get $str)\n";
-  std::cout << "  )\n\n";
-
-  std::cout << "  (export \"set_at\" (func $set_at))\n";
-  std::cout << ")\n";
+void PadCharFunction(WasmWriter & out) {
+  // hard coded function for a char repeated $count times (char * int): one
+  // allocation, then a single fill; a 0 char or a count below 1 makes an empty string
+  out.Func("pad_char", FOLDED).Param("char", I32).Param("count", I32).Result(I32);
+  out.Local("result", I32);
+  out.LocalGet("char").Op(I32_EQZ).LocalGet("count").I32Const(0).Op(I32_LT_S).Op(I32_OR).If(OWN_LINE);
+  out.I32Const(0).LocalSet("count");
+  out.End();
+  out.LocalGet("count").I32Const(5).Op(I32_ADD).Call("alloc").LocalSet("result");
+  out.LocalGet("result").LocalGet("count").Op(I32_STORE);
+  out.LocalGet("result").I32Const(4).Op(I32_ADD).LocalGet("char").LocalGet("count").Call("fill_bytes");
+  out.LocalGet("result").LocalGet("count").Op(I32_ADD).I32Const(0).Op(I32_STORE8, 4);
+  out.LocalGet("result");
+  out.EndFunc().Export("pad_char", "pad_char");
+}
+
+void RepeatStringFunction(WasmWriter & out) {
+  // hard coded function for a string repeated $count times (string * int): one
+  // allocation; the first copy comes from $str, then what's done so far is copied
+  // after itself (doubling it) until the result is full; $str is then released if nothing holds it
+  out.Func("repeat_string", FOLDED).Param("str", I32).Param("count", I32).Result(I32);
+  out.Local("result", I32).Local("length", I32).Local("total", I32).Local("done", I32);
+  out.LocalGet("str").Op(I32_LOAD).LocalSet("length");
+  out.LocalGet("count").I32Const(0).Op(I32_GT_S).LocalGet("length").I32Const(0).Op(I32_GT_U).Op(I32_AND).If();
+  // a length that doesn't fit in 31 bits traps, rather than making a short string
+  out.LocalGet("count").I32Const(2147483647).LocalGet("length").Op(I32_DIV_U).Op(I32_GT_U);
+  out.If(OWN_LINE).Op(UNREACHABLE).End();
+  out.LocalGet("length").LocalGet("count").Op(I32_MUL).LocalSet("total");
+  out.End();
+  out.LocalGet("total").I32Const(5).Op(I32_ADD).Call("alloc").LocalSet("result");
+  out.LocalGet("total").If();
+  out.LocalGet("result").I32Const(4).Op(I32_ADD);
+  out.LocalGet("str").I32Const(4).Op(I32_ADD).LocalGet("length").Call("copy_bytes");
+  out.LocalGet("length").LocalSet("done");
+  out.Block("full").Loop("double");
+  out.LocalGet("done").LocalGet("total").Op(I32_GE_U).BrIf("full");
+  out.LocalGet("total").LocalGet("done").Op(I32_SUB).LocalSet("length");
+  out.LocalGet("length").LocalGet("done").Op(I32_GT_U).If(INLINE).LocalGet("done").LocalSet("length").End();
+  out.LocalGet("result").I32Const(4).Op(I32_ADD).LocalGet("done").Op(I32_ADD);
+  out.Wrap(12).LocalGet("result").I32Const(4).Op(I32_ADD).LocalGet("length").Call("copy_bytes");
+  out.LocalGet("done").LocalGet("length").Op(I32_ADD).LocalSet("done");
+  out.Br("double");
+  out.End().End();
+  out.End();
+  out.LocalGet("result").LocalGet("total").Op(I32_STORE);
+  out.LocalGet("result").LocalGet("total").Op(I32_ADD).I32Const(0).Op(I32_STORE8, 4);
+  out.LocalGet("str").Call("release_temp");
+  out.LocalGet("result");
+  out.EndFunc().Export("repeat_string", "repeat_string");
 }
 
 class Tubular {
 private:
   // Private member variables and helper functions
+  SourceFile source;     // Must outlive tokens; they are lexed directly from it.
   TokenQueue tokens;
+  Arena arena;           // Holds the AST and Functions; freed when compilation ends.
   std::vector<Function*> functions{};
+  size_t num_threads = 1;  // For parsing and code generation; 0 means one per hardware thread.
+  bool fold = true;        // Fold constant expressions before generating code?
+  RuntimeFeatures features{};  // Wasm features the runtime functions may use.
+  MemoryPages pages{};         // Memory to start with, and the most it may grow to.
+  int literal_end = 0;     // Where the literal strings end (and strings made by folding begin).
+  bool binary = false;     // Generating a binary module (rather than text)?
+  size_t num_folded = 0;
+  size_t num_propagated = 0;
+
+  TimeReport * report = nullptr;             // Where to record phase times and counters, if anywhere.
+  CompileCache * cache = nullptr;            // Where to look for (and save) each function's code, if anywhere.
+  std::vector<CompileCache::Key> cache_keys{};  // Indexed like functions.
+  std::vector<bool> cache_hits{};
+  std::vector<std::string> cached_code{};
+
+  // Functions don't depend on each other once parsed, so with several threads
+  // each is generated into its own buffer (text, or a module fragment), and the
+  // buffers are then added in source order (making the output the same for any thread count).
+  void GenerateFunctions(WasmWriter & out) {
+    std::vector<double> seconds(report ? functions.size() : 0);  // Time to generate each function.
+    if (num_threads == 1 && !cache) {
+      for (size_t i = 0; i < functions.size(); ++i) {
+        TimeReport::Stopwatch watch(report);
+        functions[i]->GenerateCode(out);
+        if (report) seconds[i] = watch.Seconds();
+      }
+    } else {
+      std::vector<std::string> bodies(functions.size());
+      auto generate = [&](size_t i) {
+        if (cache && cache_hits[i]) {
+          bodies[i] = std::move(cached_code[i]);
+          return;
+        }
+        TimeReport::Stopwatch watch(report);
+        if (out.IsBinary()) {
+          WasmModule fragment = out.Module().Fragment();
+          WasmWriter body(fragment);
+          functions[i]->GenerateCode(body);
+          bodies[i] = fragment.TakeFragment();
+        } else {
+          Emitter text(bodies[i], FUNCTION_BUFFER_SIZE);
+          WasmWriter body(text);
+          functions[i]->GenerateCode(body);
+        }
+        if (report) seconds[i] = watch.Seconds();
+        // Strings made by folding are placed after every function's literals, so their
+        // positions depend on other functions; code that uses them isn't worth keeping.
+        if (cache && !functions[i]->HasFoldedStrings()) cache->Store(cache_keys[i], bodies[i]);
+      };
+      if (num_threads == 1) {
+        for (size_t i = 0; i < functions.size(); ++i) generate(i);
+      } else {
+        ThreadPool pool(num_threads);
+        pool.ParallelFor(functions.size(), generate);
+      }
+      for (const std::string & body : bodies) out.Append(body);
+    }
+    if (!report) return;
+    for (size_t i = 0; i < functions.size(); ++i) {
+      if (!cache || !cache_hits[i]) report->AddFunction(functions[i]->GetFunctionName(), seconds[i]);
+    }
+  }
+
+  // Lex the whole source up front, so function bodies can be parsed
+  // independently (on other threads, or sliced for the cache).  On one thread
+  // with no cache, stream the tokens instead: the parser reads them twice, but
+  // never holds more than a few.
+  void Lex() {
+    TimeReport::Scope phase(report, "lex");
+    if (num_threads == 1 && !cache) tokens.Stream(source.View());
+    else tokens.Load(source.View());
+    if (report) report->Count("tokens lexed", tokens.Size());
+  }
+
+  // Look up every function's code in the cache, once the signatures have been
+  // scanned.  A function's key covers everything its code depends on: the
+  // code generator version (whether it folds constants, and writes text or
+  // binary), the function's tokens and id, the signatures of the functions it
+  // calls (and in binary, their ids, which give their indices), and (if it has
+  // literal strings) where in memory they start.  Functions found are never
+  // parsed, so their literal strings are read straight from the tokens; the
+  // data segment comes out the same either way.
+  void LookUpCachedFunctions(const Parser & parser) {
+    const size_t count = functions.size();
+    cache_keys.resize(count);
+    cache_hits.assign(count, false);
+    cached_code.assign(count, std::string{});
+    int literal_base = 0;
+    std::vector<std::string_view> literals;
+    for (size_t i = 0; i < count; ++i) {
+      const Parser::FunctionRange & range = parser.Ranges()[i];
+      CompileCache::Hasher hasher;
+      hasher.Add(CACHE_VERSION).Add(fold).Add(binary).Add(range.function->GetId());
+      literals.clear();
+      TokenQueue body = tokens.Slice(range.begin, range.end);
+      while (body.Any()) {
+        const emplex::Token & token = body.Use();
+        const std::string_view lexeme = body.Lexeme(token);
+        hasher.Add(token.id).Add(lexeme);
+        if (token.id == Lexer::ID_literal_string) {
+          literals.push_back(lexeme.substr(1, lexeme.size() - 2));
+        } else if (token.id == Lexer::ID_identifier && body.Any() && body.Peek().id == Lexer::ID_open_parenthesis) {
+          // A call (or this function's own signature).
+          if (Function * callee = parser.FindFunction(token.symbol)) {
+            if (binary) hasher.Add(callee->GetId());
+            hasher.Add(callee->GetReturnType());
+            for (const auto & arg : callee->getArgs()) hasher.Add(arg.first);
+          } else {
+            hasher.Add(-1);
+          }
+        }
+      }
+      if (!literals.empty()) hasher.Add(literal_base);
+      for (std::string_view literal : literals) literal_base += Function::StringFootprint(literal);
+
+      cache_keys[i] = hasher.Finish();
+      if (cache->Load(cache_keys[i], cached_code[i])) {
+        cache_hits[i] = true;
+        for (std::string_view literal : literals) functions[i]->addLiteralString(nullptr, literal);
+      }
+    }
+  }
+
 public:
-  Tubular(std::string filename) {    
-    std::ifstream in_file(filename);              // Load the input file
-    if (in_file.fail()) {
-      std::cerr << "ERROR: Unable to open file '" << filename << "'." << std::endl;
-      exit(1);
+  static constexpr size_t FUNCTION_BUFFER_SIZE = 4096;
+  // Part of every cache key.  Bump it with any change to the code generated for
+  // a function (GenerateCode, the runtime's signatures or the module layout),
+  // so that code cached by an older compiler is never reused.
+  static constexpr std::string_view CACHE_VERSION = "tubular codegen 2";
+
+  Tubular() = default;
+  Tubular(std::string filename) { Open(filename); }
+
+  // A Tubular can compile any number of programs, one after another; each
+  // reuses the arena chunks and token storage that earlier ones warmed up.
+  void Open(const std::string & filename) {
+    Clear();
+    {
+      TimeReport::Scope phase(report, "read source");
+      if (!source.Open(filename)) {               // Map (or read) the input file
+        Error("Unable to open file '", filename, "'.");
+      }
     }
-    tokens.Load(in_file);  // Load all tokens from the file.
+    Lex();
+  }
+
+  // Compile source text held in memory instead (e.g., a compile-server request).
+  void Assign(std::string_view text) {
+    Clear();
+    source.Assign(text);
+    Lex();
+  }
+
+  // Forget the previous program (its AST is destroyed, but the arena's chunks are kept).
+  void Clear() {
+    functions.clear();
+    literal_end = 0;
+    num_folded = num_propagated = 0;
+    cache_keys.clear();
+    cache_hits.clear();
+    cached_code.clear();
+    arena.Reset();
   }
 
   void Parse() {
     // Outer layer can only be function definitions.
-    Parser parser(tokens);
-    functions = parser.Parse();
+    TimeReport::Scope phase(report, "parse");
+    Parser parser(tokens, arena);
+    {
+      TimeReport::Scope subphase(report, "signatures");
+      functions = parser.ScanSignatures();
+    }
+    if (cache) {
+      TimeReport::Scope subphase(report, "cache lookup");
+      LookUpCachedFunctions(parser);
+    }
+    {
+      TimeReport::Scope subphase(report, "bodies");
+      parser.ParseBodies(num_threads, cache_hits);  // With a cache, only the functions not found.
+      literal_end = parser.PlaceLiteralStrings();
+    }
+    if (report) report->Count("functions", functions.size());
   }
 
-  void ToWASM() {
-    // CODE GOES HERE to convert the AST made in Parse() into WebAssembly Text
+  void TypeCheck() {
+    // Cache every expression's type, and report all type errors at once.
+    TimeReport::Scope phase(report, "typecheck");
+    TypeChecker checker;
+    checker.Check(functions);
+    if (report) report->Count("AST nodes", checker.NumNodes());
+    checker.ReportErrors();
+  }
+
+  // Replace constant expressions by their values (see ConstantFolder), and
+  // lay out the strings that makes after the literal strings.
+  void Fold() {
+    TimeReport::Scope phase(report, "fold constants");
+    ConstantFolder folder(arena);
+    folder.Fold(functions);
+    int memory_pos = literal_end;
+    for (Function * function : functions) memory_pos = function->PlaceFoldedStrings(memory_pos);
+    num_folded = folder.NumFolded();
+    num_propagated = folder.NumPropagated();
+    if (report) {
+      report->Count("expressions folded", num_folded);
+      report->Count("constants propagated", num_propagated);
+    }
+  }
 
-    std::cout << "(module\n"; // begin module
+  // Generate the whole module, as text or binary (see WasmWriter).
+  void Generate(WasmWriter & out) {
+    out.BeginModule(); // begin module
 
-    std::cout << "(memory (export \"memory\") 10)\n"; // allocate memory
+    out.Memory("memory", pages.initial, pages.max); // allocate memory
 
-    Function::GenerateLiteralStrings();
+    const int strings_end = Function::GenerateLiteralStrings(out, functions);
+    HeapFunctions(out, strings_end, pages); // hard coded allocator for strings made at run time
+    RefCountFunctions(out); // hard coded reference counting, to free strings once they're dead
 
-    GetSizeFunction(); // hard coded function for the size of a string
-    AddStringsFunction(); // hard coded function for adding two strings
-    CharToStringFunction(); // hard coded function for converting a char to a string
-    PadCharFunction(); // hard coded function for repeating a char
+    // Only these runtime functions depend on the features, so cached function code doesn't.
+    CopyBytesFunction(out, features); // hard coded function for copying bytes, used by the string functions
+    FillBytesFunction(out, features); // hard coded function for setting bytes to one value
+    GetSizeFunction(out); // hard coded function for the size of a string
+    HostStringFunctions(out, features); // hard coded functions for converting to and from C strings
+    AddStringsFunction(out); // hard coded function for adding two strings
+    ConcatFunction(out); // hard coded function for joining a chain of strings and chars
+    CharToStringFunction(out); // hard coded function for converting a char to a string
+    PadCharFunction(out); // hard coded function for repeating a char
+    RepeatStringFunction(out); // hard coded function for repeating a string
 
 
-    
-    for (auto& func : functions)
-      func->GenerateCode();
+    {
+      TimeReport::Scope subphase(report, "functions");
+      // Functions may call ones defined after them.
+      for (Function * function : functions) out.Declare(function->GetFunctionName());
+      GenerateFunctions(out);
+    }
+
+    out.EndModule(); // end module
+  }
+
+  void ToWASM(Emitter & out) {
+    // CODE GOES HERE to convert the AST made in Parse() into WebAssembly Text
+    TimeReport::Scope phase(report, "generate");
+    const size_t start_bytes = out.BytesWritten();
+    WasmWriter writer(out);
+    Generate(writer);
+    if (report) report->Count("WAT bytes", out.BytesWritten() - start_bytes);
+  }
+
+  // Write a binary module instead of text.  Each instruction is encoded as it
+  // is generated, so no text is made (or parsed) along the way.
+  void ToBinary(Emitter & out) {
+    WasmModule module;
+    {
+      TimeReport::Scope phase(report, "generate");
+      WasmWriter writer(module);
+      Generate(writer);
+    }
+    TimeReport::Scope phase(report, "write wasm");
+    const size_t start_bytes = out.BytesWritten();
+    module.Write(out);
+    if (report) report->Count("wasm bytes", out.BytesWritten() - start_bytes);
+  }
 
-    std::cout << ")\n"; // end module
+  // Parse, check and generate the loaded program, as text or (if emit_wasm) binary.
+  void Compile(bool emit_wasm, Emitter & out) {
+    binary = emit_wasm;
+    Parse();
+    TypeCheck();
+    if (fold) Fold();
+    if (emit_wasm) ToBinary(out);
+    else ToWASM(out);
+  }
+
+  void SetThreads(size_t count) { num_threads = count; }
+  void SetFold(bool fold_constants) { fold = fold_constants; }
+  void SetFeatures(const RuntimeFeatures & runtime_features) { features = runtime_features; }
+  void SetPages(const MemoryPages & memory_pages) { pages = memory_pages; }
+  // Record how long each phase takes; nullptr to not time anything.
+  void SetTimeReport(TimeReport * time_report) {
+    if constexpr (TimeReport::ENABLED) report = time_report;
+  }
+  // Reuse (and save) generated code for unchanged functions; nullptr to not use a cache.
+  void SetCache(CompileCache * function_cache) { cache = function_cache; }
+
+  // Print how much memory the AST needed, to help size the arena.
+  void PrintArenaReport(std::ostream & os) const { arena.PrintReport(os); }
+
+  void PrintFoldReport(std::ostream & os) const {
+    os << "constant folding: " << num_folded << " expression(s) folded, "
+       << num_propagated << " read(s) of constant locals replaced\n";
   }
 
   // ... OTHER USEFUL PUBLIC FUNCTIONS ...
@@ -380,14 +783,323 @@ public:
 };
 
 
+// How to compile each program (see main for the corresponding flags).
+struct CompileOptions {
+  bool emit_wasm = false;
+  size_t num_threads = 1;
+  bool fold = true;
+  CompileCache * cache = nullptr;
+  TimeReport * time_report = nullptr;
+  RuntimeFeatures features{};
+  MemoryPages pages{};
+};
+
+// Compile one program into out (text or binary); throws a CompileError on failure.
+void Compile(const std::string & filename, const CompileOptions & options, Emitter & out,
+             bool arena_report = false, bool fold_report = false) {
+  Tubular prog;
+  prog.SetThreads(options.num_threads);
+  prog.SetFold(options.fold);
+  prog.SetFeatures(options.features);
+  prog.SetPages(options.pages);
+  prog.SetCache(options.cache);
+  prog.SetTimeReport(options.time_report);
+  prog.Open(filename);
+  prog.Compile(options.emit_wasm, out);
+  if (arena_report) prog.PrintArenaReport(std::cerr);
+  if (fold_report) prog.PrintFoldReport(std::cerr);
+}
+
+// Read a batch manifest: one filename per line; blank lines and lines starting with # are skipped.
+bool ReadManifest(const std::string & manifest, std::vector<std::string> & filenames) {
+  std::ifstream file(manifest);
+  if (!file) return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    const size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') continue;
+    const size_t end = line.find_last_not_of(" \t\r");
+    filenames.push_back(line.substr(start, end - start + 1));
+  }
+  return true;
+}
+
+// Compile every file into out_dir, as <name>.wat (or .wasm), running whole
+// programs side by side on options.num_threads threads.  Each program is compiled
+// independently, so one failing doesn't affect the others.  A status line is
+// printed for each file, in the order given; returns how many failed.
+size_t CompileBatch(const std::vector<std::string> & filenames, const std::string & out_dir,
+                    CompileOptions options) {
+  struct Result {
+    std::string output;   // Where the code is written.
+    std::string error;    // Empty if the file compiled.
+  };
+  std::vector<Result> results(filenames.size());
+
+  // Two inputs with the same name (from different directories) would overwrite each other.
+  std::set<std::string> used_names;
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    const std::filesystem::path name = std::filesystem::path(filenames[i]).stem().string() + (options.emit_wasm ? ".wasm" : ".wat");
+    results[i].output = (std::filesystem::path(out_dir) / name).string();
+    if (!used_names.insert(name).second) {
+      results[i].error = ToString("ERROR: Output file '", results[i].output, "' is used by an earlier input.");
+    }
+  }
+
+  std::error_code dir_error;
+  std::filesystem::create_directories(out_dir, dir_error);
+  if (dir_error) {
+    std::cerr << "ERROR: Unable to create directory '" << out_dir << "'." << std::endl;
+    return filenames.size();
+  }
+
+  ThreadPool pool(options.num_threads);
+  options.num_threads = 1;  // Each program is compiled on a single thread.
+  pool.ParallelFor(filenames.size(), [&](size_t i) {
+    Result & result = results[i];
+    if (!result.error.empty()) return;
+    std::string code;
+    try {
+      Emitter out(code);
+      Compile(filenames[i], options, out);
+      out.Flush();
+    } catch (const CompileError & error) {
+      result.error = error.what();
+      return;
+    }
+    std::ofstream file(result.output, std::ios::binary);
+    file.write(code.data(), static_cast<std::streamsize>(code.size()));
+    file.close();
+    if (!file) result.error = ToString("ERROR: Unable to write file '", result.output, "'.");
+  });
+
+  size_t num_failed = 0;
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    if (results[i].error.empty()) {
+      std::cout << "ok    " << filenames[i] << " -> " << results[i].output << '\n';
+      continue;
+    }
+    ++num_failed;
+    std::cout << "FAIL  " << filenames[i] << '\n';
+    std::istringstream lines(results[i].error);
+    for (std::string line; std::getline(lines, line); ) std::cout << "        " << line << '\n';
+  }
+  std::cout << (filenames.size() - num_failed) << " compiled, " << num_failed << " failed" << std::endl;
+  return num_failed;
+}
+
+// Answer compile requests (see ServeProtocol.hpp) read from in_fd by writing
+// the responses to out_fd, until in_fd is closed.  The same Tubular and
+// output buffer are reused for every request, so they stay warm.
+void ServeConnection(int in_fd, int out_fd, Tubular & prog) {
+  std::string request;
+  std::string code;
+  Emitter out(code);
+  while (ServeProtocol::ReadFrame(in_fd, request) && !request.empty()) {
+    char status = ServeProtocol::STATUS_OK;
+    try {
+      prog.Assign(std::string_view(request).substr(1));
+      prog.Compile(request[0] == ServeProtocol::EMIT_WASM, out);
+      out.Flush();
+    } catch (const CompileError & error) {
+      out.Discard();
+      status = ServeProtocol::STATUS_ERROR;
+      code = error.what();
+    }
+    if (!ServeProtocol::WriteFrame(out_fd, status, code)) break;
+    code.clear();
+  }
+}
+
+// Listen on a Unix domain socket at path, serving each connection on one of
+// num_threads worker threads (each with its own warm Tubular).  Runs until killed.
+int ServeSocket(const std::string & path, size_t num_threads, const RuntimeFeatures & features,
+                const MemoryPages & pages) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "ERROR: Socket path '" << path << "' is too long." << std::endl;
+    return 1;
+  }
+  path.copy(address.sun_path, path.size());
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path.c_str());  // Left behind by an earlier server.
+  if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    std::cerr << "ERROR: Unable to listen on socket '" << path << "'." << std::endl;
+    return 1;
+  }
+
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+  ThreadPool pool(num_threads + 1);  // The calling thread only accepts; the workers serve.
+  while (true) {
+    const int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      std::cerr << "ERROR: Unable to accept connections on '" << path << "'." << std::endl;
+      return 1;
+    }
+    pool.Submit([connection, features, pages]() {
+      thread_local Tubular prog;
+      prog.SetFeatures(features);
+      prog.SetPages(pages);
+      ServeConnection(connection, connection, prog);
+      close(connection);
+    });
+  }
+}
+
 int main(int argc, char * argv[])
 {
-  if (argc != 2) {
-    std::cout << "Format: " << argv[0] << " [filename]" << std::endl;
-    exit(1);
+  std::vector<std::string> filenames;
+  bool arena_report = false;
+  bool fold_report = false;
+  bool fold = true;
+  bool cache_report = false;
+  bool time_report = false;
+  bool time_report_json = false;
+  std::string cache_dir;
+  bool emit_wasm = false;
+  RuntimeFeatures features;
+  MemoryPages pages;
+  bool batch = false;
+  bool serve = false;
+  std::string socket_path;
+  std::string out_dir;
+  bool bad_args = false;
+  std::optional<size_t> num_threads;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--arena-report") arena_report = true;
+    else if (arg == "--fold-report") fold_report = true;
+    else if (arg == "--no-fold") fold = false;
+    else if (arg == "--cache-report") cache_report = true;
+    else if (arg == "--time-report") time_report = true;
+    else if (arg == "--time-report=json") time_report = time_report_json = true;
+    else if (arg == "--cache-dir") {
+      if (i + 1 < argc) cache_dir = argv[++i];
+      else bad_args = true;
+    }
+    else if (arg.starts_with("--cache-dir=")) cache_dir = arg.substr(12);
+    else if (arg.starts_with("--initial-pages") || arg.starts_with("--max-pages")) {
+      // --initial-pages N / --max-pages N (or =N): memory to start with, and the most it may grow to.
+      const size_t name_end = arg.find('=');
+      const std::string name = arg.substr(0, name_end);
+      const std::string count = (name_end != std::string::npos) ? arg.substr(name_end + 1) : (i + 1 < argc ? argv[++i] : "");
+      if ((name != "--initial-pages" && name != "--max-pages") || count.empty() || count.size() > 9 ||
+          count.find_first_not_of("0123456789") != std::string::npos) bad_args = true;
+      else (name == "--initial-pages" ? pages.initial : pages.max) = static_cast<uint32_t>(std::stoul(count));
+    }
+    else if (arg.starts_with("-j")) {
+      // -j N or -jN: use N threads (0 = one per hardware thread).
+      const std::string count = (arg.size() > 2) ? arg.substr(2) : (i + 1 < argc ? argv[++i] : "");
+      if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos) bad_args = true;
+      else num_threads = std::stoul(count);
+    }
+    else if (arg == "--emit=wat") emit_wasm = false;
+    else if (arg == "--emit=wasm") emit_wasm = true;
+    else if (arg.starts_with("--features=")) bad_args |= !features.Parse(std::string_view(arg).substr(11));
+    else if (arg == "--batch") batch = true;
+    else if (arg == "--serve") serve = true;
+    else if (arg.starts_with("--serve=")) {
+      serve = true;
+      socket_path = arg.substr(8);
+    }
+    else if (arg == "-o") {
+      if (i + 1 < argc) out_dir = argv[++i];
+      else bad_args = true;
+    }
+    else if (arg.starts_with("--")) bad_args = true;
+    else filenames.push_back(arg);
+  }
+
+  if (pages.max == 0 || pages.max > MemoryPages::LIMIT || pages.initial > pages.max) {
+    std::cerr << "ERROR: --max-pages must be from 1 to " << MemoryPages::LIMIT
+              << ", and --initial-pages no more than --max-pages." << std::endl;
+    return 1;
   }
 
-  Tubular prog(argv[1]);
-  prog.Parse();
-  prog.ToWASM();
+  if (serve) {
+    if (bad_args || batch || arena_report || fold_report || !fold || !cache_dir.empty() || cache_report || time_report || !out_dir.empty() || !filenames.empty() || (socket_path.empty() && num_threads)) {
+      std::cout << "Format: " << argv[0] << " --serve[=socket_path] [-j N] [--features=simd,bulk-memory] [--initial-pages N] [--max-pages N]" << std::endl;
+      return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);  // A client hanging up must not kill the server.
+    if (!socket_path.empty()) return ServeSocket(socket_path, num_threads.value_or(0), features, pages);
+    Tubular prog;
+    prog.SetFeatures(features);
+    prog.SetPages(pages);
+    ServeConnection(STDIN_FILENO, STDOUT_FILENO, prog);
+    return 0;
+  }
+
+  if (cache_report && cache_dir.empty()) bad_args = true;
+  // Generated code for each function is kept here, to be reused by later compiles.
+  std::optional<CompileCache> cache;
+  if (!cache_dir.empty()) cache.emplace(cache_dir);
+  CompileCache * function_cache = cache ? &*cache : nullptr;
+
+  // Times for each phase of compilation (summed over every program, in --batch).
+  std::optional<TimeReport> times;
+  if (time_report) {
+    if (!TimeReport::ENABLED) {
+      std::cerr << "ERROR: --time-report is unavailable; the compiler was built with TUBULAR_TIMERS=0." << std::endl;
+      return 1;
+    }
+    times.emplace();
+  }
+  auto print_time_report = [&]() {
+    if (!times) return;
+    if (time_report_json) times->PrintJSON(std::cerr);
+    else times->Print(std::cerr);
+  };
+  CompileOptions options{emit_wasm, num_threads.value_or(1), fold, function_cache, times ? &*times : nullptr, features, pages};
+
+  if (batch) {
+    // Arguments of the form @file name a manifest listing more inputs.
+    std::vector<std::string> inputs;
+    for (const std::string & name : filenames) {
+      if (!name.starts_with('@')) inputs.push_back(name);
+      else if (!ReadManifest(name.substr(1), inputs)) {
+        std::cerr << "ERROR: Unable to open manifest '" << name.substr(1) << "'." << std::endl;
+        return 1;
+      }
+    }
+    if (bad_args || arena_report || fold_report || out_dir.empty() || inputs.empty()) {
+      std::cout << "Format: " << argv[0] << " --batch [--emit=wat|wasm] [--features=simd,bulk-memory] [--initial-pages N] [--max-pages N] [--no-fold] [-j N] [--cache-dir dir [--cache-report]] [--time-report[=json]] -o outdir file... [@manifest...]" << std::endl;
+      return 1;
+    }
+    // Each program is compiled on a single thread; the threads are spread across programs.
+    options.num_threads = num_threads.value_or(0);
+    const size_t num_failed = CompileBatch(inputs, out_dir, options);
+    if (cache_report) cache->PrintReport(std::cerr);
+    print_time_report();
+    return num_failed == 0 ? 0 : 1;
+  }
+
+  if (bad_args || !out_dir.empty() || filenames.size() != 1) {
+    std::cout << "Format: " << argv[0] << " [--arena-report] [--fold-report] [--emit=wat|wasm] [--features=simd,bulk-memory] [--initial-pages N] [--max-pages N] [--no-fold] [-j N] [--cache-dir dir [--cache-report]] [--time-report[=json]] [filename]   (use - to read from stdin)" << std::endl;
+    std::cout << "        " << argv[0] << " --batch [--emit=wat|wasm] [--features=simd,bulk-memory] [--initial-pages N] [--max-pages N] [--no-fold] [-j N] [--cache-dir dir [--cache-report]] [--time-report[=json]] -o outdir file... [@manifest...]" << std::endl;
+    std::cout << "        " << argv[0] << " --serve[=socket_path] [-j N] [--features=simd,bulk-memory] [--initial-pages N] [--max-pages N]   (requests as in ServeProtocol.hpp)" << std::endl;
+    return 1;
+  }
+
+  Emitter out;  // Buffered stdout
+  try {
+    Compile(filenames[0], options, out, arena_report, fold_report);
+  } catch (const CompileError & error) {
+    out.Discard();
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  {
+    TimeReport::Scope phase(options.time_report, "write output");
+    out.Flush();
+  }
+  if (out.Failed()) {
+    std::cerr << "ERROR: Unable to write output." << std::endl;
+    return 1;
+  }
+  if (cache_report) cache->PrintReport(std::cerr);
+  print_time_report();
 }
@@ -0,0 +1,78 @@
+#pragma once
+
+// Framing for the compile server (Project4 --serve).
+//
+// Every message, in either direction, is a frame: a 4-byte little-endian
+// payload length, then the payload.  A request's payload is one byte saying
+// what to emit (EMIT_WAT or EMIT_WASM) followed by the source text; a
+// response's is one status byte (STATUS_OK or STATUS_ERROR) followed by the
+// generated code, or by the error messages (one per line) if compilation
+// failed.  Requests on one connection are answered in order, and the server
+// keeps serving a connection until the client closes it.
+//
+// Example usage (client side):
+//   ServeProtocol::WriteFrame(fd, ServeProtocol::EMIT_WAT, source);
+//   std::string reply;
+//   if (ServeProtocol::ReadFrame(fd, reply) && reply[0] == ServeProtocol::STATUS_OK) ...
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace ServeProtocol {
+  constexpr char EMIT_WAT = 0;
+  constexpr char EMIT_WASM = 1;
+  constexpr char STATUS_OK = 0;
+  constexpr char STATUS_ERROR = 1;
+
+  // Larger frames are refused, so a corrupt length can't exhaust memory.
+  constexpr uint32_t MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+  // Read exactly size bytes; false on end of input or error.
+  inline bool ReadAll(int fd, char * data, size_t size) {
+    while (size > 0) {
+      const ssize_t count = ::read(fd, data, size);
+      if (count < 0 && errno == EINTR) continue;
+      if (count <= 0) return false;
+      data += count;
+      size -= static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  // Read one frame's payload into payload (reusing its storage); false at
+  // end of input, on error, or if the frame is too large.
+  inline bool ReadFrame(int fd, std::string & payload) {
+    unsigned char header[4];
+    if (!ReadAll(fd, reinterpret_cast<char *>(header), sizeof(header))) return false;
+    const uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (uint32_t{header[3]} << 24);
+    if (size > MAX_FRAME_SIZE) return false;
+    payload.resize(size);
+    return ReadAll(fd, payload.data(), size);
+  }
+
+  // Write a frame holding the tag byte followed by body, with a single writev where possible.
+  inline bool WriteFrame(int fd, char tag, std::string_view body) {
+    const uint32_t size = static_cast<uint32_t>(body.size() + 1);
+    char header[5] = { static_cast<char>(size), static_cast<char>(size >> 8),
+                       static_cast<char>(size >> 16), static_cast<char>(size >> 24), tag };
+    iovec parts[2] = { { header, sizeof(header) }, { const_cast<char *>(body.data()), body.size() } };
+    size_t first = 0;
+    while (first < 2) {
+      const ssize_t count = ::writev(fd, parts + first, static_cast<int>(2 - first));
+      if (count < 0 && errno == EINTR) continue;
+      if (count < 0) return false;
+      // Skip past whatever was written.
+      size_t done = static_cast<size_t>(count);
+      while (first < 2 && done >= parts[first].iov_len) done -= parts[first++].iov_len;
+      if (first < 2) {
+        parts[first].iov_base = static_cast<char *>(parts[first].iov_base) + done;
+        parts[first].iov_len -= done;
+      }
+    }
+    return true;
+  }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+// Read-only access to the full text of a source file.
+//
+// Regular files are memory-mapped so the lexer can scan them in place, without
+// first copying them into a std::string.  Inputs that cannot be mapped (pipes,
+// terminals, or stdin given as "-") fall back to reading in large blocks.
+//
+// Example usage:
+//   SourceFile source;
+//   if (!source.Open(filename)) { ... }
+//   tokens.Load(source.View());     // View stays valid as long as source lives.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+class SourceFile {
+private:
+  const char * map_data = nullptr;  // Start of the mapping (if mapped).
+  size_t map_size = 0;              // Number of bytes mapped.
+  std::string buffer{};             // Contents, when the input could not be mapped.
+
+  static constexpr size_t READ_BLOCK = 1 << 16;
+
+  // Read everything remaining on fd into buffer.
+  bool ReadAll(int fd) {
+    size_t used = 0;
+    while (true) {
+      if (buffer.size() - used < READ_BLOCK) buffer.resize(used + 4 * READ_BLOCK);
+      ssize_t count = read(fd, buffer.data() + used, buffer.size() - used);
+      if (count < 0 && errno == EINTR) continue;  // Interrupted by a signal before reading anything.
+      if (count < 0) return false;
+      if (count == 0) break;
+      used += static_cast<size_t>(count);
+    }
+    buffer.resize(used);
+    return true;
+  }
+
+  // Try to map a regular file; returns false if it must be read instead.
+  bool Map(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) return false;
+    void * data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+    map_data = static_cast<const char *>(data);
+    map_size = static_cast<size_t>(info.st_size);
+    return true;
+  }
+
+public:
+  SourceFile() = default;
+  SourceFile(const SourceFile &) = delete;
+  SourceFile(SourceFile && in) { *this = std::move(in); }
+  ~SourceFile() { Close(); }
+
+  SourceFile & operator=(const SourceFile &) = delete;
+  SourceFile & operator=(SourceFile && in) {
+    if (this != &in) {
+      Close();
+      std::swap(map_data, in.map_data);
+      std::swap(map_size, in.map_size);
+      std::swap(buffer, in.buffer);
+    }
+    return *this;
+  }
+
+  // Load a file by name ("-" reads stdin); returns false if it cannot be read.
+  bool Open(const std::string & filename) {
+    Close();
+    if (filename == "-") return ReadAll(STDIN_FILENO);
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool success = Map(fd) || ReadAll(fd);
+    close(fd);
+    return success;
+  }
+
+  // Use a copy of in-memory text as the source (e.g., for testing, or a
+  // compile-server request).  The buffer's storage is reused from call to call.
+  void Assign(std::string_view text) {
+    Close();
+    buffer.assign(text);
+  }
+
+  void Close() {
+    if (map_data) munmap(const_cast<char *>(map_data), map_size);
+    map_data = nullptr;
+    map_size = 0;
+    buffer.clear();
+  }
+
+  bool IsMapped() const { return map_data != nullptr; }
+  size_t Size() const { return IsMapped() ? map_size : buffer.size(); }
+
+  // View of the complete source text.
+  std::string_view View() const {
+    if (IsMapped()) return std::string_view(map_data, map_size);
+    return buffer;
+  }
+};
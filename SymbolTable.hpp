@@ -2,9 +2,10 @@
 
 #include <assert.h>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include "DataType.hpp"
+#include "InternTable.hpp"
+#include "tools.hpp"
 
 
 struct VarData {
@@ -14,68 +15,100 @@ struct VarData {
   VarData(int unique_id, DataType type) : unique_id(unique_id), type(type) {}
 };
 
+// Variables are looked up by their interned name (see InternTable).
+//
+// Rather than keeping a map per scope, the table holds the one binding that is
+// currently visible for each symbol, indexed directly by symbol.  Declaring a
+// variable shadows any outer binding and records the old one in an undo log;
+// popping a scope replays the log back to where that scope began.  Every
+// lookup is then a single array access, however deeply scopes are nested.
 class SymbolTable {
 private:
-  std::vector<std::unordered_map<std::string, int>> scopes;
-  std::vector<VarData> variables;
-  int unique_id_increment = 0;
+  struct Binding {
+    int unique_id = -1;  // -1 if no variable with this name is visible.
+    int depth = -1;      // Scope depth the variable was declared at.
+  };
+  struct Undo {
+    int symbol;
+    Binding previous;
+  };
+
+  std::vector<VarData> variables;   // Indexed by unique id.
+  std::vector<Binding> bindings;    // Indexed by symbol.
+  std::vector<Undo> undo_log;       // Bindings replaced in open scopes.
+  std::vector<size_t> scope_starts; // undo_log size when each scope opened.
+  const InternTable & names; // Only used for error messages.
+
+  int Depth() const { return static_cast<int>(scope_starts.size()) - 1; }
+
+  // Restore every binding replaced since the current scope opened, newest first.
+  void PopBindings() {
+    while (undo_log.size() > scope_starts.back()) {
+      bindings[static_cast<size_t>(undo_log.back().symbol)] = undo_log.back().previous;
+      undo_log.pop_back();
+    }
+  }
 
-  std::unordered_map<std::string, int>& GetCurrentScope() {
-    return scopes.back();
+  Binding Lookup(int symbol) const {
+    if (symbol < 0 || static_cast<size_t>(symbol) >= bindings.size()) return Binding{};
+    return bindings[static_cast<size_t>(symbol)];
   }
 
 public:
-  SymbolTable() {
+  SymbolTable(const InternTable & names) : names(names) {
     PushScope(); // Initialize with the global scope
   }
 
-  bool HasVarInCurrentScope(const std::string& name) {
-    return GetCurrentScope().find(name) != GetCurrentScope().end();
+  // Forget every variable and scope, ready for a new function.
+  void Reset() {
+    scope_starts.resize(1);
+    scope_starts[0] = 0;
+    PopBindings();
+    variables.clear();
   }
 
-  bool HasVar(const std::string& name) {
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-      if (it->find(name) != it->end())
-        return true;
-    }
-    return false;
+  bool HasVarInCurrentScope(int symbol) const {
+    return Lookup(symbol).depth == Depth();
+  }
+
+  bool HasVar(int symbol) const {
+    return Lookup(symbol).unique_id >= 0;
   }
 
   DataType GetDataType(int unique_id) const {
-    for (const auto& varData : variables) {
-      if (varData.unique_id == unique_id)
-        return varData.type;
-    }
-    return DataType::INTEGER; // Error case, should't be reachable (to prevent warnings)
+    assert(unique_id >= 0 && static_cast<size_t>(unique_id) < variables.size());
+    return variables[static_cast<size_t>(unique_id)].type;
   }
 
-  int GetUniqueId(const std::string& name) {
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-      auto found = it->find(name);
-      if (found != it->end())
-        return found->second;
-    }
-    Error("Variable not defined: " + name);
-    return -1;
+  int GetUniqueId(int symbol) const {
+    const int unique_id = Lookup(symbol).unique_id;
+    if (unique_id < 0) Error("Variable not defined: ", names.Name(symbol));
+    return unique_id;
   }
 
-  int InitializeVar(const std::string& name, const DataType& type) {
-    if (HasVarInCurrentScope(name)) {
-      Error("Variable already defined in this scope: " + name);
+  int InitializeVar(int symbol, const DataType& type) {
+    if (HasVarInCurrentScope(symbol)) {
+      Error("Variable already defined in this scope: ", names.Name(symbol));
     }
 
-    GetCurrentScope()[name] = unique_id_increment;
-    variables.emplace_back(unique_id_increment, type); // New variable with default value 0
-    return unique_id_increment++;
+    if (static_cast<size_t>(symbol) >= bindings.size()) bindings.resize(static_cast<size_t>(symbol) + 1);
+    Binding & binding = bindings[static_cast<size_t>(symbol)];
+    undo_log.push_back(Undo{symbol, binding});
+
+    const int unique_id = static_cast<int>(variables.size());
+    binding = Binding{unique_id, Depth()};
+    variables.emplace_back(unique_id, type);
+    return unique_id;
   }
 
   void PushScope() {
-    scopes.emplace_back();
+    scope_starts.push_back(undo_log.size());
   }
 
   void PopScope() {
-    if (scopes.size() > 1) {
-      scopes.pop_back();
+    if (scope_starts.size() > 1) {
+      PopBindings();
+      scope_starts.pop_back();
     } else {
       Error("No scope to pop");
     }
@@ -84,11 +117,11 @@ public:
 
   /*
   This function tells us if we are inside any of the scopes.
-  This is needed because if we return from inside if or while, 
+  This is needed because if we return from inside if or while,
   we need to add a "break" statement in our code.
   This can be achieved by checking if we are inside any of the scopes (excluding main function scope).
   */
   bool InsideTheScope() {
-    return scopes.size() > 1;
+    return scope_starts.size() > 1;
   }
-};
\ No newline at end of file
+};
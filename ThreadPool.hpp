@@ -0,0 +1,156 @@
+#pragma once
+
+// A small work-stealing thread pool.
+//
+// Each thread (including the one that calls Wait) has its own task queue.  A
+// thread takes work from the back of its own queue, and when that runs dry it
+// steals from the front of the others', so uneven tasks (e.g., one huge
+// function among many small ones) still keep every thread busy.  With a single
+// thread, no threads are started and tasks simply run inside Wait().
+//
+// Example usage:
+//   ThreadPool pool(4);
+//   pool.ParallelFor(items.size(), [&](size_t i) { Process(items[i]); });
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class ThreadPool {
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;  // queues[0] belongs to the caller of Wait().
+  std::vector<std::thread> workers;            // Worker i uses queues[i+1].
+  std::atomic<size_t> queued = 0;              // Tasks waiting in some queue.
+  std::atomic<size_t> pending = 0;             // Tasks submitted but not yet finished.
+  std::atomic<size_t> next_queue = 0;          // Round-robin target for Submit.
+  std::mutex wake_mutex;
+  std::condition_variable wake;                // Signaled on new work or when all work is done.
+  bool stopping = false;
+  std::exception_ptr error = nullptr;          // First exception thrown by a task.
+  std::mutex error_mutex;
+
+  // Take a task from our own queue (newest first), or else steal one from another (oldest first).
+  bool TryPop(size_t self, std::function<void()> & task) {
+    {
+      Queue & own = *queues[self];
+      std::lock_guard lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --queued;
+        return true;
+      }
+    }
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+      Queue & victim = *queues[(self + offset) % queues.size()];
+      std::lock_guard lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Run(std::function<void()> & task) {
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard lock(error_mutex);
+      if (!error) error = std::current_exception();
+    }
+    if (--pending == 0) {
+      std::lock_guard lock(wake_mutex);
+      wake.notify_all();
+    }
+  }
+
+  void WorkerLoop(size_t self) {
+    std::function<void()> task;
+    while (true) {
+      if (TryPop(self, task)) { Run(task); continue; }
+      std::unique_lock lock(wake_mutex);
+      wake.wait(lock, [this]() { return stopping || queued > 0; });
+      if (stopping) return;
+    }
+  }
+
+public:
+  // Use num_threads threads in all (0 means one per hardware thread).
+  explicit ThreadPool(size_t num_threads = 0) {
+    if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < num_threads; ++i) queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 1; i < num_threads; ++i) workers.emplace_back([this, i]() { WorkerLoop(i); });
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(wake_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread & worker : workers) worker.join();
+  }
+
+  size_t NumThreads() const { return queues.size(); }
+
+  void Submit(std::function<void()> task) {
+    ++pending;
+    Queue & queue = *queues[next_queue++ % queues.size()];
+    {
+      std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+      ++queued;  // Before unlocking, so a thief can't take it first and underflow the count.
+    }
+    std::lock_guard lock(wake_mutex);
+    wake.notify_one();
+  }
+
+  // Help run tasks until every submitted task has finished.  If any task
+  // threw, the first exception is rethrown here.
+  void Wait() {
+    std::function<void()> task;
+    while (pending > 0) {
+      if (TryPop(0, task)) { Run(task); continue; }
+      std::unique_lock lock(wake_mutex);
+      wake.wait(lock, [this]() { return pending == 0 || queued > 0; });
+    }
+    std::lock_guard lock(error_mutex);
+    if (error) std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+  // Call fn(i) for every i in [0, count) and wait for all of them.  If any
+  // calls threw, the exception from the lowest i is rethrown, so which error
+  // is reported doesn't depend on how the threads happened to be scheduled.
+  template <typename FN>
+  void ParallelFor(size_t count, FN fn) {
+    std::vector<std::exception_ptr> errors(count);
+    for (size_t i = 0; i < count; ++i) {
+      Submit([&fn, &errors, i]() {
+        try { fn(i); } catch (...) { errors[i] = std::current_exception(); }
+      });
+    }
+    Wait();
+    for (std::exception_ptr & error : errors) {
+      if (error) std::rethrow_exception(error);
+    }
+  }
+};
@@ -0,0 +1,214 @@
+#pragma once
+
+// Where compilation time goes: scoped timers for each phase, plus counters
+// (tokens lexed, AST nodes, bytes emitted, ...) and per-function codegen times.
+//
+// Timing only happens when a report is given (e.g., with --time-report); with
+// a null report, a Scope or Stopwatch does nothing.  Building with
+// -DTUBULAR_TIMERS=0 removes the instrumentation altogether: Scope and
+// Stopwatch become empty, and ENABLED lets callers skip the rest at compile time.
+//
+// Example usage:
+//   TimeReport report;
+//   {
+//     TimeReport::Scope timer(&report, "parse");  // Nested scopes show up indented.
+//     ...
+//   }
+//   report.Count("functions", functions.size());
+//   report.Print(std::cerr);      // Or PrintJSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef TUBULAR_TIMERS
+#define TUBULAR_TIMERS 1
+#endif
+
+class TimeReport {
+public:
+  static constexpr bool ENABLED = TUBULAR_TIMERS;
+  using clock_type = std::chrono::steady_clock;
+
+private:
+  struct Phase {
+    std::string name;
+    int depth;          // How many scopes it was nested inside (when first seen).
+    size_t calls = 0;
+    double seconds = 0.0;
+  };
+
+  std::vector<Phase> phases{};                               // In the order first seen.
+  std::vector<std::pair<std::string, uint64_t>> counters{};  // Likewise.
+  std::vector<std::pair<std::string, double>> function_seconds{};
+  mutable std::mutex mutex;  // Phases may be timed on several threads (e.g., in --batch).
+
+  static int & Depth() {
+    thread_local int depth = 0;
+    return depth;
+  }
+
+  // Phases are added when they start, so each is listed before the phases nested inside it.
+  size_t StartPhase(std::string_view name, int depth) {
+    std::lock_guard lock(mutex);
+    auto it = std::find_if(phases.begin(), phases.end(), [&](const Phase & phase) { return phase.name == name; });
+    if (it == phases.end()) it = phases.insert(phases.end(), Phase{std::string(name), depth});
+    return static_cast<size_t>(it - phases.begin());
+  }
+
+  void EndPhase(size_t index, double seconds) {
+    std::lock_guard lock(mutex);
+    ++phases[index].calls;
+    phases[index].seconds += seconds;
+  }
+
+  // Total of the outermost phases.
+  double TotalSeconds() const {
+    double total = 0.0;
+    for (const Phase & phase : phases) {
+      if (phase.depth == 0) total += phase.seconds;
+    }
+    return total;
+  }
+
+  static void WriteJSONString(std::ostream & os, std::string_view str) {
+    os << '"';
+    for (char c : str) {
+      if (c == '"' || c == '\\') os << '\\' << c;
+      else if (static_cast<unsigned char>(c) < 0x20) {
+        char escape[8];
+        std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+        os << escape;
+      }
+      else os << c;
+    }
+    os << '"';
+  }
+
+public:
+  // Times from construction to destruction, adding the time to the named phase.
+  class Scope {
+#if TUBULAR_TIMERS
+  private:
+    TimeReport * report;
+    size_t phase = 0;
+    clock_type::time_point start{};
+
+  public:
+    Scope(TimeReport * report, std::string_view name) : report(report) {
+      if (!report) return;
+      phase = report->StartPhase(name, Depth()++);
+      start = clock_type::now();
+    }
+    ~Scope() {
+      if (!report) return;
+      report->EndPhase(phase, std::chrono::duration<double>(clock_type::now() - start).count());
+      --Depth();
+    }
+#else
+  public:
+    Scope(TimeReport *, std::string_view) { }
+#endif
+    Scope(const Scope &) = delete;
+    Scope & operator=(const Scope &) = delete;
+  };
+
+  // Measures time since construction, for timings that aren't phases (see AddFunction).
+  class Stopwatch {
+#if TUBULAR_TIMERS
+  private:
+    clock_type::time_point start{};
+
+  public:
+    explicit Stopwatch(const TimeReport * report) {
+      if (report) start = clock_type::now();
+    }
+    double Seconds() const { return std::chrono::duration<double>(clock_type::now() - start).count(); }
+#else
+  public:
+    explicit Stopwatch(const TimeReport *) { }
+    double Seconds() const { return 0.0; }
+#endif
+  };
+
+  // Add amount to the named counter.
+  void Count(std::string_view name, uint64_t amount) {
+    if constexpr (!ENABLED) return;
+    std::lock_guard lock(mutex);
+    auto it = std::find_if(counters.begin(), counters.end(), [&](const auto & counter) { return counter.first == name; });
+    if (it == counters.end()) counters.emplace_back(std::string(name), amount);
+    else it->second += amount;
+  }
+
+  // Record how long one function took to generate.
+  void AddFunction(std::string_view name, double seconds) {
+    if constexpr (!ENABLED) return;
+    std::lock_guard lock(mutex);
+    function_seconds.emplace_back(std::string(name), seconds);
+  }
+
+  // A table of phases (indented by nesting), counters, and the slowest functions.
+  void Print(std::ostream & os, size_t max_functions = 10) const {
+    std::lock_guard lock(mutex);
+    const double total = TotalSeconds();
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-32s %8s %12s %7s\n", "phase", "calls", "time (ms)", "%");
+    os << line;
+    for (const Phase & phase : phases) {
+      const std::string name = std::string(2 * static_cast<size_t>(phase.depth), ' ') + phase.name;
+      std::snprintf(line, sizeof(line), "%-32s %8zu %12.3f %7.1f\n", name.c_str(), phase.calls,
+                    phase.seconds * 1000.0, total > 0.0 ? 100.0 * phase.seconds / total : 0.0);
+      os << line;
+    }
+    std::snprintf(line, sizeof(line), "%-32s %8s %12.3f\n", "total", "", total * 1000.0);
+    os << line;
+
+    if (!counters.empty()) os << "\n";
+    for (const auto & [name, value] : counters) {
+      std::snprintf(line, sizeof(line), "%-32s %21llu\n", name.c_str(), static_cast<unsigned long long>(value));
+      os << line;
+    }
+
+    if (function_seconds.empty()) return;
+    std::vector<std::pair<std::string, double>> slowest = function_seconds;
+    std::stable_sort(slowest.begin(), slowest.end(), [](const auto & a, const auto & b) { return a.second > b.second; });
+    if (slowest.size() > max_functions) slowest.resize(max_functions);
+    os << "\nslowest functions to generate:\n";
+    for (const auto & [name, seconds] : slowest) {
+      std::snprintf(line, sizeof(line), "  %-30s %21.3f\n", name.c_str(), seconds * 1000.0);
+      os << line;
+    }
+  }
+
+  // The same information as one JSON object, with every function's time (in source order).
+  void PrintJSON(std::ostream & os) const {
+    std::lock_guard lock(mutex);
+    os << "{\n  \"total_seconds\": " << TotalSeconds() << ",\n  \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+      os << (i ? ",\n    " : "\n    ") << "{\"name\": ";
+      WriteJSONString(os, phases[i].name);
+      os << ", \"depth\": " << phases[i].depth << ", \"calls\": " << phases[i].calls
+         << ", \"seconds\": " << phases[i].seconds << "}";
+    }
+    os << "\n  ],\n  \"counters\": {";
+    for (size_t i = 0; i < counters.size(); ++i) {
+      os << (i ? ",\n    " : "\n    ");
+      WriteJSONString(os, counters[i].first);
+      os << ": " << counters[i].second;
+    }
+    os << "\n  },\n  \"functions\": [";
+    for (size_t i = 0; i < function_seconds.size(); ++i) {
+      os << (i ? ",\n    " : "\n    ") << "{\"name\": ";
+      WriteJSONString(os, function_seconds[i].first);
+      os << ", \"seconds\": " << function_seconds[i].second << "}";
+    }
+    os << "\n  ]\n}\n";
+  }
+};
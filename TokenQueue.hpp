@@ -2,84 +2,208 @@
 
 // A dynamic token manager.
 // 
+// Tokens can either be lexed all at once (Load), or pulled from the lexer on
+// demand into a small ring buffer (Stream).  When streaming, memory for tokens
+// stays constant regardless of the size of the source, and parsing can begin
+// before the whole input has been scanned.
+//
 // Example usages:
 //   TokenQueue tokens;
-//   tokens.Load(filename);          // Load a file
+//   tokens.Load(source.View());     // Lex all of the source text
+//   tokens.Stream(source.View());   // ...or lex it lazily as it is used
 //   auto token = tokens.Use();      // Get the next token and advance
 //   bool found = tokens.UseIf('$'); // Use the next token IF it is a dollar sign
 //   auto token2 = tokens.Peek();    // Get the next token _without_ advancing
 //
 //   // Use the next token; if it is NOT an IDENTIFIER token, give an error and exit!
 //   auto token3 = tokens.Use(Lexer::ID_IDENTIFIER);
-//   
+//
+//   // A loaded queue can be sliced into independent queues over ranges of its
+//   // tokens (e.g., one per function body, to be parsed on separate threads).
+//   TokenQueue body = tokens.Slice(begin, end);
 
+#include <array>
 #include <assert.h>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
+#include "InternTable.hpp"
 #include "tools.hpp"
 #include "lexer.hpp"
 
 class TokenQueue {
 private:
-  emplex::Lexer lexer;
+  // When streaming, tokens are lexed (and identifiers interned) lazily, even from
+  // const accessors like Peek; members touched by that are mutable.
+  mutable emplex::Lexer lexer;
+
+  std::string_view source{};      // Text that all token offsets refer to.
+  std::string owned_source{};     // Storage for source, when loaded from a stream.
+  mutable InternTable interns{};  // Symbols for every identifier in source.
 
   std::vector<emplex::Token> tokens{};
-  size_t token_id = 0;
+  std::span<const emplex::Token> loaded{};  // Tokens in use: all of tokens, or part of parent's.
+  const TokenQueue * parent = nullptr;      // Queue this one is a slice of, if any.
+  size_t token_id = 0;              // Position of the next token to be used.
+
+  // Streaming mode keeps only a window of tokens around token_id: one behind
+  // (for Rewind) plus the parser's lookahead (Peek and PeekByIndex(1)).
+  static constexpr size_t WINDOW_SIZE = 4;  // Must be a power of two.
+  static constexpr size_t MAX_LOOKAHEAD = WINDOW_SIZE - 1;
+  bool streaming = false;
+  mutable std::array<emplex::Token, WINDOW_SIZE> window{};
+  mutable size_t lexed_count = 0;   // Tokens pulled from the lexer so far.
+  mutable bool lexer_done = false;  // Has the lexer reached the end of source?
 
   static const emplex::Token eof_token;
 
-  // == Helper functions ==
-  void Cleanup() {
-    assert(token_id <= tokens.size());
-    if (token_id) {
-      tokens.erase(tokens.begin(), tokens.begin()+token_id);
-      token_id = 0;
+  // Lex the next token that the parser should see, skipping whitespace and comments.
+  emplex::Token NextToken(emplex::Lexer & from) const {
+    emplex::Token token;
+    do { token = from.NextToken(source); } while (token && emplex::Lexer::IgnoreToken(token.id));
+    return token;
+  }
+
+  // Lex the next token from this queue's lexer, interning identifiers.
+  emplex::Token LexNext() const {
+    emplex::Token token = NextToken(lexer);
+    if (token.id == emplex::Lexer::ID_identifier) token.symbol = interns.Intern(Lexeme(token));
+    return token;
+  }
+
+  // Streaming mode: make sure tokens up to position pos are in the window.
+  void Fill(size_t pos) const {
+    while (!lexer_done && lexed_count <= pos) {
+      emplex::Token token = LexNext();
+      if (!token) lexer_done = true;
+      else window[lexed_count++ % WINDOW_SIZE] = token;
     }
   }
 
+  // Return the token at position pos, or nullptr if the input ends before it.
+  const emplex::Token * At(size_t pos) const {
+    if (!streaming) return (pos < loaded.size()) ? &loaded[pos] : nullptr;
+    Fill(pos);
+    if (pos >= lexed_count) return nullptr;
+    assert(pos + WINDOW_SIZE > lexed_count);  // Still inside the window?
+    return &window[pos % WINDOW_SIZE];
+  }
+
+  // A queue over tokens [begin, end) of a loaded queue; see Slice.
+  TokenQueue(const TokenQueue & from, size_t begin, size_t end)
+    : source(from.source), loaded(from.loaded.subspan(begin, end - begin)), parent(&from) {
+    assert(!from.streaming && begin <= end && end <= from.loaded.size());
+  }
+
 public:
-  void Reset() { tokens.resize(0); token_id = 0; }
+  TokenQueue() = default;
+  TokenQueue(const TokenQueue &) = delete;  // Would leave source dangling.
+  TokenQueue & operator=(const TokenQueue &) = delete;
+
+  void Reset() {
+    tokens.resize(0);
+    loaded = {};
+    parent = nullptr;
+    token_id = 0;
+    streaming = false;
+    lexed_count = 0;
+    lexer_done = false;
+  }
 
   // Load in tokens from a stream.
   void Load(std::istream & is) {
-    Cleanup();
-    auto new_tokens = lexer.Tokenize(is);
-    if (tokens.size() == 0) std::swap(tokens, new_tokens);
-    else tokens.insert( tokens.end(), new_tokens.begin(), new_tokens.end() );
+    owned_source.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    Load(std::string_view(owned_source));
   }
 
-  // Load in tokens from a string.
-  void Load(const std::string & str) {
-    Cleanup();
-    auto new_tokens = lexer.Tokenize(str);
-    if (tokens.size() == 0) std::swap(tokens, new_tokens);
-    else tokens.insert( tokens.end(), new_tokens.begin(), new_tokens.end() );
+  // Load in tokens from a string (or a view of a memory-mapped SourceFile).
+  // Tokens only refer into the text, so it must outlive this queue.
+  void Load(std::string_view str) {
+    Reset();
+    source = str;
+    interns.Clear();
+    lexer.Reset();
+    while (emplex::Token token = LexNext()) tokens.push_back(token);
+    loaded = tokens;
   }
 
-  // Count remaining tokens.
-  size_t Size() const { return tokens.size() - token_id; }
+  // A new queue over tokens [begin, end) of this (loaded) one.  It shares this
+  // queue's tokens and symbols, which must outlive it, but has its own
+  // position, so slices can be used from different threads at once.
+  TokenQueue Slice(size_t begin, size_t end) const { return TokenQueue(*this, begin, end); }
+
+  // Lex tokens from a string only as they are needed.  As with Load, the text
+  // must outlive this queue.
+  void Stream(std::string_view str) {
+    Reset();
+    source = str;
+    interns.Clear();
+    lexer.Reset();
+    streaming = true;
+  }
+
+  // Stream the same text again from its start.  Symbols are kept, so each
+  // identifier gets the same one it did the first time through.
+  void Restart() {
+    assert(streaming);
+    token_id = 0;
+    lexed_count = 0;
+    lexer_done = false;
+    lexer.Reset();
+  }
+
+  bool IsStreaming() const { return streaming; }
+
+  // Get the text for a token from this queue.
+  std::string_view Lexeme(const emplex::Token & token) const {
+    if (token.id == 0) return "_EOF_";
+    return token.Lexeme(source);
+  }
+
+  const InternTable & Interns() const { return parent ? parent->Interns() : interns; }
+
+  // Count remaining tokens.  When streaming, this lexes the rest of the input
+  // on a copy of the lexer, without interning; the queue itself is unchanged.
+  size_t Size() const {
+    if (!streaming) return loaded.size() - token_id;
+    size_t count = lexed_count - token_id;
+    if (!lexer_done) {
+      emplex::Lexer scout = lexer;  // Copy, so the stream position is kept.
+      while (NextToken(scout)) ++count;
+    }
+    return count;
+  }
 
   // Test if there are ANY tokens remaining.
-  bool Any() const { return token_id < tokens.size(); }
+  bool Any() const { return At(token_id) != nullptr; }
 
   // Test if there are NO tokens remaining.
-  bool None() const { return token_id >= tokens.size();; }
+  bool None() const { return !Any(); }
 
   // Test if a specific token is next.
   bool Is(int id) const { return Any() && Peek() == id; }
 
   // Get the next token, but don't remove it from the queue.
   const emplex::Token & Peek() const {
-    if (None()) return eof_token;
-    return tokens[token_id];
+    const emplex::Token * token = At(token_id);
+    return token ? *token : eof_token;
   }
 
+  // Look ahead past the next token (index 0 is the same as Peek).
   const emplex::Token & PeekByIndex(int index) const {
-    return tokens[token_id+index];
+    assert(index >= 0 && (!streaming || static_cast<size_t>(index) < MAX_LOOKAHEAD));
+    const emplex::Token * token = At(token_id + static_cast<size_t>(index));
+    return token ? *token : eof_token;
   }
+
   // Get the next token, removing it from the queue.
   const emplex::Token & Use() {
-    if (None()) return eof_token;
-    return tokens[token_id++];
+    const emplex::Token * token = At(token_id);
+    if (!token) return eof_token;
+    token_id++;
+    return *token;
   }
 
   // Get and remove the next token, give provided error if is not expected id.
@@ -106,14 +230,18 @@ public:
   // Base case for UseIf
   int UseIf() { return 0; }
 
+  // Position of the next token (e.g., to Slice from later).
+  size_t Position() const { return token_id; }
+
+  // Step back one token (when streaming, only one step is guaranteed).
   void Rewind() {
     assert(token_id > 0);
     token_id--;
   }
 
   // Get the current lexeme.
-  std::string CurLexeme() const {
-    if (Any()) return Peek().lexeme;
+  std::string_view CurLexeme() const {
+    if (Any()) return Lexeme(Peek());
     return "";
   }
 
@@ -123,4 +251,4 @@ public:
     return 0;
   }
 };
-const emplex::Token TokenQueue::eof_token{0, "_EOF_", 0}; // @Ivan: had to move it here because otherwise compiler wouldn't compile
\ No newline at end of file
+const emplex::Token TokenQueue::eof_token{0, 0, 0, 0, 0}; // @Ivan: had to move it here because otherwise compiler wouldn't compile
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+// Type-checking pass over a parsed program.
+//
+// Every expression is visited bottom-up, so each node's DataType is computed
+// exactly once from its children's (already cached) types and stored on the
+// node; code generation afterwards only reads the cached values.  Type errors
+// are collected and reported together instead of stopping at the first one.
+//
+// Example usage:
+//   TypeChecker checker;
+//   checker.Check(functions);
+//   checker.ReportErrors();   // Throws a CompileError listing every error, if there were any.
+
+#include <string>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "Function.hpp"
+
+class TypeChecker {
+private:
+    std::vector<std::string> errors{};
+    size_t numNodes = 0;
+
+    // Type node and everything below it; returns false if there was an error.
+    bool Check(ASTNode* node) {
+        numNodes++;
+        bool ok = true;
+        ForEachChild(node, [&](ASTNode* child) { ok = Check(child) && ok; });
+        if (!ok) return false; // don't pile further errors onto one already reported
+        if (!IsExpressionKind(node->Kind())) return true;
+
+        try {
+            node->CheckType();
+        } catch (const TypeError& error) {
+            errors.push_back(error.message);
+            return false;
+        }
+        return true;
+    }
+
+public:
+    // Check every function; returns the number of type errors found.
+    size_t Check(const std::vector<Function*>& functions) {
+        for (Function* function : functions) {
+            for (ASTNode* node : function->GetNodes()) Check(node);
+        }
+        return errors.size();
+    }
+
+    // Number of AST nodes visited by Check.
+    size_t NumNodes() const {
+        return numNodes;
+    }
+
+    const std::vector<std::string>& Errors() const {
+        return errors;
+    }
+
+    // Throw a CompileError with all errors found (one per line, in the same form as Error), if there were any.
+    void ReportErrors() const {
+        if (errors.empty()) return;
+        std::string report;
+        for (const std::string& message : errors) {
+            if (!report.empty()) report += '\n';
+            report += "ERROR: " + message;
+        }
+        throw CompileError(report);
+    }
+};
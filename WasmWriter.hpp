@@ -0,0 +1,906 @@
+#pragma once
+
+// Writes the code we generate as WebAssembly text, or directly as a binary module.
+//
+// Code generators (each node's GenerateCode, and the runtime functions) make one
+// call per instruction, in stack-machine order.  Given an Emitter, the calls
+// write WAT, laid out as each function asks (see WasmLayout); given a
+// WasmModule, each appends the instruction's encoding to the function being
+// built instead, resolving names ($var3, $alloc, $fun_exit1) to indices as it
+// goes.  Sections are laid out the way wat2wasm lays them out, so the binary is
+// byte-for-byte what it makes of the text.
+//
+// Example usage:
+//   WasmModule module;
+//   WasmWriter out(module);                 // Or WasmWriter out(emitter) for text
+//   out.Func("one").Result(WasmType::I32);
+//   out.I32Const(1).EndFunc().Export("one", "one");
+//   module.Write(emitter);                  // The binary module
+
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "Emitter.hpp"
+#include "tools.hpp"
+
+enum class WasmType : uint8_t { NONE = 0x40, I32 = 0x7F, I64 = 0x7E, F32 = 0x7D, F64 = 0x7C, V128 = 0x7B };
+
+// Instructions without immediates (other than a load or store's offset).
+enum class WasmOp : uint8_t {
+  UNREACHABLE, RETURN, DROP,
+  I32_LOAD, I32_LOAD8_U, I32_STORE, I32_STORE8, V128_LOAD, V128_STORE,
+  MEMORY_SIZE, MEMORY_GROW, MEMORY_COPY, MEMORY_FILL,
+  I32_EQZ, I32_EQ, I32_NE, I32_LT_S, I32_LT_U, I32_GT_S, I32_GT_U, I32_LE_S, I32_LE_U, I32_GE_S, I32_GE_U,
+  F64_EQ, F64_NE, F64_LT, F64_GT, F64_LE, F64_GE,
+  I32_CLZ, I32_CTZ, I32_ADD, I32_SUB, I32_MUL, I32_DIV_S, I32_DIV_U, I32_REM_S, I32_AND, I32_OR, I32_SHL, I32_SHR_U,
+  F64_SQRT, F64_ADD, F64_SUB, F64_MUL, F64_DIV,
+  I32_TRUNC_F64_S, F64_CONVERT_I32_S,
+  I8X16_SPLAT, I8X16_EQ, I8X16_BITMASK,
+  NUM_OPS
+};
+
+// A name in the module, without its $: {"var", 3} is $var3.  The text it refers
+// to (e.g., a function name in the source) must outlive the module.
+struct WasmName {
+  std::string_view base;
+  int number = -1;  // Appended to base, unless negative.
+
+  WasmName(const char * base) : base(base) { }
+  WasmName(std::string_view base, int number = -1) : base(base), number(number) { }
+  bool operator==(const WasmName &) const = default;
+
+  std::string ToString() const {
+    std::string text("$");
+    text.append(base);
+    if (number >= 0) text.append(std::to_string(number));
+    return text;
+  }
+
+  struct Hash {
+    size_t operator()(const WasmName & name) const {
+      return std::hash<std::string_view>{}(name.base) * 31 + static_cast<size_t>(name.number);
+    }
+  };
+};
+
+inline Emitter & operator<<(Emitter & out, const WasmName & name) {
+  out << '$' << name.base;
+  if (name.number >= 0) out << name.number;
+  return out;
+}
+
+// The immediates an instruction in WASM_OPS takes.
+enum class WasmImm : uint8_t { NONE, MEMARG, ZEROS };
+
+struct WasmOpInfo {
+  std::string_view name;
+  uint8_t prefix;  // 0 for single-byte opcodes, else 0xFC / 0xFD.
+  uint32_t code;
+  uint8_t pops;    // Values it takes from the stack...
+  bool pushes;     // ...and whether it leaves one (for folding text; see WasmLayout).
+  WasmImm imm = WasmImm::NONE;
+  uint8_t arg = 0; // Natural alignment (log2) for MEMARG, byte count for ZEROS.
+};
+
+// Indexed by WasmOp.
+inline constexpr WasmOpInfo WASM_OPS[] = {
+  {"unreachable", 0, 0x00, 0, false}, {"return", 0, 0x0F, 0, false}, {"drop", 0, 0x1A, 1, false},
+  {"i32.load", 0, 0x28, 1, true, WasmImm::MEMARG, 2}, {"i32.load8_u", 0, 0x2D, 1, true, WasmImm::MEMARG, 0},
+  {"i32.store", 0, 0x36, 2, false, WasmImm::MEMARG, 2}, {"i32.store8", 0, 0x3A, 2, false, WasmImm::MEMARG, 0},
+  {"v128.load", 0xFD, 0, 1, true, WasmImm::MEMARG, 4}, {"v128.store", 0xFD, 11, 2, false, WasmImm::MEMARG, 4},
+  {"memory.size", 0, 0x3F, 0, true, WasmImm::ZEROS, 1}, {"memory.grow", 0, 0x40, 1, true, WasmImm::ZEROS, 1},
+  {"memory.copy", 0xFC, 10, 3, false, WasmImm::ZEROS, 2}, {"memory.fill", 0xFC, 11, 3, false, WasmImm::ZEROS, 1},
+  {"i32.eqz", 0, 0x45, 1, true}, {"i32.eq", 0, 0x46, 2, true}, {"i32.ne", 0, 0x47, 2, true},
+  {"i32.lt_s", 0, 0x48, 2, true}, {"i32.lt_u", 0, 0x49, 2, true}, {"i32.gt_s", 0, 0x4A, 2, true},
+  {"i32.gt_u", 0, 0x4B, 2, true}, {"i32.le_s", 0, 0x4C, 2, true}, {"i32.le_u", 0, 0x4D, 2, true},
+  {"i32.ge_s", 0, 0x4E, 2, true}, {"i32.ge_u", 0, 0x4F, 2, true},
+  {"f64.eq", 0, 0x61, 2, true}, {"f64.ne", 0, 0x62, 2, true}, {"f64.lt", 0, 0x63, 2, true},
+  {"f64.gt", 0, 0x64, 2, true}, {"f64.le", 0, 0x65, 2, true}, {"f64.ge", 0, 0x66, 2, true},
+  {"i32.clz", 0, 0x67, 1, true}, {"i32.ctz", 0, 0x68, 1, true}, {"i32.add", 0, 0x6A, 2, true},
+  {"i32.sub", 0, 0x6B, 2, true}, {"i32.mul", 0, 0x6C, 2, true}, {"i32.div_s", 0, 0x6D, 2, true},
+  {"i32.div_u", 0, 0x6E, 2, true}, {"i32.rem_s", 0, 0x6F, 2, true}, {"i32.and", 0, 0x71, 2, true},
+  {"i32.or", 0, 0x72, 2, true}, {"i32.shl", 0, 0x74, 2, true}, {"i32.shr_u", 0, 0x76, 2, true},
+  {"f64.sqrt", 0, 0x9F, 1, true}, {"f64.add", 0, 0xA0, 2, true}, {"f64.sub", 0, 0xA1, 2, true},
+  {"f64.mul", 0, 0xA2, 2, true}, {"f64.div", 0, 0xA3, 2, true},
+  {"i32.trunc_f64_s", 0, 0xAA, 1, true}, {"f64.convert_i32_s", 0, 0xB7, 1, true},
+  {"i8x16.splat", 0xFD, 15, 1, true}, {"i8x16.eq", 0xFD, 35, 2, true}, {"i8x16.bitmask", 0xFD, 100, 1, true},
+};
+static_assert(std::size(WASM_OPS) == static_cast<size_t>(WasmOp::NUM_OPS));
+
+// How a function's text is laid out (a binary module is the same either way).
+enum class WasmLayout : uint8_t {
+  FLAT,      // An instruction per line, unindented (the code generated for a program).
+  INDENTED,  // An instruction per line, indented by nesting.
+  FOLDED,    // Folded expressions, e.g., (i32.add (local.get $a) (i32.const 1)); a statement per line.
+  ONE_LINE,  // Folded, with the whole function on the line that starts it.
+};
+
+// Where the text of an if's then (or else) goes, in a FOLDED function.
+enum class WasmBranch : uint8_t {
+  LINES,     // (then, its code and ) on lines of their own.
+  OWN_LINE,  // (then ...) on one line of its own.
+  INLINE,    // (then ...) at the end of the if's line; its else must be INLINE too.
+};
+
+// A binary module being built (see WasmWriter), written out once it is complete.
+class WasmModule {
+private:
+  friend class WasmWriter;
+  using NameMap = std::unordered_map<WasmName, uint32_t, WasmName::Hash>;
+
+  const WasmModule * parent = nullptr;   // Set for a fragment; see Fragment().
+  std::vector<std::string> signatures{}; // Each function's type, encoded...
+  std::vector<std::string> bodies{};     // ...and its entry in the code section.
+  NameMap func_ids{}, global_ids{};
+  uint32_t num_declared = 0;             // Functions defined or declared so far.
+  uint32_t num_memories = 0, num_globals = 0, num_exports = 0, num_data = 0;
+  std::string memory_section{}, global_section{}, export_section{}, data_section{};
+
+  explicit WasmModule(const WasmModule * parent) : parent(parent) { }
+
+  static void AppendU32(std::string & out, uint64_t value) {
+    do {
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      if (value) byte |= 0x80;
+      out += static_cast<char>(byte);
+    } while (value);
+  }
+
+  static void AppendS64(std::string & out, int64_t value) {
+    while (true) {
+      const uint8_t byte = value & 0x7F;
+      value >>= 7;  // Arithmetic shift keeps the sign.
+      if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+        out += static_cast<char>(byte);
+        return;
+      }
+      out += static_cast<char>(byte | 0x80);
+    }
+  }
+
+  template <typename T>
+  static void AppendBytes(std::string & out, T value) {
+    auto bits = std::bit_cast<std::conditional_t<sizeof(T) == 8, uint64_t, uint32_t>>(value);
+    for (size_t i = 0; i < sizeof(T); ++i, bits >>= 8) out += static_cast<char>(bits & 0xFF);
+  }
+
+  static void AppendName(std::string & out, std::string_view name) {
+    AppendU32(out, name.size());
+    out += name;
+  }
+
+  static uint32_t ReadU32(std::string_view in, size_t & pos) {
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t>(in[pos++]);
+      value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+  }
+
+  static std::string_view ReadName(std::string_view in, size_t & pos) {
+    const uint32_t size = ReadU32(in, pos);
+    pos += size;
+    return in.substr(pos - size, size);
+  }
+
+  // Decode the text of a WAT string (without its quotes), escapes and all.
+  static void AppendUnescaped(std::string & out, std::string_view text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] != '\\') { out += text[i]; continue; }
+      const char c = text[++i];
+      switch (c) {
+      case 'n': out += '\n'; break;
+      case 't': out += '\t'; break;
+      case 'r': out += '\r'; break;
+      case '"': case '\'': case '\\': out += c; break;
+      case 'u': {  // \u{hex}: encode the code point as UTF-8.
+        const size_t end = text.find('}', i);
+        uint32_t cp = 0;
+        std::from_chars(text.data() + i + 2, text.data() + end, cp, 16);
+        if (cp < 0x80) out += static_cast<char>(cp);
+        else if (cp < 0x800) { out += static_cast<char>(0xC0 | (cp >> 6)); out += static_cast<char>(0x80 | (cp & 0x3F)); }
+        else if (cp < 0x10000) {
+          out += static_cast<char>(0xE0 | (cp >> 12));
+          out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+          out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+          out += static_cast<char>(0xF0 | (cp >> 18));
+          out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+          out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+          out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        i = end;
+        break;
+      }
+      default: {  // Two hex digits
+        uint8_t byte = 0;
+        std::from_chars(text.data() + i, text.data() + i + 2, byte, 16);
+        out += static_cast<char>(byte);
+        ++i;
+      }
+      }
+    }
+  }
+
+  static void WriteSection(Emitter & out, uint8_t id, size_t count, std::string_view body) {
+    std::string header;
+    header += static_cast<char>(id);
+    std::string count_bytes;
+    AppendU32(count_bytes, count);
+    AppendU32(header, count_bytes.size() + body.size());
+    out << header << count_bytes << body;
+  }
+
+  static uint32_t Lookup(const NameMap & ids, WasmName name) {
+    auto it = ids.find(name);
+    if (it == ids.end()) Error("WASM encoding: unknown name '", name.ToString(), "'.");
+    return it->second;
+  }
+
+  uint32_t FuncIndex(WasmName name) const { return parent ? parent->FuncIndex(name) : Lookup(func_ids, name); }
+  uint32_t GlobalIndex(WasmName name) const { return parent ? parent->GlobalIndex(name) : Lookup(global_ids, name); }
+
+  void Declare(WasmName name) {
+    assert(!parent);
+    assert(!func_ids.contains(name));  // The parser reports a function defined twice.
+    func_ids.emplace(name, num_declared++);
+  }
+
+  void AddFunction(WasmName name, std::string signature, std::string body) {
+    if (!parent) {
+      if (!func_ids.contains(name)) Declare(name);
+      assert(func_ids[name] == signatures.size());  // Defined in the order declared.
+    }
+    signatures.push_back(std::move(signature));
+    bodies.push_back(std::move(body));
+  }
+
+  void AddExport(std::string_view name, uint8_t kind, uint32_t index) {
+    AppendName(export_section, name);
+    export_section += static_cast<char>(kind);
+    AppendU32(export_section, index);
+    ++num_exports;
+  }
+
+  void AddMemory(std::string_view export_name, uint32_t initial, uint32_t max) {
+    memory_section += static_cast<char>(0x01);
+    AppendU32(memory_section, initial);
+    AppendU32(memory_section, max);
+    AddExport(export_name, 2, num_memories++);
+  }
+
+  void AddGlobal(WasmName name, WasmType type, int32_t value, bool is_mutable) {
+    global_section += static_cast<char>(type);
+    global_section += static_cast<char>(is_mutable ? 0x01 : 0x00);
+    global_section += static_cast<char>(0x41);
+    AppendS64(global_section, value);
+    global_section += static_cast<char>(0x0B);
+    global_ids.emplace(name, num_globals++);
+  }
+
+  void AddData(int32_t offset, std::initializer_list<std::string_view> pieces) {
+    std::string bytes;
+    for (std::string_view piece : pieces) AppendUnescaped(bytes, piece);
+    data_section += static_cast<char>(0x00);
+    data_section += static_cast<char>(0x41);
+    AppendS64(data_section, offset);
+    data_section += static_cast<char>(0x0B);
+    AppendName(data_section, bytes);
+    ++num_data;
+  }
+
+public:
+  WasmModule() = default;
+
+  // An empty module for functions generated separately (e.g., on another
+  // thread), whose names are resolved through this one; see TakeFragment.
+  WasmModule Fragment() const { return WasmModule(this); }
+
+  // The functions and exports in this fragment, to add to its module with
+  // AddFragment (possibly much later, e.g., from a cache).
+  std::string TakeFragment() {
+    std::string fragment;
+    AppendU32(fragment, signatures.size());
+    for (size_t i = 0; i < signatures.size(); ++i) {
+      AppendName(fragment, signatures[i]);
+      AppendName(fragment, bodies[i]);
+    }
+    AppendU32(fragment, num_exports);
+    fragment += export_section;
+    return fragment;
+  }
+
+  void AddFragment(std::string_view fragment) {
+    size_t pos = 0;
+    for (uint32_t count = ReadU32(fragment, pos); count > 0; --count) {
+      signatures.emplace_back(ReadName(fragment, pos));
+      bodies.emplace_back(ReadName(fragment, pos));
+    }
+    num_exports += ReadU32(fragment, pos);
+    export_section += fragment.substr(pos);
+  }
+
+  // Write out the whole module, a section at a time.
+  void Write(Emitter & out) const {
+    out << std::string_view("\0asm\x01\0\0\0", 8);
+
+    // Each distinct type once, in the order functions first use them.
+    std::vector<std::string_view> types;
+    std::string section;
+    for (const std::string & signature : signatures) {
+      size_t index = 0;
+      while (index < types.size() && types[index] != signature) ++index;
+      if (index == types.size()) types.push_back(signature);
+      AppendU32(section, index);
+    }
+    std::string type_section;
+    for (std::string_view type : types) type_section += type;
+    if (types.size()) WriteSection(out, 1, types.size(), type_section);
+    if (signatures.size()) WriteSection(out, 3, signatures.size(), section);
+
+    if (num_memories) WriteSection(out, 5, num_memories, memory_section);
+    if (num_globals) WriteSection(out, 6, num_globals, global_section);
+    if (num_exports) WriteSection(out, 7, num_exports, export_section);
+
+    section.clear();
+    for (const std::string & body : bodies) AppendName(section, body);
+    if (bodies.size()) WriteSection(out, 10, bodies.size(), section);
+
+    if (num_data) WriteSection(out, 11, num_data, data_section);
+  }
+};
+
+class WasmWriter {
+private:
+  Emitter * text = nullptr;       // Where the WAT goes, in text mode...
+  WasmModule * module = nullptr;  // ...or the module being built.
+
+  struct Label {
+    WasmName name;
+    bool is_if;
+    int depth;                    // Text mode: the nesting of the line it starts on...
+    WasmBranch branch;            // ...for an if, where its then (or else) went...
+    bool one_line;                // ...and whether it is all on one line.
+  };
+  std::vector<Label> labels{};    // Blocks around the next instruction, innermost last.
+  WasmName func_name{""};
+
+  // Text mode.
+  WasmLayout layout = WasmLayout::FLAT;  // The current function's.
+  int depth = 0;                  // Nesting of the next line (1 in a function's body).
+  int same_line = 0;              // While positive, the function's text stays on the current line.
+  bool line_open = false;         // Is there a line to end before the next module field?
+  int wrap = -1;                  // FOLDED: a column to start the next operand at, on a new line.
+  std::string folded{};           // FOLDED: expressions built, but not yet used or written...
+  std::vector<size_t> operands{}; // ...each from here (with the space or line break before it).
+  uint32_t num_params = 0;
+  bool has_result = false;
+  struct Arity {
+    uint32_t params;
+    bool result;
+  };
+  std::unordered_map<WasmName, Arity, WasmName::Hash> arities{};  // Of FOLDED functions, to fold calls.
+
+  // Binary mode: the function being built.
+  std::string params{}, results{}, locals{};  // Their types.
+  WasmModule::NameMap local_ids{};
+  std::string code{};
+
+  static std::string_view TypeName(WasmType type) {
+    switch (type) {
+    case WasmType::I32: return "i32";
+    case WasmType::I64: return "i64";
+    case WasmType::F32: return "f32";
+    case WasmType::F64: return "f64";
+    case WasmType::V128: return "v128";
+    default: return "";
+    }
+  }
+
+  template <typename T>
+  static void Put(std::string & out, const T & piece) {
+    if constexpr (std::is_same_v<T, WasmName>) {
+      out += '$';
+      out += piece.base;
+      if (piece.number >= 0) Put(out, piece.number);
+    } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, char>) {
+      char digits[Emitter::MAX_NUMBER_CHARS];
+      out.append(digits, std::to_chars(digits, digits + sizeof(digits), piece).ptr);
+    } else {
+      out += piece;
+    }
+  }
+
+  // Text mode: end the line in progress (if any), for a module field.
+  Emitter & Line() {
+    if (line_open) {
+      *text << '\n';
+      line_open = false;
+    }
+    return *text;
+  }
+
+  // Text mode: start the next part of a function, on a line of its own (or after a space).
+  Emitter & Item() {
+    if (same_line) return *text << ' ';
+    *text << '\n';
+    if (layout != WasmLayout::FLAT) {
+      for (int i = 0; i < depth; ++i) *text << "  ";
+    }
+    return *text;
+  }
+
+  // Text mode: the ) that ends a function, block or branch.
+  void Close() {
+    if (same_line) *text << ')';
+    else Item() << ')';
+  }
+
+  // FOLDED: write out the values computed but not yet used, one per line.
+  void Flush() {
+    for (size_t i = 0; i < operands.size(); ++i) {
+      const size_t start = folded.find('(', operands[i]);
+      const size_t end = i + 1 < operands.size() ? operands[i + 1] : folded.size();
+      Item() << std::string_view(folded).substr(start, end - start);
+    }
+    operands.clear();
+    folded.clear();
+  }
+
+  // FOLDED: the instruction head...) takes pops values and may leave one.  Its operands
+  // are the last pops expressions built, and it becomes one in turn -- or, if it
+  // leaves no value, a statement on a line of its own.
+  void Fold(uint32_t pops, bool pushes, std::string_view head) {
+    assert(operands.size() >= pops);
+    size_t start = folded.size();
+    if (pops) {
+      start = operands[operands.size() - pops];
+      operands.resize(operands.size() - pops);
+      const size_t end = folded.size();
+      folded += head;
+      folded += ' ';
+      // Move the head in front of the first operand (after its space or line break).
+      std::rotate(folded.begin() + folded.find('(', start), folded.begin() + end, folded.end());
+    } else {
+      if (wrap < 0) folded += ' ';
+      else {
+        folded += '\n';
+        folded.append(wrap, ' ');
+        wrap = -1;
+      }
+      folded += head;
+    }
+    folded += ')';
+    if (pushes) {
+      operands.push_back(start);
+      return;
+    }
+    assert(operands.empty());  // A statement uses every value before it.
+    Item() << std::string_view(folded).substr(folded.find('(', start));
+    folded.clear();
+  }
+
+  // Text mode: an instruction that isn't simply on a line of its own (see Instr).
+  template <typename... PIECES>
+  void Place(uint32_t pops, bool pushes, const PIECES &... pieces) {
+    std::string head("(");
+    (Put(head, pieces), ...);
+    if (layout < WasmLayout::FOLDED) Item() << head << ')';
+    else Fold(pops, pushes, head);
+  }
+
+  // Text mode: an instruction, (pieces...), that takes pops values and may leave one.
+  // Code generated for a program is FLAT, a line per instruction; it is kept to a
+  // few writes, as most of the text is made here.
+  template <typename... PIECES>
+  void Instr(uint32_t pops, bool pushes, const PIECES &... pieces) {
+    if (layout == WasmLayout::FLAT && !same_line) ((*text << '\n' << '(') << ... << pieces) << ')';
+    else Place(pops, pushes, pieces...);
+  }
+
+  // Binary mode: an instruction in WASM_OPS.
+  void Encode(const WasmOpInfo & info, uint32_t offset) {
+    if (info.prefix) {
+      code += static_cast<char>(info.prefix);
+      WasmModule::AppendU32(code, info.code);
+    } else {
+      code += static_cast<char>(info.code);
+    }
+    if (info.imm == WasmImm::MEMARG) {
+      WasmModule::AppendU32(code, info.arg);
+      WasmModule::AppendU32(code, offset);
+    } else if (info.imm == WasmImm::ZEROS) {
+      code.append(info.arg, '\0');
+    }
+  }
+
+  // An instruction naming a local, global, function or label.
+  // (In text mode, op is its text up to the name's $, e.g., "(call $", as in Instr.)
+  WasmWriter & Ref(std::string_view op, uint32_t pops, bool pushes, uint8_t opcode, WasmName name, uint32_t index) {
+    if (text) {
+      if (layout == WasmLayout::FLAT && !same_line) {
+        *text << '\n' << op << name.base;
+        if (name.number >= 0) *text << name.number;
+        *text << ')';
+      }
+      else Place(pops, pushes, op.substr(1, op.size() - 2), name);
+    } else {
+      code += static_cast<char>(opcode);
+      WasmModule::AppendU32(code, index);
+    }
+    return *this;
+  }
+
+  uint32_t LocalIndex(WasmName name) const { return text ? 0 : WasmModule::Lookup(local_ids, name); }
+  uint32_t GlobalIndex(WasmName name) const { return text ? 0 : module->GlobalIndex(name); }
+
+  uint32_t LabelDepth(WasmName name) const {
+    if (text) return 0;
+    for (size_t i = labels.size(); i-- > 0;) {
+      if (labels[i].name == name) return static_cast<uint32_t>(labels.size() - 1 - i);
+    }
+    Error("WASM encoding: unknown label '", name.ToString(), "'.");
+  }
+
+  // Start a block, loop or if (its text is written by the caller).
+  WasmWriter & Enter(uint8_t opcode, WasmName label, WasmType result, bool is_if) {
+    labels.push_back(Label{label, is_if, depth, WasmBranch::LINES, false});
+    if (text) ++depth;
+    else {
+      code += static_cast<char>(opcode);
+      code += static_cast<char>(result);
+    }
+    return *this;
+  }
+
+  // Text mode: start the innermost if's then or else.
+  void Branch(std::string_view name, WasmBranch branch) {
+    Label & label = labels.back();
+    label.branch = branch;
+    if (branch == WasmBranch::INLINE && !label.one_line) {
+      label.one_line = true;
+      ++same_line;
+    }
+    Item() << '(' << name;
+    if (branch == WasmBranch::LINES) ++depth;
+    else if (branch == WasmBranch::OWN_LINE) ++same_line;
+  }
+
+  // Text mode: end the innermost if's then or else.
+  void EndBranch() {
+    Flush();
+    const WasmBranch branch = labels.back().branch;
+    if (branch == WasmBranch::LINES) {
+      --depth;
+      Close();
+      return;
+    }
+    *text << ')';
+    if (branch == WasmBranch::OWN_LINE) --same_line;
+  }
+
+public:
+  explicit WasmWriter(Emitter & out) : text(&out) { }
+  explicit WasmWriter(WasmModule & module) : module(&module) { }
+  WasmWriter(const WasmWriter &) = delete;
+  WasmWriter & operator=(const WasmWriter &) = delete;
+
+  bool IsBinary() const { return module != nullptr; }
+  WasmModule & Module() { return *module; }
+
+  // ---------- Module fields ----------
+
+  WasmWriter & BeginModule() {
+    if (text) Line() << "(module\n";
+    return *this;
+  }
+
+  WasmWriter & EndModule() {
+    if (text) Line() << ")\n";
+    return *this;
+  }
+
+  // The module's memory, exported as export_name.
+  WasmWriter & Memory(std::string_view export_name, uint32_t initial, uint32_t max) {
+    if (text) Line() << "(memory (export \"" << export_name << "\") " << initial << " " << max << ")\n";
+    else module->AddMemory(export_name, initial, max);
+    return *this;
+  }
+
+  WasmWriter & Global(WasmName name, WasmType type, int32_t value, bool is_mutable = false) {
+    if (text) {
+      Line() << "(global " << name << ' ';
+      if (is_mutable) *text << "(mut " << TypeName(type) << ')';
+      else *text << TypeName(type);
+      *text << " (i32.const " << value << "))\n";
+    } else {
+      module->AddGlobal(name, type, value, is_mutable);
+    }
+    return *this;
+  }
+
+  WasmWriter & MutableGlobal(WasmName name, WasmType type, int32_t value) { return Global(name, type, value, true); }
+
+  // Bytes placed in memory at offset, given as the pieces of a WAT string (with its escapes).
+  template <typename... PIECES>
+  WasmWriter & Data(int32_t offset, const PIECES &... pieces) {
+    if (text) {
+      Emitter & out = Line();
+      out << "(data (i32.const " << offset << ") \"";
+      (out << ... << pieces) << "\")\n";
+    } else {
+      module->AddData(offset, {std::string_view(pieces)...});
+    }
+    return *this;
+  }
+
+  WasmWriter & Export(std::string_view name, WasmName func) {
+    if (text) Line() << "(export \"" << name << "\" (func " << func << "))\n";
+    else module->AddExport(name, 0, module->FuncIndex(func));
+    return *this;
+  }
+
+  // Name a function that is defined later, so calls before then can refer to it.
+  WasmWriter & Declare(WasmName func) {
+    if (module) module->Declare(func);
+    return *this;
+  }
+
+  // Add code generated separately: text, or a WasmModule::TakeFragment.
+  WasmWriter & Append(std::string_view fragment) {
+    if (text) Line() << fragment;
+    else module->AddFragment(fragment);
+    return *this;
+  }
+
+  // ---------- Functions ----------
+
+  // Start a function; its params, result and locals come next, then its body.
+  WasmWriter & Func(WasmName name, WasmLayout layout = WasmLayout::FLAT) {
+    labels.clear();
+    func_name = name;
+    if (text) {
+      Line() << "(func " << name;
+      line_open = true;
+      this->layout = layout;
+      depth = 1;
+      same_line = (layout == WasmLayout::ONE_LINE);
+      num_params = 0;
+      has_result = false;
+      return *this;
+    }
+    params.clear();
+    results.clear();
+    locals.clear();
+    local_ids.clear();
+    code.clear();
+    return *this;
+  }
+
+  WasmWriter & Param(WasmName name, WasmType type) {
+    if (text) {
+      *text << " (param " << name << ' ' << TypeName(type) << ')';
+      ++num_params;
+    } else {
+      local_ids.emplace(name, static_cast<uint32_t>(params.size()));
+      params += static_cast<char>(type);
+    }
+    return *this;
+  }
+
+  WasmWriter & Result(WasmType type) {
+    if (text) {
+      *text << " (result " << TypeName(type) << ')';
+      has_result = true;
+    } else {
+      results += static_cast<char>(type);
+    }
+    return *this;
+  }
+
+  WasmWriter & Local(WasmName name, WasmType type) {
+    if (text) Item() << "(local " << name << ' ' << TypeName(type) << ')';
+    else {
+      local_ids.emplace(name, static_cast<uint32_t>(params.size() + locals.size()));
+      locals += static_cast<char>(type);
+    }
+    return *this;
+  }
+
+  WasmWriter & EndFunc() {
+    assert(labels.empty());
+    if (text) {
+      Flush();
+      depth = 0;
+      Close();
+      same_line = 0;
+      line_open = true;
+      if (layout >= WasmLayout::FOLDED) arities[func_name] = Arity{num_params, has_result};
+      return *this;
+    }
+    std::string signature;
+    signature += static_cast<char>(0x60);
+    WasmModule::AppendName(signature, params);
+    WasmModule::AppendName(signature, results);
+
+    // Locals are declared as runs of the same type.
+    std::string body;
+    size_t num_runs = 0;
+    for (size_t i = 0; i < locals.size(); ++i) num_runs += (i == 0 || locals[i] != locals[i-1]);
+    WasmModule::AppendU32(body, num_runs);
+    for (size_t i = 0, run; i < locals.size(); i += run) {
+      for (run = 1; i + run < locals.size() && locals[i + run] == locals[i]; ++run) { }
+      WasmModule::AppendU32(body, run);
+      body += locals[i];
+    }
+    body += code;
+    body += static_cast<char>(0x0B);
+    module->AddFunction(func_name, std::move(signature), std::move(body));
+    return *this;
+  }
+
+  // ---------- Text only ----------
+
+  // A comment on a line of its own.
+  WasmWriter & Comment(std::string_view comment) {
+    if (text) {
+      Flush();
+      Item() << ";; " << comment;
+    }
+    return *this;
+  }
+
+  // Text added to the end of the line just written, e.g. "  ;; why", in FLAT or INDENTED code.
+  WasmWriter & Note(std::string_view note) {
+    assert(layout < WasmLayout::FOLDED);
+    if (text) *text << note;
+    return *this;
+  }
+
+  // FOLDED: start the next operand on a new line, indented to column.
+  WasmWriter & Wrap(int column) {
+    if (text && layout >= WasmLayout::FOLDED) wrap = column;
+    return *this;
+  }
+
+  // ---------- Instructions ----------
+
+  // An instruction without immediates (a load or store with its natural alignment and no offset).
+  WasmWriter & Op(WasmOp op) {
+    const WasmOpInfo & info = WASM_OPS[static_cast<size_t>(op)];
+    if (text) Instr(info.pops, info.pushes, info.name);
+    else Encode(info, 0);
+    return *this;
+  }
+
+  // A load or store, with an offset added to its address.
+  WasmWriter & Op(WasmOp op, uint32_t offset) {
+    const WasmOpInfo & info = WASM_OPS[static_cast<size_t>(op)];
+    assert(info.imm == WasmImm::MEMARG);
+    if (text) Instr(info.pops, info.pushes, info.name, " offset=", offset);
+    else Encode(info, offset);
+    return *this;
+  }
+
+  WasmWriter & I32Const(int32_t value) {
+    if (text) Instr(0, true, "i32.const ", value);
+    else {
+      code += static_cast<char>(0x41);
+      WasmModule::AppendS64(code, value);
+    }
+    return *this;
+  }
+
+  // A double written to 6 significant digits (like an ostream), or in full if exact.
+  WasmWriter & F64Const(double value, bool exact = false) {
+    char digits[Emitter::MAX_NUMBER_CHARS];
+    const char * end = exact ? std::to_chars(digits, digits + sizeof(digits), value).ptr
+                             : std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6).ptr;
+    if (text) {
+      Instr(0, true, "f64.const ", std::string_view(digits, end - digits));
+      return *this;
+    }
+    std::from_chars(digits, end, value);  // The value the text stands for.
+    code += static_cast<char>(0x44);
+    WasmModule::AppendBytes(code, value);
+    return *this;
+  }
+
+  WasmWriter & LocalGet(WasmName name) { return Ref("(local.get $", 0, true, 0x20, name, LocalIndex(name)); }
+  WasmWriter & LocalSet(WasmName name) { return Ref("(local.set $", 1, false, 0x21, name, LocalIndex(name)); }
+  WasmWriter & LocalTee(WasmName name) { return Ref("(local.tee $", 1, true, 0x22, name, LocalIndex(name)); }
+  WasmWriter & GlobalGet(WasmName name) { return Ref("(global.get $", 0, true, 0x23, name, GlobalIndex(name)); }
+  WasmWriter & GlobalSet(WasmName name) { return Ref("(global.set $", 1, false, 0x24, name, GlobalIndex(name)); }
+  WasmWriter & Br(WasmName label) { return Ref("(br $", 0, false, 0x0C, label, LabelDepth(label)); }
+  WasmWriter & BrIf(WasmName label) { return Ref("(br_if $", 1, false, 0x0D, label, LabelDepth(label)); }
+
+  WasmWriter & Call(WasmName func) {
+    if (!text) return Ref("(call $", 0, false, 0x10, func, module->FuncIndex(func));
+    Arity arity{0, false};  // Only folded code needs it (and only calls functions defined before it).
+    if (layout >= WasmLayout::FOLDED) {
+      assert(arities.contains(func));
+      arity = arities[func];
+    }
+    return Ref("(call $", arity.params, arity.result, 0x10, func, 0);
+  }
+
+  WasmWriter & Block(WasmName label, WasmType result = WasmType::NONE) {
+    if (text) {
+      Flush();
+      Item() << "(block " << label;
+      if (result != WasmType::NONE) *text << " (result " << TypeName(result) << ')';
+    }
+    return Enter(0x02, label, result, false);
+  }
+
+  WasmWriter & Loop(WasmName label) {
+    if (text) {
+      Flush();
+      Item() << "(loop " << label;
+    }
+    return Enter(0x03, label, WasmType::NONE, false);
+  }
+
+  // Start the then branch of an if on the condition just computed (folded into the
+  // if's line, in FOLDED code).
+  WasmWriter & If(WasmType result = WasmType::NONE, WasmBranch branch = WasmBranch::LINES) {
+    if (!text) return Enter(0x04, "", result, true);
+    if (layout < WasmLayout::FOLDED) {
+      Item() << "(if ";
+      if (result != WasmType::NONE) *text << "(result " << TypeName(result) << ')';
+    } else {
+      assert(operands.size() == 1);  // The condition.
+      Item() << "(if";
+      if (result != WasmType::NONE) *text << " (result " << TypeName(result) << ')';
+      *text << folded;
+      operands.clear();
+      folded.clear();
+    }
+    Enter(0x04, "", result, true);
+    Branch("then", branch);
+    return *this;
+  }
+
+  WasmWriter & If(WasmBranch branch) { return If(WasmType::NONE, branch); }
+
+  WasmWriter & Else(WasmBranch branch = WasmBranch::LINES) {
+    assert(!labels.empty() && labels.back().is_if);
+    if (text) {
+      assert(labels.back().one_line == (branch == WasmBranch::INLINE));
+      EndBranch();
+      Branch("else", branch);
+    } else {
+      code += static_cast<char>(0x05);
+    }
+    return *this;
+  }
+
+  // End the innermost block, loop or if.
+  WasmWriter & End() {
+    assert(!labels.empty());
+    const Label label = labels.back();
+    if (text) {
+      if (label.is_if) EndBranch();
+      else Flush();
+      depth = label.depth;
+      Close();
+      if (label.one_line) --same_line;
+    } else {
+      code += static_cast<char>(0x0B);
+    }
+    labels.pop_back();
+    return *this;
+  }
+};
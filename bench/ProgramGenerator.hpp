@@ -0,0 +1,142 @@
+#pragma once
+
+// Synthesizes valid .tube programs of a chosen size and shape, for the
+// benchmarks.  Each shape stresses one thing:
+//   functions    - many short functions, each calling the one before
+//   nesting      - if/while blocks nested `intensity` deep, with a local in each
+//   expressions  - arithmetic chains of `intensity` terms
+//   strings      - `intensity` string literals per function, concatenated
+//   locals       - `intensity` locals per function, all used afterwards
+// The output depends only on the arguments (and seed), so runs can be compared.
+//
+// Example usage:
+//   std::string source = ProgramGenerator::Generate("nesting", 500, 40);
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ProgramGenerator {
+private:
+  std::string out;
+  uint64_t state;
+
+  // Small deterministic pseudo-random numbers (for constants and operators).
+  int Next(int limit) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<int>((state >> 33) % static_cast<uint64_t>(limit));
+  }
+
+  // Append each piece (text or a number) to the program, without building
+  // temporary strings along the way.
+  void Add(std::string_view text) { out.append(text); }
+  void Add(int number) { out.append(std::to_string(number)); }
+  template <typename FIRST, typename SECOND, typename... REST>
+  void Add(const FIRST & first, const SECOND & second, const REST &... rest) {
+    Add(first);
+    Add(second, rest...);
+  }
+
+  void Header(int id, std::string_view params = "int a, double b", std::string_view result = "int") {
+    Add("function F", id, "(", params, ") : ", result, " {\n");
+  }
+
+  void Functions(int id) {
+    Header(id);
+    Add("  int total = a * ", Next(9) + 1, ";\n");
+    Add("  if (total > ", Next(100), ") { total = total - 1; }\n");
+    if (id == 0) Add("  return total;\n");
+    else Add("  return total + F", id - 1, "(a - 1, b * 1.5);\n");
+    Add("}\n");
+  }
+
+  void Nesting(int id, int depth) {
+    Header(id);
+    Add("  int total = 0;\n");
+    std::string indent = "  ";
+    for (int level = 0; level < depth; ++level) {
+      if (level % 2 == 0) Add(indent, "if (a > ", level, ") {\n");
+      else Add(indent, "while (total < ", level * 10, ") {\n");
+      indent.append("  ");
+      Add(indent, "int v", level, " = a + ", Next(50), ";\n");
+      Add(indent, "total = total + v", level, ";\n");
+    }
+    for (int level = depth - 1; level >= 0; --level) {
+      indent.resize(indent.size() - 2);
+      Add(indent, "}\n");
+    }
+    Add("  return total;\n}\n");
+  }
+
+  void Expressions(int id, int terms) {
+    static constexpr std::string_view ops[] = {" + ", " - ", " * ", " + "};
+    Header(id);
+    Add("  int total = a");
+    for (int term = 0; term < terms; ++term) {
+      Add(ops[Next(4)]);
+      if (term % 5 == 4) {
+        const int divisor = Next(7) + 1;
+        const int offset = Next(20) + 1;
+        Add("(a + ", offset, ") / ", divisor);
+      }
+      else Add(Next(100));
+      if (term % 12 == 11) Add("\n     ");
+    }
+    Add(";\n  return total;\n}\n");
+  }
+
+  void Strings(int id, int literals) {
+    Header(id, "int a", "string");
+    Add("  string text = \"start\";\n");
+    for (int literal = 0; literal < literals; ++literal) {
+      Add("  text = text + \"literal ", id, "-", literal);
+      out.append(static_cast<size_t>(Next(24)), 'x');
+      Add("\";\n");
+    }
+    Add("  return text;\n}\n");
+  }
+
+  void Locals(int id, int count) {
+    Header(id);
+    for (int local = 0; local < count; ++local) {
+      Add("  int l", local, " = a + ", Next(1000), ";\n");
+    }
+    Add("  int total = 0;\n");
+    for (int local = 0; local < count; ++local) {
+      Add("  total = total + l", local, ";\n");
+    }
+    Add("  return total;\n}\n");
+  }
+
+  explicit ProgramGenerator(uint64_t seed) : state(seed) { }
+
+public:
+  static const std::vector<std::string_view> & Shapes() {
+    static const std::vector<std::string_view> shapes{"functions", "nesting", "expressions", "strings", "locals"};
+    return shapes;
+  }
+
+  // A sensible `intensity` for each shape (ignored by "functions").
+  static int DefaultIntensity(std::string_view shape) {
+    if (shape == "nesting") return 40;
+    if (shape == "expressions") return 200;
+    if (shape == "strings") return 50;
+    if (shape == "locals") return 200;
+    return 0;
+  }
+
+  // A program of num_functions functions in the given shape; empty if the shape is unknown.
+  static std::string Generate(std::string_view shape, int num_functions, int intensity, uint64_t seed = 1) {
+    ProgramGenerator generator(seed);
+    for (int id = 0; id < num_functions; ++id) {
+      if (shape == "functions") generator.Functions(id);
+      else if (shape == "nesting") generator.Nesting(id, intensity);
+      else if (shape == "expressions") generator.Expressions(id, intensity);
+      else if (shape == "strings") generator.Strings(id, intensity);
+      else if (shape == "locals") generator.Locals(id, intensity);
+      else return "";
+    }
+    return generator.out;
+  }
+};
@@ -0,0 +1,131 @@
+// AST traversal benchmark.
+//
+// Parses a large synthetic program, then times the same passes (counting nodes
+// by kind, and finding the deepest node) over the pointer tree built by the
+// parser and over its FlatAST copy.  Both walks switch on the node kind, so
+// the difference is down to memory layout.  Also times FlatAST serialization.
+//
+// Usage: bench/ast_bench [num_functions] [repeat]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Arena.hpp"
+#include "FlatAST.hpp"
+#include "Parser.hpp"
+#include "TokenQueue.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+// A program with num_functions functions of loops, branches and arithmetic,
+// each calling the one before it.
+static std::string SynthesizeProgram(int num_functions) {
+  std::string out;
+  for (int id = 0; id < num_functions; ++id) {
+    const std::string n = std::to_string(id);
+    out += "function F" + n + "(int a, double b) : int {\n";
+    out += "  int total = 0;\n";
+    out += "  int i = 0;\n";
+    out += "  while (i < a) {\n";
+    out += "    if (i % 3 == 0 && a > 2) {\n";
+    out += "      total = total + i * 2 - (a + 1) / 3 + (i - 7) * (a + " + n + ");\n";
+    out += "    } else {\n";
+    out += "      total = total - 1;\n";
+    out += "    }\n";
+    out += "    i = i + 1;\n";
+    out += "  }\n";
+    out += "  string s = \"value\";\n";
+    out += "  int c = s[0];\n";
+    if (id == 0) out += "  return total;\n";
+    else out += "  return total + F" + std::to_string(id - 1) + "(a - 1, b * 2.5);\n";
+    out += "}\n";
+  }
+  return out;
+}
+
+static void TreeCountKinds(ASTNode* node, std::array<size_t, static_cast<size_t>(NodeKind::NUM_KINDS)>& counts) {
+  counts[static_cast<size_t>(node->Kind())]++;
+  ForEachChild(node, [&counts](ASTNode* child) { TreeCountKinds(child, counts); });
+}
+
+static size_t TreeDepth(ASTNode* node) {
+  size_t below = 0;
+  ForEachChild(node, [&below](ASTNode* child) { below = std::max(below, TreeDepth(child)); });
+  return below + 1;
+}
+
+template <typename FN>
+static double BestTime(int repeat, FN fn) {
+  double best = 1e30;
+  for (int i = 0; i < repeat; ++i) {
+    auto start = clock_type::now();
+    fn();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  const int num_functions = (argc > 1) ? std::atoi(argv[1]) : 20000;
+  const int repeat = (argc > 2) ? std::atoi(argv[2]) : 5;
+
+  const std::string source = SynthesizeProgram(num_functions);
+  TokenQueue tokens;
+  tokens.Load(source);
+  Arena arena;
+  Parser parser(tokens, arena);
+  std::vector<Function*> functions = parser.Parse();
+
+  FlatAST flat;
+  const double flatten_time = BestTime(repeat, [&]() { flat = FlatAST::Flatten(functions); });
+
+  std::array<size_t, static_cast<size_t>(NodeKind::NUM_KINDS)> tree_counts{}, flat_counts{};
+  size_t tree_depth = 0, flat_depth = 0;
+
+  const double tree_count_time = BestTime(repeat, [&]() {
+    tree_counts = {};
+    for (Function* function : functions) {
+      for (ASTNode* node : function->GetNodes()) TreeCountKinds(node, tree_counts);
+    }
+  });
+  const double flat_count_time = BestTime(repeat, [&]() { flat_counts = flat.CountKinds(); });
+
+  const double tree_depth_time = BestTime(repeat, [&]() {
+    tree_depth = 0;
+    for (Function* function : functions) {
+      for (ASTNode* node : function->GetNodes()) tree_depth = std::max(tree_depth, TreeDepth(node));
+    }
+  });
+  const double flat_depth_time = BestTime(repeat, [&]() { flat_depth = flat.MaxDepth(); });
+
+  // The flat copy adds one BLOCK per function to hold its statements.
+  flat_counts[static_cast<size_t>(NodeKind::BLOCK)] -= functions.size();
+  if (tree_counts != flat_counts || tree_depth + 1 != flat_depth) {
+    std::fprintf(stderr, "ast_bench: tree and flat passes disagree!\n");
+    return 1;
+  }
+
+  std::string bytes;
+  const double serialize_time = BestTime(repeat, [&]() { bytes = flat.Serialize(); });
+  FlatAST copy;
+  const double deserialize_time = BestTime(repeat, [&]() { copy = FlatAST::Deserialize(bytes); });
+  if (copy.Hash() != flat.Hash()) {
+    std::fprintf(stderr, "ast_bench: serialized AST does not round-trip!\n");
+    return 1;
+  }
+
+  const double mb = static_cast<double>(bytes.size()) / (1 << 20);
+  std::printf("ast_bench: %d functions, %zu nodes (best of %d)\n", num_functions, flat.Size(), repeat);
+  std::printf("  flatten          : %8.2f ms\n", flatten_time * 1e3);
+  std::printf("  count kinds      : tree %8.2f ms, flat %8.2f ms  (%.1fx)\n",
+              tree_count_time * 1e3, flat_count_time * 1e3, tree_count_time / flat_count_time);
+  std::printf("  max depth        : tree %8.2f ms, flat %8.2f ms  (%.1fx)\n",
+              tree_depth_time * 1e3, flat_depth_time * 1e3, tree_depth_time / flat_depth_time);
+  std::printf("  serialize        : %8.1f MB/s (%.1f MB)\n", mb / serialize_time, mb);
+  std::printf("  deserialize      : %8.1f MB/s\n", mb / deserialize_time);
+}
@@ -0,0 +1,100 @@
+// Parallel code generation benchmark.
+//
+// Parses a synthetic program with thousands of functions once, then times
+// generating their code with increasing numbers of threads, the same way
+// Tubular::ToWASM does it: each function into its own buffer on a ThreadPool,
+// with the buffers joined in source order.  Every run must produce the same
+// bytes as the single-threaded one.
+//
+// Usage: bench/codegen_bench [num_functions] [max_threads] [repeat]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arena.hpp"
+#include "Emitter.hpp"
+#include "Parser.hpp"
+#include "ThreadPool.hpp"
+#include "TokenQueue.hpp"
+#include "TypeChecker.hpp"
+#include "WasmWriter.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+// Functions of varied size (every tenth one much larger), so that work
+// stealing has something to balance.
+static std::string SynthesizeProgram(int num_functions) {
+  std::string out;
+  for (int id = 0; id < num_functions; ++id) {
+    const std::string n = std::to_string(id);
+    out += "function F" + n + "(int a, double b) : double {\n";
+    out += "  int i = 0;\n";
+    const int loops = (id % 10 == 0) ? 40 : 4;
+    for (int loop = 0; loop < loops; ++loop) {
+      out += "  while (i < a) {\n";
+      out += "    if (i % 3 == 0 && a > 2) { b = b * 1.5 + i; } else { b = b - (a + " + n + ") / 3; }\n";
+      out += "    i = i + 1;\n";
+      out += "  }\n";
+    }
+    out += "  return b;\n}\n";
+  }
+  return out;
+}
+
+static std::string Generate(const std::vector<Function*> & functions, size_t num_threads) {
+  std::vector<std::string> bodies(functions.size());
+  ThreadPool pool(num_threads);
+  pool.ParallelFor(functions.size(), [&](size_t i) {
+    Emitter text(bodies[i], 4096);
+    WasmWriter body(text);
+    functions[i]->GenerateCode(body);
+  });
+  std::string wat;
+  Emitter out(wat);
+  for (const std::string & body : bodies) out << body;
+  out.Flush();
+  return wat;
+}
+
+int main(int argc, char* argv[]) {
+  const int num_functions = (argc > 1) ? std::atoi(argv[1]) : 5000;
+  const size_t max_threads = (argc > 2) ? std::atoi(argv[2])
+                                        : std::max(4u, std::thread::hardware_concurrency());
+  const int repeat = (argc > 3) ? std::atoi(argv[3]) : 3;
+
+  const std::string source = SynthesizeProgram(num_functions);
+  TokenQueue tokens;
+  tokens.Load(source);
+  Arena arena;
+  Parser parser(tokens, arena);
+  std::vector<Function*> functions = parser.Parse();
+  TypeChecker checker;
+  checker.Check(functions);
+  checker.ReportErrors();
+
+  const std::string expected = Generate(functions, 1);
+  std::printf("codegen_bench: %d functions, %.1f MB of WAT, %u hardware thread(s) (best of %d)\n",
+              num_functions, expected.size() / double(1 << 20), std::thread::hardware_concurrency(), repeat);
+
+  double base_time = 0.0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double best = 1e30;
+    for (int r = 0; r < repeat; ++r) {
+      auto start = clock_type::now();
+      const std::string wat = Generate(functions, threads);
+      std::chrono::duration<double> elapsed = clock_type::now() - start;
+      best = std::min(best, elapsed.count());
+      if (wat != expected) {
+        std::fprintf(stderr, "codegen_bench: output with %zu threads differs!\n", threads);
+        return 1;
+      }
+    }
+    if (threads == 1) base_time = best;
+    std::printf("  %2zu thread(s)     : %8.2f ms  (%.2fx)\n", threads, best * 1e3, base_time / best);
+  }
+}
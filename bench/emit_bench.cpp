@@ -0,0 +1,99 @@
+// WAT output benchmark.
+//
+// Writes the same stream of small code fragments (instructions, variable ids
+// and constants, as code generation produces them) to /dev/null through an
+// std::ofstream and through an Emitter, then times generating code for a
+// large synthetic program into memory.
+//
+// Usage: bench/emit_bench [num_fragments] [num_functions]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Arena.hpp"
+#include "Emitter.hpp"
+#include "Parser.hpp"
+#include "TokenQueue.hpp"
+#include "WasmWriter.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+template <typename OUT>
+static void WriteFragments(OUT & out, int num_fragments) {
+  for (int i = 0; i < num_fragments; ++i) {
+    out << "(local.get $var" << (i & 1023) << ")\n";
+    out << "(i32.const " << i << ")\n";
+    out << "(i32.add)\n";
+    if ((i & 15) == 0) out << "(f64.const " << (i * 0.25) << ")\n(drop)\n";
+  }
+}
+
+template <typename FN>
+static double Time(FN fn) {
+  auto start = clock_type::now();
+  fn();
+  std::chrono::duration<double> elapsed = clock_type::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+  const int num_fragments = (argc > 1) ? std::atoi(argv[1]) : 2000000;
+  const int num_functions = (argc > 2) ? std::atoi(argv[2]) : 5000;
+
+  std::string expected;
+  {
+    Emitter out(expected);
+    WriteFragments(out, num_fragments);
+  }
+  const double mb = static_cast<double>(expected.size()) / (1 << 20);
+
+  std::ofstream null_stream("/dev/null");
+  const double stream_time = Time([&]() { WriteFragments(null_stream, num_fragments); null_stream.flush(); });
+
+  const int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0) { std::perror("emit_bench: /dev/null"); return 1; }
+  size_t flushes = 0;
+  const double emitter_time = Time([&]() {
+    Emitter out(null_fd);
+    WriteFragments(out, num_fragments);
+    out.Flush();
+    flushes = out.NumFlushes();
+  });
+  close(null_fd);
+
+  // Code generation for a whole program, into memory.
+  std::string source;
+  for (int id = 0; id < num_functions; ++id) {
+    const std::string n = std::to_string(id);
+    source += "function F" + n + "(int a, double b) : double {\n"
+              "  int i = 0;\n"
+              "  while (i < a) { b = b * 1.5 + i; i = i + " + n + "; }\n"
+              "  return b;\n}\n";
+  }
+  TokenQueue tokens;
+  tokens.Load(source);
+  Arena arena;
+  Parser parser(tokens, arena);
+  std::vector<Function*> functions = parser.Parse();
+  std::string wat;
+  const double codegen_time = Time([&]() {
+    Emitter text(wat);
+    WasmWriter out(text);
+    for (Function* function : functions) function->GenerateCode(out);
+  });
+  const double wat_mb = static_cast<double>(wat.size()) / (1 << 20);
+
+  std::printf("emit_bench: %d fragments (%.1f MB)\n", num_fragments, mb);
+  std::printf("  ostream          : %8.1f MB/s\n", mb / stream_time);
+  std::printf("  emitter          : %8.1f MB/s  (%.1fx, %zu writes)\n",
+              mb / emitter_time, stream_time / emitter_time, flushes);
+  std::printf("  codegen          : %8.1f MB/s  (%d functions, %.1f MB of WAT)\n",
+              wat_mb / codegen_time, num_functions, wat_mb);
+}
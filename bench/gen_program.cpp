@@ -0,0 +1,32 @@
+// Write a synthetic .tube program (see ProgramGenerator.hpp) to stdout, e.g.
+// to look at with Project4 --time-report.
+//
+// Usage: bench/gen_program shape [num_functions] [intensity] [seed]
+//   shape is one of: functions, nesting, expressions, strings, locals
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "ProgramGenerator.hpp"
+
+int main(int argc, char * argv[]) {
+  if (argc < 2 || argc > 5) {
+    std::fprintf(stderr, "Usage: %s shape [num_functions] [intensity] [seed]\n  shapes:", argv[0]);
+    for (std::string_view shape : ProgramGenerator::Shapes()) std::fprintf(stderr, " %.*s", int(shape.size()), shape.data());
+    std::fprintf(stderr, "\n");
+    return 1;
+  }
+  const std::string shape = argv[1];
+  const int num_functions = (argc > 2) ? std::atoi(argv[2]) : 1000;
+  const int intensity = (argc > 3) ? std::atoi(argv[3]) : ProgramGenerator::DefaultIntensity(shape);
+  const uint64_t seed = (argc > 4) ? std::strtoull(argv[4], nullptr, 10) : 1;
+
+  const std::string program = ProgramGenerator::Generate(shape, num_functions, intensity, seed);
+  if (program.empty()) {
+    std::fprintf(stderr, "Unknown shape '%s'.\n", shape.c_str());
+    return 1;
+  }
+  std::fwrite(program.data(), 1, program.size(), stdout);
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Lexing throughput benchmark.
+//
+// Compares the original input path (ifstream -> std::string copy -> Tokenize)
+// against lexing a memory-mapped SourceFile in place, and the plain DFA against
+// the wide-scan fast paths for whitespace, comments and string literals.
+//
+// Usage: bench/lex_bench [file.tube] [repeat]
+//   With no file, two large inputs are synthesized: one from the programs in
+//   tests/, and one shaped like generated code (deep indentation, long comment
+//   blocks and long string literals).
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "SourceFile.hpp"
+#include "lexer.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+// Build roughly target_bytes of source by repeating the test programs.
+static std::string SynthesizeTestsSource(size_t target_bytes) {
+  std::string sample;
+  for (int i = 1; i <= 20; ++i) {
+    std::string name = "tests/test-" + std::string(i < 10 ? "0" : "") + std::to_string(i) + ".tube";
+    std::ifstream in(name);
+    sample += std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    sample += "\n";
+  }
+  if (sample.size() < 2) {
+    sample = "function Add(int a, int b) : int {\n  // Add two values.\n  return a + b;\n}\n";
+  }
+
+  std::string out;
+  out.reserve(target_bytes + sample.size());
+  while (out.size() < target_bytes) out += sample;
+  return out;
+}
+
+// Build roughly target_bytes of source that looks like machine-generated code.
+static std::string SynthesizeGeneratedSource(size_t target_bytes) {
+  std::string out;
+  out.reserve(target_bytes + 1024);
+  for (size_t id = 0; out.size() < target_bytes; ++id) {
+    const std::string n = std::to_string(id);
+    out += "// ------------------------------------------------------------------------\n";
+    out += "// Generated function " + n + ".  This comment block describes the table\n";
+    out += "// entries below and is repeated verbatim by the generator for every entry.\n";
+    out += "// ------------------------------------------------------------------------\n";
+    out += "function Entry" + n + "(int key) : string {\n";
+    out += "                if (key == " + n + ") {\n";
+    out += "                                return \"entry " + n + ": the quick brown fox jumps over the lazy dog\";\n";
+    out += "                }\n";
+    out += "                return \"                                                        \";\n";
+    out += "}\n\n";
+  }
+  return out;
+}
+
+// Run fn `repeat` times and return the best time in seconds.
+template <typename FN>
+static double BestTime(int repeat, FN fn) {
+  double best = 1e30;
+  for (int i = 0; i < repeat; ++i) {
+    auto start = clock_type::now();
+    fn();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    if (elapsed.count() < best) best = elapsed.count();
+  }
+  return best;
+}
+
+static std::string WriteTempFile(const std::string & text) {
+  char path[] = "/tmp/lex_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) { std::cerr << "Unable to create temporary file." << std::endl; std::exit(1); }
+  close(fd);
+  std::ofstream(path) << text;
+  return path;
+}
+
+static void RunBenchmark(const std::string & label, const std::string & filename, int repeat) {
+  SourceFile source;
+  if (!source.Open(filename)) { std::cerr << "Unable to open '" << filename << "'." << std::endl; std::exit(1); }
+  const double mb = static_cast<double>(source.Size()) / (1 << 20);
+  size_t token_count = 0;
+
+  double stream_time = BestTime(repeat, [&]() {
+    std::ifstream in(filename);
+    std::string text(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>{});
+    emplex::Lexer lexer;
+    token_count = lexer.Tokenize(text).size();
+  });
+
+  double dfa_time = BestTime(repeat, [&]() {
+    SourceFile mapped;
+    mapped.Open(filename);
+    emplex::Lexer lexer;
+    lexer.SetFastScan(false);
+    lexer.Tokenize(mapped.View());
+  });
+
+  double fast_time = BestTime(repeat, [&]() {
+    SourceFile mapped;
+    mapped.Open(filename);
+    emplex::Lexer lexer;
+    lexer.Tokenize(mapped.View());
+  });
+
+  std::printf("lex_bench: %s, %.1f MB, %zu tokens (best of %d)\n", label.c_str(), mb, token_count, repeat);
+  std::printf("  DFA table        : %s, %d symbol classes, %zu bytes\n",
+#ifdef EMPLEX_WIDE_TABLE
+              "wide",
+#else
+              "compressed",
+#endif
+              emplex::DFA::NumClasses(), emplex::DFA::TableBytes());
+  std::printf("  istream + copy   : %8.1f MB/s\n", mb / stream_time);
+  std::printf("  mmap, DFA only   : %8.1f MB/s\n", mb / dfa_time);
+  std::printf("  mmap, fast scan  : %8.1f MB/s  (%.2fx vs DFA only)\n", mb / fast_time, dfa_time / fast_time);
+}
+
+int main(int argc, char * argv[]) {
+  int repeat = (argc > 2) ? std::atoi(argv[2]) : 5;
+
+  if (argc > 1) {
+    RunBenchmark(argv[1], argv[1], repeat);
+    return 0;
+  }
+
+  std::string tests_file = WriteTempFile(SynthesizeTestsSource(16 << 20));
+  RunBenchmark("test programs", tests_file, repeat);
+  std::remove(tests_file.c_str());
+
+  std::string generated_file = WriteTempFile(SynthesizeGeneratedSource(16 << 20));
+  RunBenchmark("generated code", generated_file, repeat);
+  std::remove(generated_file.c_str());
+}
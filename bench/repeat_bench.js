@@ -0,0 +1,113 @@
+// Benchmark of repeating a char or a string (char * int, string * int).
+//
+// Compiles a small program with Project4 --emit=wasm once per feature set,
+// then times, for results of 10 up to 1e6 bytes:
+//   pad      - c * n            ($pad_char: one allocation, one fill)
+//   repeat   - "ab" * (n / 2)   ($repeat_string: one allocation, doubling copies)
+//   loop     - s = s + c, n times, as pad_char used to work (quadratic, so
+//              only run up to 1e3)
+// Each result is freed after it's checked, so later runs reuse its memory
+// (the first run grows memory as needed); a result that doesn't fit in the
+// most memory a module may have is reported as such.
+//
+// Usage: node bench/repeat_bench.js [--compiler path] [--repeat n]
+
+'use strict';
+const { execFileSync } = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const VARIANTS = ['', 'bulk-memory', 'simd'];
+const COUNTS = [10, 100, 1000, 10000, 100000, 1000000];
+const MAX_LOOP_COUNT = 1000;
+
+let compiler = path.join(__dirname, '..', 'Project4');
+let repeat = 5;
+for (let i = 2; i < process.argv.length; ++i) {
+  const arg = process.argv[i];
+  const has_value = i + 1 < process.argv.length;
+  if (arg === '--compiler' && has_value) compiler = process.argv[++i];
+  else if (arg === '--repeat' && has_value) repeat = Math.max(1, parseInt(process.argv[++i], 10));
+  else {
+    console.error('Usage: node bench/repeat_bench.js [--compiler path] [--repeat n]');
+    process.exit(1);
+  }
+}
+
+const source = `function Pad(char c, int n) : string {
+  return c * n;
+}
+
+function Repeat(string s, int n) : string {
+  return s * n;
+}
+
+function Loop(char c, int n) : string {
+  string s = "";
+  int i = 0;
+  while (i < n) {
+    s = s + c;
+    i = i + 1;
+  }
+  return s;
+}
+`;
+const source_file = path.join(fs.mkdtempSync(path.join(os.tmpdir(), 'repeat-')), 'repeat.tube');
+fs.writeFileSync(source_file, source);
+
+function Compile(features) {
+  const args = ['--emit=wasm'];
+  if (features) args.push('--features=' + features);
+  return new WebAssembly.Module(execFileSync(compiler, [...args, source_file]));
+}
+
+// A new string "ab" in a fresh instance's memory, held so the calls given it don't free it.
+function MakeAB(exports) {
+  const bytes = new Uint8Array(exports.memory.buffer);
+  const cstr = bytes.length - 3;
+  bytes.set([97, 98, 0], cstr);
+  return exports.retain(exports.string_from_c(cstr));
+}
+
+// Best seconds for one call of kernel making a string of count bytes, or null if it doesn't fit.
+function Time(module, kernel, count) {
+  const exports = new WebAssembly.Instance(module, {}).exports;
+  const ab = MakeAB(exports);
+  let best = Infinity;
+  for (let run = 0; run <= repeat; ++run) {
+    let result;
+    const start = process.hrtime.bigint();
+    try {
+      if (kernel === 'pad') result = exports.Pad(45, count);
+      else if (kernel === 'repeat') result = exports.Repeat(ab, count / 2);
+      else result = exports.Loop(45, count);
+    } catch (error) {
+      if (error instanceof WebAssembly.RuntimeError) return null;  // Out of bounds.
+      throw error;
+    }
+    if (run > 0) best = Math.min(best, Number(process.hrtime.bigint() - start) / 1e9);  // Run 0 warms up.
+    if (exports.get_length(result) !== count) {
+      throw new Error(`${kernel}: made a string of ${exports.get_length(result)} bytes instead of ${count}`);
+    }
+    exports.free(result);
+  }
+  return best;
+}
+
+const modules = VARIANTS.map(Compile);
+console.log(`Repeating a char or string (best of ${repeat} runs)`);
+console.log(['kernel'.padEnd(7), 'bytes'.padStart(8), 'features'.padEnd(12), 'time (us)'.padStart(11), 'MB/s'.padStart(9)].join(' '));
+for (const kernel of ['pad', 'repeat', 'loop']) {
+  for (const count of COUNTS) {
+    if (kernel === 'loop' && count > MAX_LOOP_COUNT) continue;
+    VARIANTS.forEach((features, i) => {
+      const seconds = Time(modules[i], kernel, count);
+      const row = [kernel.padEnd(7), String(count).padStart(8), (features || 'none').padEnd(12)];
+      if (seconds === null) row.push('  (out of memory)');
+      else row.push((seconds * 1e6).toFixed(1).padStart(11), (count / 1e6 / seconds).toFixed(1).padStart(9));
+      console.log(row.join(' '));
+    });
+  }
+}
+fs.rmSync(path.dirname(source_file), { recursive: true, force: true });
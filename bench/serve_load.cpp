@@ -0,0 +1,240 @@
+// Load test for the compile server (Project4 --serve).
+//
+// Sends the same small program over and over on several connections at once
+// and reports requests per second and the median and 99th-percentile latency.
+// Connections go to a server already listening on a Unix socket (--socket),
+// or else to servers started for the purpose, one per connection, speaking
+// over pipes.  For comparison, it then compiles the program with a new
+// compiler process per request, the way a build service would without a server.
+//
+// Usage: bench/serve_load [--socket path] [--compiler path] [-c connections]
+//                         [-n requests] [--wasm] [file.tube]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <spawn.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "ServeProtocol.hpp"
+
+extern char ** environ;
+
+using clock_type = std::chrono::steady_clock;
+
+// A typical small request: a few short functions.
+static const char * SAMPLE_PROGRAM = R"(
+function Fib(int n) : int {
+  if (n < 2) return n;
+  return Fib(n - 1) + Fib(n - 2);
+}
+
+function Average(double a, double b, double c) : double {
+  return (a + b + c) / 3.0;
+}
+
+function Shout(string s) : string {
+  return s + "!";
+}
+
+function Sum(int n) : int {
+  int total = 0;
+  int i = 1;
+  while (i <= n) {
+    total = total + i;
+    i = i + 1;
+  }
+  return total;
+}
+)";
+
+struct Options {
+  std::string socket_path;
+  std::string compiler = "./Project4";
+  size_t connections = 4;
+  size_t requests = 4000;
+  bool wasm = false;
+  std::string source = SAMPLE_PROGRAM;
+};
+
+// A connection to a server: a socket, or the pipes of a server process we started.
+struct Connection {
+  int in_fd = -1;
+  int out_fd = -1;
+  pid_t pid = -1;
+
+  void Close() {
+    close(out_fd);
+    if (in_fd != out_fd) close(in_fd);
+    if (pid > 0) waitpid(pid, nullptr, 0);
+  }
+};
+
+// Start program with the given arguments, its stdin and stdout connected to pipes.
+static bool Spawn(const std::vector<std::string> & args, Connection & connection) {
+  int to_child[2], from_child[2];
+  // Close-on-exec, so later children don't hold these pipes open (and keep a server from seeing EOF).
+  if (pipe2(to_child, O_CLOEXEC) != 0 || pipe2(from_child, O_CLOEXEC) != 0) return false;
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, to_child[1]);
+  posix_spawn_file_actions_addclose(&actions, from_child[0]);
+  std::vector<char *> argv;
+  for (const std::string & arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+  const int result = posix_spawn(&connection.pid, argv[0], &actions, nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(to_child[0]);
+  close(from_child[1]);
+  connection.out_fd = to_child[1];
+  connection.in_fd = from_child[0];
+  return result == 0;
+}
+
+static bool Connect(const Options & options, Connection & connection) {
+  if (options.socket_path.empty()) return Spawn({options.compiler, "--serve"}, connection);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  options.socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) return false;
+  connection.in_fd = connection.out_fd = fd;
+  return true;
+}
+
+static double Percentile(const std::vector<double> & sorted, double fraction) {
+  const size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size()));
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void Report(const char * name, size_t connections, std::vector<double> & latencies, double seconds) {
+  std::sort(latencies.begin(), latencies.end());
+  std::printf("%-26s %2zu conn  %7zu req  %10.0f req/s   p50 %8.1f us   p99 %8.1f us\n",
+              name, connections, latencies.size(), static_cast<double>(latencies.size()) / seconds,
+              Percentile(latencies, 0.50), Percentile(latencies, 0.99));
+}
+
+// Send options.requests requests, spread over options.connections connections
+// to the server; every response must succeed and be the same.
+static bool RunServer(const Options & options) {
+  std::vector<Connection> connections(options.connections);
+  for (Connection & connection : connections) {
+    if (!Connect(options, connection)) {
+      std::fprintf(stderr, "Unable to connect to the server.\n");
+      return false;
+    }
+  }
+
+  std::vector<double> latencies;
+  std::string expected;
+  std::mutex mutex;
+  bool ok = true;
+  const char emit = options.wasm ? ServeProtocol::EMIT_WASM : ServeProtocol::EMIT_WAT;
+  const auto start = clock_type::now();
+  std::vector<std::thread> threads;
+  for (size_t c = 0; c < connections.size(); ++c) {
+    threads.emplace_back([&, c]() {
+      const size_t count = options.requests / connections.size() + (c < options.requests % connections.size());
+      std::vector<double> times;
+      std::string reply;
+      for (size_t i = 0; i < count; ++i) {
+        const auto sent = clock_type::now();
+        if (!ServeProtocol::WriteFrame(connections[c].out_fd, emit, options.source) ||
+            !ServeProtocol::ReadFrame(connections[c].in_fd, reply)) {
+          reply.clear();
+        }
+        times.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - sent).count());
+        if (reply.empty() || reply[0] != ServeProtocol::STATUS_OK) {
+          std::lock_guard lock(mutex);
+          if (ok) std::fprintf(stderr, "Request failed: %s\n", reply.empty() ? "no response" : reply.c_str() + 1);
+          ok = false;
+          break;
+        }
+        if (i == 0) {
+          std::lock_guard lock(mutex);
+          if (expected.empty()) expected = reply;
+          else if (expected != reply) ok = false;
+        }
+      }
+      std::lock_guard lock(mutex);
+      latencies.insert(latencies.end(), times.begin(), times.end());
+    });
+  }
+  for (std::thread & thread : threads) thread.join();
+  const double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+  for (Connection & connection : connections) connection.Close();
+  if (!ok) return false;
+  Report(options.socket_path.empty() ? "serve (pipes)" : "serve (socket)", connections.size(), latencies, seconds);
+  return true;
+}
+
+// Compile with a new compiler process per request, source on stdin, for comparison.
+static bool RunProcessPerRequest(const Options & options, size_t requests) {
+  std::vector<double> latencies;
+  const auto start = clock_type::now();
+  for (size_t i = 0; i < requests; ++i) {
+    const auto sent = clock_type::now();
+    Connection child;
+    std::vector<std::string> args{options.compiler};
+    if (options.wasm) args.push_back("--emit=wasm");
+    args.push_back("-");
+    if (!Spawn(args, child)) return false;
+    bool ok = ::write(child.out_fd, options.source.data(), options.source.size()) ==
+              static_cast<ssize_t>(options.source.size());
+    close(child.out_fd);
+    char buffer[4096];
+    while (::read(child.in_fd, buffer, sizeof(buffer)) > 0) { }
+    close(child.in_fd);
+    int status = 0;
+    waitpid(child.pid, &status, 0);
+    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::fprintf(stderr, "Compiler process failed.\n");
+      return false;
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - sent).count());
+  }
+  const double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+  Report("process per request", 1, latencies, seconds);
+  return true;
+}
+
+int main(int argc, char * argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--socket" && has_value) options.socket_path = argv[++i];
+    else if (arg == "--compiler" && has_value) options.compiler = argv[++i];
+    else if (arg == "-c" && has_value) options.connections = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "-n" && has_value) options.requests = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "--wasm") options.wasm = true;
+    else if (!arg.starts_with("-")) {
+      std::ifstream file(arg);
+      if (!file) { std::fprintf(stderr, "Unable to open '%s'.\n", arg.c_str()); return 1; }
+      options.source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else {
+      std::fprintf(stderr, "Usage: %s [--socket path] [--compiler path] [-c connections] [-n requests] [--wasm] [file.tube]\n", argv[0]);
+      return 1;
+    }
+  }
+  options.connections = std::min(options.connections, options.requests);
+
+  std::printf("Compile server load test (%zu-byte program, %s)\n", options.source.size(), options.wasm ? "wasm" : "wat");
+  if (!RunServer(options)) return 1;
+  if (!RunProcessPerRequest(options, std::max(1ul, options.requests / 20))) return 1;
+  return 0;
+}
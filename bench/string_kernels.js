@@ -0,0 +1,130 @@
+// Micro-benchmark of the string runtime's kernels under each --features set.
+//
+// Compiles a small program with Project4 --emit=wasm once per feature set
+// (none, bulk-memory, simd, simd+bulk-memory), then times two exported
+// runtime functions on long strings:
+//   string_from_c  - find a C string's terminator, then copy it
+//   add_strings    - copy two strings into a new one
+// and reports each one's throughput and speedup over the byte-at-a-time
+// runtime.  Every variant is first checked against the expected strings,
+// including ones that end right at the end of memory.
+//
+// Each result is freed before the next call, so the calls reuse one block
+// (the time to allocate and free it is included).  Throughput is in MB/s of
+// input (string_from_c reads one string, add_strings two).
+//
+// Usage: node bench/string_kernels.js [--compiler path] [--repeat n]
+
+'use strict';
+const { execFileSync } = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const VARIANTS = ['', 'bulk-memory', 'simd', 'simd,bulk-memory'];
+const LENGTHS = [256, 4096, 65536];
+const TARGET_BYTES = 64 * 1024 * 1024;  // Input bytes per measurement.
+
+let compiler = path.join(__dirname, '..', 'Project4');
+let repeat = 3;
+for (let i = 2; i < process.argv.length; ++i) {
+  const arg = process.argv[i];
+  const has_value = i + 1 < process.argv.length;
+  if (arg === '--compiler' && has_value) compiler = process.argv[++i];
+  else if (arg === '--repeat' && has_value) repeat = Math.max(1, parseInt(process.argv[++i], 10));
+  else {
+    console.error('Usage: node bench/string_kernels.js [--compiler path] [--repeat n]');
+    process.exit(1);
+  }
+}
+
+// Any program will do; every module includes the whole runtime.
+const source = 'function Echo(string s) : string {\n  return s;\n}\n';
+const source_file = path.join(fs.mkdtempSync(path.join(os.tmpdir(), 'kernels-')), 'echo.tube');
+fs.writeFileSync(source_file, source);
+
+function Compile(features) {
+  const args = ['--emit=wasm'];
+  if (features) args.push('--features=' + features);
+  return new WebAssembly.Module(execFileSync(compiler, [...args, source_file]));
+}
+
+// Write a C string of length bytes ending just before end; returns its address.
+function WriteCString(memory, length, end) {
+  const bytes = new Uint8Array(memory.buffer);
+  const start = end - length - 1;
+  for (let i = 0; i < length; ++i) bytes[start + i] = 97 + (i % 26);
+  bytes[start + length] = 0;
+  return start;
+}
+
+function ReadString(exports, str) {
+  const bytes = new Uint8Array(exports.memory.buffer);
+  const length = exports.get_length(str);
+  const text = Buffer.from(bytes.subarray(str + 4, str + 4 + length)).toString('latin1');
+  if (bytes[str + 4 + length] !== 0) throw new Error('string at ' + str + ' is not 0-terminated');
+  return text;
+}
+
+function Expected(length) {
+  let text = '';
+  for (let i = 0; i < length; ++i) text += String.fromCharCode(97 + (i % 26));
+  return text;
+}
+
+// Every length up to a few vectors, at every alignment, and right at the end of memory.
+function Check(module, features) {
+  const exports = new WebAssembly.Instance(module, {}).exports;
+  const memory_end = exports.memory.buffer.byteLength;
+  for (let length = 0; length <= 70; ++length) {
+    for (let end of [memory_end, memory_end - 1 - (length % 16), memory_end - 4096 - length]) {
+      const str = exports.retain(exports.string_from_c(WriteCString(exports.memory, length, end)));
+      const joined = exports.add_strings(str, str);
+      if (ReadString(exports, str) !== Expected(length) ||
+          ReadString(exports, joined) !== Expected(length) + Expected(length)) {
+        throw new Error(`features '${features}': wrong result for a string of length ${length}`);
+      }
+      exports.release(str);
+      exports.release(joined);
+    }
+  }
+}
+
+// Best seconds, over repeat rounds, for calls totalling TARGET_BYTES of input.
+function Time(module, length, kernel) {
+  const exports = new WebAssembly.Instance(module, {}).exports;
+  const cstr = exports.alloc(length + 1);
+  WriteCString(exports.memory, length, cstr + length + 1);
+  const str = exports.retain(exports.string_from_c(cstr));  // add_strings would free it otherwise
+  const calls = Math.ceil(TARGET_BYTES / (kernel === 'add_strings' ? 2 * length : length));
+  let best = Infinity;
+  for (let round = 0; round < repeat; ++round) {
+    const start = process.hrtime.bigint();
+    if (kernel === 'add_strings') {
+      for (let i = 0; i < calls; ++i) exports.free(exports.add_strings(str, str));
+    } else {
+      for (let i = 0; i < calls; ++i) exports.free(exports.string_from_c(cstr));
+    }
+    best = Math.min(best, Number(process.hrtime.bigint() - start) / 1e9);
+  }
+  return best * TARGET_BYTES / (calls * (kernel === 'add_strings' ? 2 * length : length));
+}
+
+const modules = VARIANTS.map(Compile);
+VARIANTS.forEach((features, i) => Check(modules[i], features));
+
+console.log(`String kernels (best of ${repeat} rounds, ${TARGET_BYTES >> 20} MiB of input each)`);
+console.log(['kernel'.padEnd(14), 'length'.padStart(7), 'features'.padEnd(17), 'MB/s'.padStart(9), 'speedup'.padStart(8)].join(' '));
+for (const kernel of ['string_from_c', 'add_strings']) {
+  for (const length of LENGTHS) {
+    let base_seconds = 0;
+    VARIANTS.forEach((features, i) => {
+      const seconds = Time(modules[i], length, kernel);
+      if (i === 0) base_seconds = seconds;
+      console.log([kernel.padEnd(14), String(length).padStart(7), (features || 'none').padEnd(17),
+                   (TARGET_BYTES / 1e6 / seconds).toFixed(1).padStart(9),
+                   (base_seconds / seconds).toFixed(2).padStart(7) + 'x'].join(' '));
+    });
+  }
+}
+fs.rmSync(path.dirname(source_file), { recursive: true, force: true });
@@ -0,0 +1,96 @@
+// SymbolTable lookup benchmark.
+//
+// Declares thousands of locals in a function's outer scope, nests blocks to
+// increasing depths (declaring a shadowing local in each), and then times
+// variable lookups from the innermost block.  For comparison it runs the same
+// steps on the previous design: one hash map per scope, searched innermost
+// first, with a linear scan to find a variable's type.
+//
+// Usage: bench/symbol_bench [num_locals] [num_lookups]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "InternTable.hpp"
+#include "SymbolTable.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+// The scope-stack table that SymbolTable replaced.
+class ScopeStackTable {
+private:
+  std::vector<std::unordered_map<int, int>> scopes;
+  std::vector<VarData> variables;
+  int unique_id_increment = 0;
+
+public:
+  ScopeStackTable() { PushScope(); }
+  void PushScope() { scopes.emplace_back(); }
+  void PopScope() { scopes.pop_back(); }
+  int InitializeVar(int symbol, DataType type) {
+    scopes.back()[symbol] = unique_id_increment;
+    variables.emplace_back(unique_id_increment, type);
+    return unique_id_increment++;
+  }
+  int GetUniqueId(int symbol) const {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+      auto found = it->find(symbol);
+      if (found != it->end()) return found->second;
+    }
+    return -1;
+  }
+  DataType GetDataType(int unique_id) const {
+    for (const auto & var : variables) {
+      if (var.unique_id == unique_id) return var.type;
+    }
+    return DataType::INTEGER;
+  }
+};
+
+// Declare locals, nest depth scopes, then time lookups of random outer locals.
+// Returns nanoseconds per lookup (GetUniqueId + GetDataType).
+template <typename TABLE>
+static double TimeLookups(TABLE & table, int num_locals, int depth, const std::vector<int> & queries) {
+  for (int symbol = 0; symbol < num_locals; ++symbol) table.InitializeVar(symbol, DataType::INTEGER);
+  for (int level = 0; level < depth; ++level) {
+    table.PushScope();
+    table.InitializeVar(num_locals + level, DataType::DOUBLE);  // Something to shadow at each level.
+  }
+
+  long checksum = 0;
+  auto start = clock_type::now();
+  for (int symbol : queries) {
+    int unique_id = table.GetUniqueId(symbol);
+    checksum += unique_id + static_cast<int>(table.GetDataType(unique_id));
+  }
+  std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+  for (int level = 0; level < depth; ++level) table.PopScope();
+  if (checksum == 42) std::printf(" ");  // Keep the loop from being optimized away.
+  return elapsed.count() * 1e9 / static_cast<double>(queries.size());
+}
+
+int main(int argc, char * argv[]) {
+  const int num_locals = (argc > 1) ? std::atoi(argv[1]) : 4000;
+  const int num_lookups = (argc > 2) ? std::atoi(argv[2]) : 200000;
+
+  std::mt19937 rng(450);
+  std::vector<int> queries(static_cast<size_t>(num_lookups));
+  for (int & symbol : queries) symbol = static_cast<int>(rng() % static_cast<unsigned>(num_locals));
+
+  InternTable names;
+  std::printf("symbol_bench: %d locals, %d lookups (ns per lookup)\n", num_locals, num_lookups);
+  std::printf("  %8s  %12s  %12s\n", "depth", "SymbolTable", "scope stack");
+  for (int depth : {1, 8, 64, 512}) {
+    SymbolTable table(names);
+    ScopeStackTable old_table;
+    const double new_ns = TimeLookups(table, num_locals, depth, queries);
+    const double old_ns = TimeLookups(old_table, num_locals, depth, queries);
+    std::printf("  %8d  %12.1f  %12.1f\n", depth, new_ns, old_ns);
+  }
+}
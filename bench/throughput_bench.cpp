@@ -0,0 +1,226 @@
+// Compiler throughput benchmark, with regression checking.
+//
+// For each program shape from ProgramGenerator (many functions, deep nesting,
+// long expressions, many string literals, many locals), times lexing,
+// parsing, type checking, constant folding and code generation separately, and reports each
+// phase's throughput in MB/s and lines/s (the best of several runs).
+//
+// Throughput (MB/s) is compared against a baseline JSON file, and the
+// benchmark fails if any phase is slower than the baseline by more than the
+// threshold.  Baselines are specific to a machine; record a new one with
+// --write-baseline (or make bench-baseline) after an intended change.
+//
+// Usage: bench/throughput_bench [--baseline file.json] [--write-baseline]
+//                               [--threshold fraction] [--repeat n] [--scale factor]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Arena.hpp"
+#include "ConstantFolder.hpp"
+#include "Emitter.hpp"
+#include "Parser.hpp"
+#include "ProgramGenerator.hpp"
+#include "TokenQueue.hpp"
+#include "TypeChecker.hpp"
+#include "WasmWriter.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+static double SecondsSince(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// How many functions of each shape to generate (about 1-2 MB of source apiece, at scale 1).
+static int NumFunctions(std::string_view shape) {
+  if (shape == "functions") return 12000;
+  if (shape == "nesting") return 150;
+  if (shape == "expressions") return 1000;
+  if (shape == "strings") return 600;
+  return 150;  // locals
+}
+
+static const char * PHASES[] = {"lex", "parse", "typecheck", "fold", "codegen"};
+static constexpr int RETRIES = 2;  // Times to re-measure a shape that seems to have regressed.
+
+// Best seconds for each phase over `repeat` complete compilations of source.
+// The token queue, arena and output string are reused from run to run (as a
+// compile server would), so page faults from fresh allocations don't make the
+// timings noisy; the first run just warms them up.
+static std::vector<double> TimePhases(const std::string & source, int repeat) {
+  std::vector<double> best(std::size(PHASES), 1e30);
+  TokenQueue tokens;
+  Arena arena;
+  std::string wat;
+  for (int run = 0; run <= repeat; ++run) {
+    arena.Reset();
+    wat.clear();
+    if (run == 1) best.assign(best.size(), 1e30);  // Forget the warm-up run.
+
+    auto start = clock_type::now();
+    tokens.Load(source);
+    best[0] = std::min(best[0], SecondsSince(start));
+
+    start = clock_type::now();
+    Parser parser(tokens, arena);
+    std::vector<Function*> functions = parser.Parse();
+    best[1] = std::min(best[1], SecondsSince(start));
+
+    start = clock_type::now();
+    TypeChecker checker;
+    if (checker.Check(functions) != 0) {
+      std::fprintf(stderr, "Generated program has type errors: %s\n", checker.Errors()[0].c_str());
+      std::exit(1);
+    }
+    best[2] = std::min(best[2], SecondsSince(start));
+
+    start = clock_type::now();
+    ConstantFolder folder(arena);
+    folder.Fold(functions);
+    int memory_pos = parser.PlaceLiteralStrings();
+    for (Function * function : functions) memory_pos = function->PlaceFoldedStrings(memory_pos);
+    best[3] = std::min(best[3], SecondsSince(start));
+
+    start = clock_type::now();
+    {
+      Emitter text(wat);
+      WasmWriter out(text);
+      Function::GenerateLiteralStrings(out, functions);
+      for (Function * function : functions) function->GenerateCode(out);
+    }
+    best[4] = std::min(best[4], SecondsSince(start));
+  }
+  return best;
+}
+
+// Read "key": number pairs from a flat JSON object (the format WriteBaseline writes).
+static std::map<std::string, double> ReadBaseline(const std::string & filename) {
+  std::map<std::string, double> values;
+  std::ifstream file(filename);
+  const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  size_t pos = 0;
+  while ((pos = text.find('"', pos)) != std::string::npos) {
+    const size_t end = text.find('"', pos + 1);
+    if (end == std::string::npos) break;
+    const std::string key = text.substr(pos + 1, end - pos - 1);
+    const size_t colon = text.find_first_not_of(" \t\r\n", end + 1);
+    pos = end + 1;
+    if (colon == std::string::npos || text[colon] != ':') continue;
+    char * number_end = nullptr;
+    const double value = std::strtod(text.c_str() + colon + 1, &number_end);
+    if (number_end != text.c_str() + colon + 1) values[key] = value;
+  }
+  return values;
+}
+
+static bool WriteBaseline(const std::string & filename, const std::vector<std::pair<std::string, double>> & values) {
+  std::ofstream file(filename);
+  file << "{\n";
+  for (size_t i = 0; i < values.size(); ++i) {
+    char line[128];
+    std::snprintf(line, sizeof(line), "  \"%s\": %.2f%s\n", values[i].first.c_str(), values[i].second,
+                  i + 1 < values.size() ? "," : "");
+    file << line;
+  }
+  file << "}\n";
+  return static_cast<bool>(file);
+}
+
+int main(int argc, char * argv[]) {
+  std::string baseline_file = "bench/baseline.json";
+  bool write_baseline = false;
+  double threshold = 0.30;
+  int repeat = 5;
+  double scale = 1.0;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--baseline" && has_value) baseline_file = argv[++i];
+    else if (arg == "--write-baseline") write_baseline = true;
+    else if (arg == "--threshold" && has_value) threshold = std::atof(argv[++i]);
+    else if (arg == "--repeat" && has_value) repeat = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--scale" && has_value) scale = std::atof(argv[++i]);
+    else {
+      std::fprintf(stderr, "Usage: %s [--baseline file.json] [--write-baseline] [--threshold fraction] [--repeat n] [--scale factor]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const std::map<std::string, double> baseline = write_baseline ? std::map<std::string, double>{} : ReadBaseline(baseline_file);
+  if (!write_baseline && baseline.empty()) std::printf("(No baseline in %s; nothing to compare against.)\n", baseline_file.c_str());
+
+  std::printf("Compiler throughput (best of %d runs)\n", repeat);
+  std::printf("%-12s %8s %9s  %-9s %9s %12s %10s %8s\n", "shape", "MB", "lines", "phase", "MB/s", "lines/s", "baseline", "change");
+
+  std::vector<std::pair<std::string, double>> results;
+  int regressions = 0;
+  for (std::string_view shape : ProgramGenerator::Shapes()) {
+    const int num_functions = std::max(1, static_cast<int>(NumFunctions(shape) * scale));
+    const std::string source = ProgramGenerator::Generate(shape, num_functions, ProgramGenerator::DefaultIntensity(shape));
+    const double megabytes = static_cast<double>(source.size()) / 1e6;
+    const double lines = static_cast<double>(std::count(source.begin(), source.end(), '\n'));
+
+    auto key = [&](size_t phase) { return std::string(shape) + "/" + PHASES[phase]; };
+    auto regressed = [&](size_t phase, double seconds) {
+      auto it = baseline.find(key(phase));
+      return it != baseline.end() && megabytes / seconds < it->second * (1.0 - threshold);
+    };
+
+    std::vector<double> seconds = TimePhases(source, repeat);
+    if (write_baseline) {
+      // Record the median of three rounds, so one unusually fast or slow round doesn't set the bar.
+      std::vector<std::vector<double>> rounds{seconds, TimePhases(source, repeat), TimePhases(source, repeat)};
+      for (size_t phase = 0; phase < seconds.size(); ++phase) {
+        std::vector<double> times{rounds[0][phase], rounds[1][phase], rounds[2][phase]};
+        std::sort(times.begin(), times.end());
+        seconds[phase] = times[1];
+      }
+    }
+    // Timings on a busy machine can dip for a while; a regression must show up in a retry too.
+    for (int retry = 0; retry < RETRIES; ++retry) {
+      bool any_regressed = false;
+      for (size_t phase = 0; phase < seconds.size(); ++phase) any_regressed |= regressed(phase, seconds[phase]);
+      if (!any_regressed) break;
+      const std::vector<double> again = TimePhases(source, repeat);
+      for (size_t phase = 0; phase < seconds.size(); ++phase) seconds[phase] = std::min(seconds[phase], again[phase]);
+    }
+
+    for (size_t phase = 0; phase < seconds.size(); ++phase) {
+      const double rate = megabytes / seconds[phase];
+      results.emplace_back(key(phase), rate);
+
+      char comparison[64] = "";
+      auto it = baseline.find(key(phase));
+      if (it != baseline.end() && it->second > 0.0) {
+        const double change = rate / it->second - 1.0;
+        const bool regressed = change < -threshold;
+        regressions += regressed;
+        std::snprintf(comparison, sizeof(comparison), "%10.1f %+7.1f%%%s", it->second, 100.0 * change, regressed ? "  REGRESSION" : "");
+      }
+      char size[64] = "";  // Only on each shape's first line.
+      if (phase == 0) std::snprintf(size, sizeof(size), "%-12.*s %8.2f %9.0f", int(shape.size()), shape.data(), megabytes, lines);
+      std::printf("%-31s  %-9s %9.1f %12.0f %s\n", size, PHASES[phase], rate, lines / seconds[phase], comparison);
+    }
+  }
+
+  if (write_baseline) {
+    if (!WriteBaseline(baseline_file, results)) {
+      std::fprintf(stderr, "Unable to write %s\n", baseline_file.c_str());
+      return 1;
+    }
+    std::printf("Wrote baseline to %s\n", baseline_file.c_str());
+    return 0;
+  }
+  if (regressions) {
+    std::printf("FAILED: %d phase(s) more than %.0f%% slower than the baseline.\n", regressions, threshold * 100.0);
+    return 1;
+  }
+  return 0;
+}
@@ -4,19 +4,34 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <bit>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include "lexer_scan.hpp"
+
 namespace emplex {
-  // Struct to store information about a found Token
+  // Struct to store information about a found Token.
+  // Tokens do not own their text; the lexeme is the range [offset, offset+length)
+  // of the source that was tokenized (see Lexeme() below).
   struct Token {
     int id;                             // Type ID for token
-    std::string lexeme;                 // Sequence matched by token
-    size_t line_id;                     // Line token started on
-    size_t col_id;                      // Column token started on
+    uint32_t offset;                    // Position of lexeme in the source
+    uint32_t length;                    // Number of characters in lexeme
+    uint32_t line_id;                   // Line token started on
+    uint32_t col_id;                    // Column token started on
+    int symbol = -1;                    // Interned name for identifiers (-1 otherwise)
     operator int() const { return id; } // Auto-convert tokens to IDs
+
+    // Get the text of this token from the source it was lexed from.
+    std::string_view Lexeme(std::string_view source) const {
+      return source.substr(offset, length);
+    }
   };
   
   // Deterministic Finite Automaton (DFA) for token recognition.
@@ -159,6 +174,60 @@ namespace emplex {
     }};
     // DFA stop states (0 indicates NOT a stop)
     static constexpr std::array<int, NUM_STATES> stop_id = {0,0,255,232,0,228,0,218,214,213,230,227,212,234,0,229,253,247,217,225,221,223,235,211,210,235,235,235,235,235,235,235,235,235,216,0,215,219,235,235,235,235,241,241,235,235,235,235,235,235,238,238,235,243,243,235,237,237,235,235,235,235,242,242,246,235,251,251,246,235,235,235,235,235,235,248,248,235,235,244,244,235,235,235,235,250,250,235,235,235,235,235,235,235,240,240,235,249,249,235,235,235,239,239,223,224,221,222,225,226,253,252,252,229,254,254,252,230,231,218,0,245,245,220,236,232,233,255};
+
+#ifndef EMPLEX_WIDE_TABLE
+    // By default, transitions are looked up in a compressed copy of the table,
+    // built at compile time: input symbols whose columns are identical share one
+    // equivalence class, and states are stored in the narrowest type that fits.
+    // The whole automaton then takes a few KB and stays in L1 cache; the full
+    // table above is only read during compilation.  Define EMPLEX_WIDE_TABLE to
+    // use the full table directly instead (e.g., to benchmark both).
+    using state_t = std::conditional_t<(NUM_STATES <= 128), int8_t, int16_t>;
+
+    static constexpr std::array<uint8_t, NUM_SYMBOLS> symbol_class = [] {
+      std::array<uint8_t, NUM_SYMBOLS> classes{};
+      std::array<int, NUM_SYMBOLS> first_symbol{};  // Representative of each class.
+      int num_classes = 0;
+      for (int sym = 0; sym < NUM_SYMBOLS; ++sym) {
+        int found = -1;
+        for (int c = 0; c < num_classes && found < 0; ++c) {
+          bool same = true;
+          for (size_t state = 0; state < NUM_STATES && same; ++state) {
+            same = table[state][static_cast<size_t>(sym)] == table[state][static_cast<size_t>(first_symbol[c])];
+          }
+          if (same) found = c;
+        }
+        if (found < 0) {
+          found = num_classes;
+          first_symbol[num_classes++] = sym;
+        }
+        classes[static_cast<size_t>(sym)] = static_cast<uint8_t>(found);
+      }
+      return classes;
+    }();
+
+    static constexpr int NUM_CLASSES = *std::max_element(symbol_class.begin(), symbol_class.end()) + 1;
+
+    // Rows are padded to a power of two so finding a state's row is a shift.
+    static constexpr size_t CLASS_ROW_SIZE = std::bit_ceil(static_cast<size_t>(NUM_CLASSES));
+    using class_row_t = std::array<state_t, CLASS_ROW_SIZE>;
+
+    static constexpr std::array<class_row_t, NUM_STATES> class_table = [] {
+      std::array<class_row_t, NUM_STATES> out{};
+      for (size_t state = 0; state < NUM_STATES; ++state) {
+        for (size_t sym = 0; sym < NUM_SYMBOLS; ++sym) {
+          out[state][symbol_class[sym]] = static_cast<state_t>(table[state][sym]);
+        }
+      }
+      return out;
+    }();
+
+    static constexpr std::array<uint8_t, NUM_STATES> narrow_stop_id = [] {
+      std::array<uint8_t, NUM_STATES> out{};
+      for (size_t state = 0; state < NUM_STATES; ++state) out[state] = static_cast<uint8_t>(stop_id[state]);
+      return out;
+    }();
+#endif
   
   public:
     constexpr static int SYMBOL_START = 2;     ///< Symbol to indicate a start of line.
@@ -166,13 +235,28 @@ namespace emplex {
     constexpr static int SYMBOL_MIN_INPUT = 9; ///< Symbols below this are control symbols.
   
     static constexpr size_t size() { return 128; }
+
+#ifndef EMPLEX_WIDE_TABLE
+    static constexpr int NumClasses() { return NUM_CLASSES; }
+    static constexpr size_t TableBytes() { return sizeof(class_table) + sizeof(symbol_class) + sizeof(narrow_stop_id); }
+    static constexpr int GetStop(int state) {
+      return (state >= 0) ? narrow_stop_id[static_cast<size_t>(state)] : 0;
+    }
+#else
+    static constexpr int NumClasses() { return NUM_SYMBOLS; }
+    static constexpr size_t TableBytes() { return sizeof(table) + sizeof(stop_id); }
     static constexpr int GetStop(int state) {
       return (state >= 0) ? stop_id[static_cast<size_t>(state)] : 0;
     }
+#endif
     static constexpr int GetNext(int state, int sym) {
       int next_state = -1;
       if (state >= 0 && sym >= 0) {
+#ifndef EMPLEX_WIDE_TABLE
+        next_state = class_table[static_cast<size_t>(state)][symbol_class[static_cast<size_t>(sym)]];
+#else
         next_state = table[static_cast<size_t>(state)][static_cast<size_t>(sym)];
+#endif
       }
       // If sym is a control symbol (line begin/end) and not used, keep old state.
       if (sym < SYMBOL_MIN_INPUT && next_state == -1) next_state = state;
@@ -199,7 +283,7 @@ namespace emplex {
     size_t cur_line = 1;   // Track LINE we are reading in the input.
     size_t cur_col = 0;    // Track COLUMN we are reading in the input.
     int start_pos = 0;     // Track INDEX for the start of current lexeme.
-    std::string lexeme{};  // Lexeme found for the current token
+    bool fast_scan = true; // Skip whitespace, comments and strings with wide scans?
     std::string errors{};  // Description of any errors encountered
   
   public:
@@ -328,78 +412,114 @@ namespace emplex {
   
     // Return the number of token types the lexer recognizes.
     static constexpr int GetNumTokens() { return NUM_TOKENS; }
+
+    // Turn the wide-scan fast paths on or off (e.g., to benchmark the plain DFA).
+    void SetFastScan(bool enable) { fast_scan = enable; }
+
+    // If a whitespace run, comment, or string literal begins at start_pos, find
+    // where it ends with a wide scan and return its token ID.  Return 0 if the
+    // DFA must handle this token (including anything it would treat unusually,
+    // like control characters or unterminated strings).
+    int FastScan(std::string_view in, int & end_pos) const {
+      const size_t pos = static_cast<size_t>(start_pos);
+      const char c = in[pos];
+      size_t end = 0;
+      int id = 0;
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        end = scan::FindEnd<scan::Run::WHITESPACE>(in, pos + 1);
+        id = ID_whitespace;
+      } else if (c == '/' && pos + 1 < in.size() && in[pos + 1] == '/') {
+        end = scan::FindEnd<scan::Run::COMMENT>(in, pos + 2);
+        id = ID_comment;
+      } else if (c == '"') {
+        end = scan::FindEnd<scan::Run::STRING>(in, pos + 1);
+        if (end == in.size() || in[end] != '"') return 0;
+        end++;
+        id = ID_literal_string;
+      } else return 0;
+
+      // The DFA steps over control symbols, so one right after a run extends it.
+      if (end < in.size() && in[end] >= 0 && in[end] < DFA::SYMBOL_MIN_INPUT) return 0;
+      end_pos = static_cast<int>(end);
+      return id;
+    }
   
     // Generate and return the next token from the input stream.
     Token NextToken(std::string_view in) {
       // If we cannot read in, return an "EOF" token.
-      if (start_pos >= std::ssize(in)) return { 0, "", cur_line, cur_col };
+      if (start_pos >= std::ssize(in)) {
+        return { 0, static_cast<uint32_t>(start_pos), 0, static_cast<uint32_t>(cur_line), static_cast<uint32_t>(cur_col) };
+      }
   
       int cur_pos = start_pos;   // Position in the input that we are actively analyzing
       int best_pos = start_pos;  // Best look-ahead we've found so far
       int cur_state = 0;         // Next state for the DFA analysis
       int cur_stop = 0;          // Current "stop" state (or 0 if we can't stop here)
       int best_stop = -1;        // Best stop state found so far?
-  
-      // If we are at the START OF A LINE, send a DFA::SYMBOL_START
-      if (start_pos == 0 || in[start_pos-1] == '\n') {
-        cur_state = DFA::GetNext(0, DFA::SYMBOL_START);
-      }
-      // Keep looking as long as:
-      // 1: We may be able to continue the current lexeme, and
-      // 2: We have not entered an invalid state, and
-      // 3: Our input string has more symbols to provide
-      while (cur_stop >= 0 && cur_state >= 0 && cur_pos < std::ssize(in)) {
-        const char next_char = in[cur_pos++];
-        if (next_char < 0) break; // Ignore invalid chars.
-        cur_state = DFA::GetNext(cur_state, next_char);
-        cur_stop = DFA::GetStop(cur_state);
-        if (cur_stop > 0) { best_pos = cur_pos; best_stop = cur_stop; }
-        // Look ahead to see if we are at the END OF A LINE that can finish a token.
-        if (cur_pos == std::ssize(in) || in[cur_pos] == '\n') {
-          int eol_state = DFA::GetNext(cur_state, DFA::SYMBOL_STOP);
-          int eol_stop = DFA::GetStop(eol_state);
-          if (eol_stop > 0) { best_pos = cur_pos; best_stop = eol_stop; }
+
+      // Long runs of whitespace, comments and strings don't need the DFA.
+      int fast_id = fast_scan ? FastScan(in, best_pos) : 0;
+      if (fast_id) best_stop = fast_id;
+      else {
+        // If we are at the START OF A LINE, send a DFA::SYMBOL_START
+        if (start_pos == 0 || in[start_pos-1] == '\n') {
+          cur_state = DFA::GetNext(0, DFA::SYMBOL_START);
+        }
+        // Keep looking as long as:
+        // 1: We may be able to continue the current lexeme, and
+        // 2: We have not entered an invalid state, and
+        // 3: Our input string has more symbols to provide
+        while (cur_stop >= 0 && cur_state >= 0 && cur_pos < std::ssize(in)) {
+          const char next_char = in[cur_pos++];
+          if (next_char < 0) break; // Ignore invalid chars.
+          cur_state = DFA::GetNext(cur_state, next_char);
+          cur_stop = DFA::GetStop(cur_state);
+          if (cur_stop > 0) { best_pos = cur_pos; best_stop = cur_stop; }
+          // Look ahead to see if we are at the END OF A LINE that can finish a token.
+          if (cur_pos == std::ssize(in) || in[cur_pos] == '\n') {
+            int eol_state = DFA::GetNext(cur_state, DFA::SYMBOL_STOP);
+            int eol_stop = DFA::GetStop(eol_state);
+            if (eol_stop > 0) { best_pos = cur_pos; best_stop = eol_stop; }
+          }
         }
       }
   
       // If we did not find any options, peel off just one character and use it as id.
       if (best_pos == start_pos) { best_stop=in[start_pos]; best_pos++;}
   
-      lexeme = in.substr(start_pos, best_pos-start_pos);
+      const std::string_view lexeme = in.substr(start_pos, best_pos-start_pos);
+      const Token out_token{ best_stop, static_cast<uint32_t>(start_pos), static_cast<uint32_t>(lexeme.size()),
+                             static_cast<uint32_t>(cur_line), static_cast<uint32_t>(cur_col) };
       start_pos += std::ssize(lexeme);
   
       // Update the line number we are on.
-      const size_t out_line = cur_line;
-      const size_t out_col = cur_col;
       if ((cur_col = lexeme.rfind('\n')) == std::string::npos) { // No newlines
-        cur_col = out_col + lexeme.size();
+        cur_col = out_token.col_id + lexeme.size();
       } else {
         cur_col = lexeme.size() - cur_col - 1;
-        cur_line += static_cast<size_t>(std::count(lexeme.begin(),lexeme.end(),'\n'));
+        cur_line += scan::CountNewlines(lexeme);
       }
   
       // Return the token we found.
-      return { best_stop, lexeme, out_line, out_col };
+      return out_token;
     }
   
-    // Convert an input string into a vector of tokens.
-    std::vector<Token> Tokenize(std::string_view in) {
+    // Prepare to read a new input from its beginning with NextToken.
+    void Reset() {
       start_pos = 0; // Start processing at beginning of string.
       cur_line = 1;  // Start processing at the first line of the input.
       cur_col = 0;   // Start processing at the first position of the input.
+    }
+
+    // Convert an input string into a vector of tokens.
+    std::vector<Token> Tokenize(std::string_view in) {
+      Reset();
       std::vector<Token> out_tokens;
       while (Token token = NextToken(in)) {
         if (!IgnoreToken(token.id)) out_tokens.push_back(token);
       }
       return out_tokens;
     }
-  
-    // Convert an input stream to a string, then tokenize.
-    std::vector<Token> Tokenize(std::istream & is) {
-      return Tokenize(
-        std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())
-      );
-    }
-  };
+};
 } // End of namespace emplex
 #endif // #ifndef EMPLEX_LEXER_HPP_INCLUDE_
\ No newline at end of file
@@ -0,0 +1,147 @@
+#ifndef EMPLEX_LEXER_SCAN_HPP_INCLUDE_
+#define EMPLEX_LEXER_SCAN_HPP_INCLUDE_
+
+// Wide scanning helpers used by the lexer to skip over long runs of whitespace,
+// comment text and string-literal contents without stepping the DFA once per
+// character.  On x86-64 these use SSE2, or AVX2 when the CPU supports it
+// (checked once at runtime); elsewhere they fall back to simple loops.
+
+#include <cstddef>
+#include <string_view>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define EMPLEX_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace emplex::scan {
+
+  // Predicates for the three kinds of run the lexer skips.
+  // Each returns true for the byte that ENDS the run.
+  inline bool EndsWhitespace(unsigned char c) { return c != ' ' && c != '\t' && c != '\n' && c != '\r'; }
+  inline bool EndsComment(unsigned char c) { return c == '\n' || c >= 0x80; }
+  inline bool EndsString(unsigned char c) { return c == '"' || c >= 0x80; }
+
+  enum class Run { WHITESPACE, COMMENT, STRING };
+
+  template <Run RUN>
+  inline bool EndsRun(unsigned char c) {
+    if constexpr (RUN == Run::WHITESPACE) return EndsWhitespace(c);
+    else if constexpr (RUN == Run::COMMENT) return EndsComment(c);
+    else return EndsString(c);
+  }
+
+  template <Run RUN>
+  inline size_t FindEndScalar(const char * data, size_t pos, size_t size) {
+    while (pos < size && !EndsRun<RUN>(static_cast<unsigned char>(data[pos]))) ++pos;
+    return pos;
+  }
+
+  inline size_t CountNewlinesScalar(const char * data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i) count += (data[i] == '\n');
+    return count;
+  }
+
+#ifdef EMPLEX_SCAN_X86
+  // Bit mask (one bit per byte) of the positions in v that end a run.
+  template <Run RUN>
+  inline unsigned EndMask16(__m128i v) {
+    if constexpr (RUN == Run::WHITESPACE) {
+      __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+      return ~static_cast<unsigned>(_mm_movemask_epi8(ws)) & 0xFFFFu;
+    } else {
+      const char stop = (RUN == Run::COMMENT) ? '\n' : '"';
+      // OR-ing in v itself sets the sign bit for every byte >= 0x80.
+      return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(stop)), v)));
+    }
+  }
+
+  template <Run RUN>
+  __attribute__((target("avx2")))
+  inline unsigned EndMask32(__m256i v) {
+    if constexpr (RUN == Run::WHITESPACE) {
+      __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                   _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+      return ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+    } else {
+      const char stop = (RUN == Run::COMMENT) ? '\n' : '"';
+      return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(stop)), v)));
+    }
+  }
+
+  template <Run RUN>
+  inline size_t FindEndSSE2(const char * data, size_t pos, size_t size) {
+    for (; pos + 16 <= size; pos += 16) {
+      unsigned mask = EndMask16<RUN>(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos)));
+      if (mask) return pos + static_cast<size_t>(__builtin_ctz(mask));
+    }
+    return FindEndScalar<RUN>(data, pos, size);
+  }
+
+  template <Run RUN>
+  __attribute__((target("avx2")))
+  inline size_t FindEndAVX2(const char * data, size_t pos, size_t size) {
+    for (; pos + 32 <= size; pos += 32) {
+      unsigned mask = EndMask32<RUN>(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos)));
+      if (mask) return pos + static_cast<size_t>(__builtin_ctz(mask));
+    }
+    return FindEndSSE2<RUN>(data, pos, size);
+  }
+
+  inline size_t CountNewlinesSSE2(const char * data, size_t size) {
+    size_t count = 0, pos = 0;
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; pos + 16 <= size; pos += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+      count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))));
+    }
+    return count + CountNewlinesScalar(data + pos, size - pos);
+  }
+
+  __attribute__((target("avx2")))
+  inline size_t CountNewlinesAVX2(const char * data, size_t size) {
+    size_t count = 0, pos = 0;
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; pos + 32 <= size; pos += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+      count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)))));
+    }
+    return count + CountNewlinesSSE2(data + pos, size - pos);
+  }
+
+  inline bool HasAVX2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+  }
+#endif
+
+  // Return the position of the first byte at or after pos that ends a RUN
+  // (or in.size() if the run continues to the end of the input).
+  template <Run RUN>
+  inline size_t FindEnd(std::string_view in, size_t pos) {
+#ifdef EMPLEX_SCAN_X86
+    if (HasAVX2()) return FindEndAVX2<RUN>(in.data(), pos, in.size());
+    return FindEndSSE2<RUN>(in.data(), pos, in.size());
+#else
+    return FindEndScalar<RUN>(in.data(), pos, in.size());
+#endif
+  }
+
+  // Count the newline characters in text.
+  inline size_t CountNewlines(std::string_view text) {
+#ifdef EMPLEX_SCAN_X86
+    if (HasAVX2()) return CountNewlinesAVX2(text.data(), text.size());
+    return CountNewlinesSSE2(text.data(), text.size());
+#else
+    return CountNewlinesScalar(text.data(), text.size());
+#endif
+  }
+
+} // End of namespace emplex::scan
+#endif // #ifndef EMPLEX_LEXER_SCAN_HPP_INCLUDE_
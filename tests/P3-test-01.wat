@@ -1,193 +1,328 @@
 (module
-(memory (export "memory") 10)
-(global $free_mem (mut i32) (i32.const 0))
-(func $get_length (param $str i32) (result i32) 
-  (local $length i32)
-  (local $current i32)
-  (block $fun_exit1 (result i32)
-    (local.set $length (i32.const 0))
-    (block $exit1
-    (loop $loop1
-      (local.get $str)
-      (local.get $length)
-      (i32.add)
-      (i32.load8_u) ;; access the character
-       (local.set $current)
-
-      (local.get $current)
-      (i32.eqz) ;; check if the character is null terminator
-      (br_if $exit1)
-      (local.get $length)
-      (i32.const 1)
-      (i32.add) ;; add 1 to the length of a string
-      (local.set $length)
-      (br $loop1)
+(memory (export "memory") 10 32768)
+(global $heap_lists i32 (i32.const 0))
+(global $heap_base i32 (i32.const 36))
+(global $free_mem (mut i32) (i32.const 36))
+(global $concat_list (mut i32) (i32.const 0))
+(global $heap_in_use (mut i32) (i32.const 0))
+(global $heap_peak (mut i32) (i32.const 0))
+(global $heap_allocations (mut i32) (i32.const 0))
+(global $heap_frees (mut i32) (i32.const 0))
+(func $alloc (param $size i32) (result i32)
+  (local $block i32)
+  (local $list i32)
+  (local $result i32)
+  (local $end i32)
+  (local.set $block (i32.and (i32.add (local.get $size) (i32.const 15)) (i32.const -8)))
+  (block $found
+    (if (i32.le_u (local.get $block) (i32.const 2048))
+      (then
+        (local.set $block (i32.shl (i32.const 1)
+          (i32.sub (i32.const 32) (i32.clz (i32.or (i32.sub (local.get $block) (i32.const 1)) (i32.const 15))))))
+        (local.set $list (i32.add (global.get $heap_lists) (i32.shl (i32.sub (i32.const 27) (i32.clz (local.get $block))) (i32.const 2))))
+        (local.set $result (i32.load (local.get $list)))
+        (br_if $found (i32.eqz (local.get $result)))
+        (i32.store (local.get $list) (i32.load (local.get $result)))
+        (br $found)
+      )
     )
+    (local.set $list (i32.add (global.get $heap_lists) (i32.const 32)))
+    (loop $search
+      (local.set $result (i32.load (local.get $list)))
+      (br_if $found (i32.eqz (local.get $result)))
+      (local.set $end (i32.load (i32.sub (local.get $result) (i32.const 4))))
+      (if (i32.and (i32.ge_u (local.get $end) (local.get $block))
+                   (i32.le_u (local.get $end) (i32.shl (local.get $block) (i32.const 1))))
+        (then
+          (i32.store (local.get $list) (i32.load (local.get $result)))
+          (local.set $block (local.get $end))
+          (br $found)
+        )
+      )
+      (local.set $list (local.get $result))
+      (br $search)
     )
+  )
+  (if (i32.eqz (local.get $result))
+    (then
+      (local.set $result (i32.add (global.get $free_mem) (i32.const 8)))
+      (local.set $end (i32.add (global.get $free_mem) (local.get $block)))
+      (if (i32.lt_u (local.get $end) (global.get $free_mem)) (then (unreachable)))
+      (if (i32.gt_u (local.get $end) (i32.shl (memory.size) (i32.const 16)))
+        (then
+          (if (i32.lt_s (memory.grow (i32.sub (i32.shr_u (i32.add (local.get $end) (i32.const 65535)) (i32.const 16))
+                                             (memory.size)))
+                        (i32.const 0))
+            (then (unreachable))
+          )
+        )
+      )
+      (global.set $free_mem (local.get $end))
+    )
+  )
+  (i32.store (i32.sub (local.get $result) (i32.const 8)) (i32.const 0))
+  (i32.store (i32.sub (local.get $result) (i32.const 4)) (local.get $block))
+  (global.set $heap_in_use (i32.add (global.get $heap_in_use) (local.get $block)))
+  (if (i32.gt_u (global.get $heap_in_use) (global.get $heap_peak))
+    (then (global.set $heap_peak (global.get $heap_in_use)))
+  )
+  (global.set $heap_allocations (i32.add (global.get $heap_allocations) (i32.const 1)))
+  (local.get $result)
+)
+(export "alloc" (func $alloc))
+(func $free (param $ptr i32)
+  (local $block i32)
+  (local $list i32)
+  (if (i32.lt_u (local.get $ptr) (global.get $heap_base)) (then (return)))
+  (i32.store (i32.sub (local.get $ptr) (i32.const 8)) (i32.const -1))
+  (local.set $block (i32.load (i32.sub (local.get $ptr) (i32.const 4))))
+  (global.set $heap_in_use (i32.sub (global.get $heap_in_use) (local.get $block)))
+  (global.set $heap_frees (i32.add (global.get $heap_frees) (i32.const 1)))
+  (if (i32.eq (i32.add (local.get $ptr) (i32.sub (local.get $block) (i32.const 8))) (global.get $free_mem))
+    (then
+      (global.set $free_mem (i32.sub (local.get $ptr) (i32.const 8)))
+      (return)
+    )
+  )
+  (if (i32.le_u (local.get $block) (i32.const 2048))
+    (then (local.set $list (i32.add (global.get $heap_lists) (i32.shl (i32.sub (i32.const 27) (i32.clz (local.get $block))) (i32.const 2)))))
+    (else (local.set $list (i32.add (global.get $heap_lists) (i32.const 32))))
+  )
+  (i32.store (local.get $ptr) (i32.load (local.get $list)))
+  (i32.store (local.get $list) (local.get $ptr))
+)
+(export "free" (func $free))
+(func $get_heap_in_use (result i32) (global.get $heap_in_use))
+(export "heap_in_use" (func $get_heap_in_use))
+(func $get_heap_peak (result i32) (global.get $heap_peak))
+(export "heap_peak" (func $get_heap_peak))
+(func $get_heap_allocations (result i32) (global.get $heap_allocations))
+(export "heap_allocations" (func $get_heap_allocations))
+(func $get_heap_frees (result i32) (global.get $heap_frees))
+(export "heap_frees" (func $get_heap_frees))
+(func $retain (param $str i32) (result i32)
+  (if (i32.ge_u (local.get $str) (global.get $heap_base))
+    (then (i32.store (i32.sub (local.get $str) (i32.const 8))
+      (i32.add (i32.load (i32.sub (local.get $str) (i32.const 8))) (i32.const 1))))
+  )
+  (local.get $str)
+)
+(export "retain" (func $retain))
+(func $release (param $str i32)
+  (local $count i32)
+  (if (i32.lt_u (local.get $str) (global.get $heap_base)) (then (return)))
+  (local.set $count (i32.load (i32.sub (local.get $str) (i32.const 8))))
+  (if (i32.gt_s (local.get $count) (i32.const 1))
+    (then (i32.store (i32.sub (local.get $str) (i32.const 8)) (i32.sub (local.get $count) (i32.const 1))))
+    (else (if (i32.ge_s (local.get $count) (i32.const 0)) (then (call $free (local.get $str)))))
+  )
+)
+(export "release" (func $release))
+(func $release_temp (param $str i32)
+  (if (i32.ge_u (local.get $str) (global.get $heap_base))
+    (then (if (i32.eqz (i32.load (i32.sub (local.get $str) (i32.const 8)))) (then (call $free (local.get $str)))))
+  )
+)
+(func $disown (param $str i32) (result i32)
+  (if (i32.ge_u (local.get $str) (global.get $heap_base))
+    (then (i32.store (i32.sub (local.get $str) (i32.const 8))
+      (i32.sub (i32.load (i32.sub (local.get $str) (i32.const 8))) (i32.const 1))))
+  )
+  (local.get $str)
+)
+(func $temp_length (param $str i32) (result i32)
+  (local $length i32)
+  (local.set $length (i32.load (local.get $str)))
+  (call $release_temp (local.get $str))
   (local.get $length)
+)
+(func $copy_bytes (param $dest i32) (param $src i32) (param $length i32)
+  (local $i i32)
+  (block $done
+    (loop $copy
+      (br_if $done (i32.ge_u (local.get $i) (local.get $length)))
+      (i32.store8 (i32.add (local.get $dest) (local.get $i))
+        (i32.load8_u (i32.add (local.get $src) (local.get $i))))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br $copy)
+    )
+  )
+)
+(func $fill_bytes (param $dest i32) (param $value i32) (param $length i32)
+  (local $i i32)
+  (block $done
+    (loop $fill
+      (br_if $done (i32.ge_u (local.get $i) (local.get $length)))
+      (i32.store8 (i32.add (local.get $dest) (local.get $i)) (local.get $value))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br $fill)
+    )
   )
 )
+(func $get_length (param $str i32) (result i32)
+  (i32.load (local.get $str))
+)
 (export "get_length" (func $get_length))
+(func $string_from_c (param $cstr i32) (result i32)
+  (local $length i32)
+  (local $result i32)
+  (block $measured
+    (loop $measure
+      (br_if $measured (i32.eqz (i32.load8_u (i32.add (local.get $cstr) (local.get $length)))))
+      (local.set $length (i32.add (local.get $length) (i32.const 1)))
+      (br $measure)
+    )
+  )
+  (local.set $result (call $alloc (i32.add (local.get $length) (i32.const 5))))
+  (i32.store (local.get $result) (local.get $length))
+  (call $copy_bytes (i32.add (local.get $result) (i32.const 4)) (local.get $cstr) (local.get $length))
+  (i32.store8 offset=4 (i32.add (local.get $result) (local.get $length)) (i32.const 0))
+  (local.get $result)
+)
+(export "string_from_c" (func $string_from_c))
+(func $c_string (param $str i32) (result i32)
+  (i32.add (local.get $str) (i32.const 4))
+)
+(export "c_string" (func $c_string))
 (func $add_strings (param $str1 i32) (param $str2 i32) (result i32)
-  (local $old_free_mem i32)
-  (local $count i32)
-  (local $current i32)
+  (local $result i32)
+  (local $length1 i32)
+  (local $length2 i32)
+  (local.set $length1 (i32.load (local.get $str1)))
+  (local.set $length2 (i32.load (local.get $str2)))
+  (local.set $result (call $alloc (i32.add (i32.add (local.get $length1) (local.get $length2)) (i32.const 5))))
+  (i32.store (local.get $result) (i32.add (local.get $length1) (local.get $length2)))
+  (call $copy_bytes (i32.add (local.get $result) (i32.const 4))
+    (i32.add (local.get $str1) (i32.const 4)) (local.get $length1))
+  (call $copy_bytes (i32.add (i32.add (local.get $result) (i32.const 4)) (local.get $length1))
+    (i32.add (local.get $str2) (i32.const 4)) (local.get $length2))
+  (i32.store8 offset=4 (i32.add (i32.add (local.get $result) (local.get $length1)) (local.get $length2)) (i32.const 0))
+  (call $release_temp (local.get $str1))
+  (call $release_temp (local.get $str2))
+  (local.get $result)
+)
+(export "add_strings" (func $add_strings))
+(func $concat_n (param $list i32) (param $count i32) (result i32)
   (local $i i32)
-  (global.get $free_mem)
-  (local.set $old_free_mem)
-  (i32.const 0)
-  (local.set $count)
-    (i32.const 0)
-    (local.set $i)
-  (block $fun_exit1 (result i32)
-    (block $exit1
-      (loop $loop1
-        (local.get $str1)
-        (local.get $count)
-        (i32.add)
-        (i32.load8_u)
-        (local.set $current)
-        (local.get $current)
-        (i32.eqz)
-        (br_if $exit1)
-        (local.get $old_free_mem)
-        (local.get $count)
-        (i32.add)
-        (local.get $current)
-        (i32.store8)
-        (local.get $count)
-        (i32.const 1)
-        (i32.add)
-        (local.set $count)
-        (br $loop1)
+  (local $part i32)
+  (local $length i32)
+  (local $total i32)
+  (local $result i32)
+  (local $dest i32)
+  (block $measured
+    (loop $measure
+      (br_if $measured (i32.ge_u (local.get $i) (local.get $count)))
+      (local.set $part (i32.load (i32.add (local.get $list) (i32.shl (local.get $i) (i32.const 3)))))
+      (if (i32.lt_s (local.get $part) (i32.const 0))
+        (then (local.set $length (i32.ne (i32.and (local.get $part) (i32.const 255)) (i32.const 0))))
+        (else (local.set $length (i32.load (local.get $part))))
       )
+      (i32.store offset=4 (i32.add (local.get $list) (i32.shl (local.get $i) (i32.const 3))) (local.get $length))
+      (local.set $total (i32.add (local.get $total) (local.get $length)))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br $measure)
     )
-    (block $exit2
-      (loop $loop2
-        (local.get $str2)
-        (local.get $i)
-        (i32.add)
-        (i32.load8_u)
-        (local.set $current)
-        (local.get $current)
-        (i32.eqz)
-        (br_if $exit2)
-        (local.get $old_free_mem)
-        (local.get $count)
-        (i32.add)
-        (local.get $current)
-        (i32.store8)
-        (local.get $count)
-        (i32.const 1)
-        (i32.add)
-        (local.set $count)
-        (local.get $i)
-        (i32.const 1)
-        (i32.add)
-        (local.set $i)
-        (br $loop2)
+  )
+  (local.set $result (call $alloc (i32.add (local.get $total) (i32.const 5))))
+  (local.set $dest (i32.add (local.get $result) (i32.const 4)))
+  (local.set $i (i32.const 0))
+  (block $copied
+    (loop $copy
+      (br_if $copied (i32.ge_u (local.get $i) (local.get $count)))
+      (local.set $part (i32.load (i32.add (local.get $list) (i32.shl (local.get $i) (i32.const 3)))))
+      (local.set $length (i32.load offset=4 (i32.add (local.get $list) (i32.shl (local.get $i) (i32.const 3)))))
+      (if (i32.lt_s (local.get $part) (i32.const 0))
+        (then (i32.store8 (local.get $dest) (local.get $part)))
+        (else
+          (call $copy_bytes (local.get $dest) (i32.add (local.get $part) (i32.const 4)) (local.get $length))
+          (call $release_temp (local.get $part))
+        )
       )
+      (local.set $dest (i32.add (local.get $dest) (local.get $length)))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br $copy)
     )
-    (local.get $old_free_mem)
-    (local.get $count)
-    (i32.add)
-    (i32.const 0)
-    (i32.store8)
-    (local.get $old_free_mem)
-    (local.get $count)
-    (i32.add)
-    (i32.const 1)
-    (i32.add)
-    (global.set $free_mem)
-    (local.get $old_free_mem)
   )
+  (i32.store (local.get $result) (local.get $total))
+  (i32.store8 (local.get $dest) (i32.const 0))
+  (call $free (local.get $list))
+  (local.get $result)
 )
-(export "add_strings" (func $add_strings))
+(export "concat_n" (func $concat_n))
 (func $char_to_string (param $char i32) (result i32)
   (local $address i32)
   ;; Allocate memory for the string
-  (global.get $free_mem)
+  (i32.const 6)
+  (call $alloc)
   (local.set $address)
+  ;; Its length is 1 (or 0 for a 0 char, which ends the string)
+  (local.get $address)
+  (local.get $char)
+  (i32.const 0)
+  (i32.ne)
+  (i32.store)
   ;; Store the char as a single-character string
   (local.get $address)
   (local.get $char)
-  (i32.store8)
+  (i32.store8 offset=4)
   ;; Null-terminate the string
   (local.get $address)
-  (i32.const 1)
-  (i32.add)
   (i32.const 0)
-  (i32.store8)
-  ;; Update free_mem
-  (local.get $address)
-  (i32.const 2)
-  (i32.add)
-  (global.set $free_mem)
+  (i32.store8 offset=5)
   ;; Return the address of the string
   (local.get $address)
 )
 (export "char_to_string" (func $char_to_string))
-(func $pad_char (param $repeat i32) (param $char i32) (result i32)
-  (local $char_str i32)
+(func $pad_char (param $char i32) (param $count i32) (result i32)
   (local $result i32)
-  (local $i i32)
-    (block $empty_string_block
-      (local.get $repeat)
-      (i32.eqz)
-      (if
-        (then
-          (global.get $free_mem)
-          (i32.const 0)
-          (i32.store8)
-          (global.get $free_mem)
-          (i32.const 1)
-          (i32.add)
-          (global.set $free_mem)
-          (global.get $free_mem)
-          (return)
-        )
+  (if (i32.or (i32.eqz (local.get $char)) (i32.lt_s (local.get $count) (i32.const 0)))
+    (then (local.set $count (i32.const 0)))
+  )
+  (local.set $result (call $alloc (i32.add (local.get $count) (i32.const 5))))
+  (i32.store (local.get $result) (local.get $count))
+  (call $fill_bytes (i32.add (local.get $result) (i32.const 4)) (local.get $char) (local.get $count))
+  (i32.store8 offset=4 (i32.add (local.get $result) (local.get $count)) (i32.const 0))
+  (local.get $result)
+)
+(export "pad_char" (func $pad_char))
+(func $repeat_string (param $str i32) (param $count i32) (result i32)
+  (local $result i32)
+  (local $length i32)
+  (local $total i32)
+  (local $done i32)
+  (local.set $length (i32.load (local.get $str)))
+  (if (i32.and (i32.gt_s (local.get $count) (i32.const 0)) (i32.gt_u (local.get $length) (i32.const 0)))
+    (then
+      (if (i32.gt_u (local.get $count) (i32.div_u (i32.const 2147483647) (local.get $length)))
+        (then (unreachable))
       )
+      (local.set $total (i32.mul (local.get $length) (local.get $count)))
     )
-
-    ;; Convert char to string
-    (local.get $char)
-    (call $char_to_string)
-    (local.set $char_str)
-
-    (local.get $char_str)
-    (local.set $result)
-
-    (local.set $i (i32.const 1))
-    (block $exit_block
-      (loop $loop
-        ;; Break if $i >= $repeat
-        (local.get $i)
-        (local.get $repeat)
-        (i32.ge_u)
-        (br_if $exit_block)
-
-        ;; Concatenate $result with $char_str
-        (local.get $result)
-        (local.get $char_str)
-        (call $add_strings)
-        (local.set $result) ;; Update result after concatenation
-
-        ;; Increment $i
-        (local.get $i)
-        (i32.const 1)
-        (i32.add)
-        (local.set $i)
-
-        ;; Repeat the loop
-        (br $loop)
+  )
+  (local.set $result (call $alloc (i32.add (local.get $total) (i32.const 5))))
+  (if (local.get $total)
+    (then
+      (call $copy_bytes (i32.add (local.get $result) (i32.const 4)) (i32.add (local.get $str) (i32.const 4)) (local.get $length))
+      (local.set $done (local.get $length))
+      (block $full
+        (loop $double
+          (br_if $full (i32.ge_u (local.get $done) (local.get $total)))
+          (local.set $length (i32.sub (local.get $total) (local.get $done)))
+          (if (i32.gt_u (local.get $length) (local.get $done)) (then (local.set $length (local.get $done))))
+          (call $copy_bytes (i32.add (i32.add (local.get $result) (i32.const 4)) (local.get $done))
+            (i32.add (local.get $result) (i32.const 4)) (local.get $length))
+          (local.set $done (i32.add (local.get $done) (local.get $length)))
+          (br $double)
+        )
       )
     )
-
-    ;; Return the final string address
-    (local.get $result)
   )
-
-  (export "pad_char" (func $pad_char))
+  (i32.store (local.get $result) (local.get $total))
+  (i32.store8 offset=4 (i32.add (local.get $result) (local.get $total)) (i32.const 0))
+  (call $release_temp (local.get $str))
+  (local.get $result)
+)
+(export "repeat_string" (func $repeat_string))
 (func $Get42 (result i32)
 (block $fun_exit1 (result i32)
 (i32.const 42)
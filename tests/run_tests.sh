@@ -3,20 +3,43 @@
 # Initialize a counter for differing files
 wat_count=0
 wasm_count=0
-test_count=20
+wat2wasm_count=0
+test_count=27
 
 error_pass_count=0
 error_fail_count=0
-error_test_count=11
+error_test_count=13
 
 P3_wat_count=0
 P3_wasm_count=0
+P3_wat2wasm_count=0
 P3_test_count=30
 
 P3_error_pass_count=0
 P3_error_fail_count=0
 P3_error_test_count=19
 
+# The committed WAT and wasm files were checked with wat2wasm when they were
+# made, so where the WAT comes out unchanged the wasm must too, even without it
+golden_dir=$(mktemp -d)
+cp *.wat *.wasm "$golden_dir" 2> /dev/null
+pair_count=0
+pair_changed_count=0
+P3_pair_count=0
+P3_pair_changed_count=0
+
+# Compare a test's new WAT and wasm files with the committed pair; prints why not
+# if they don't match, and returns 2 if the WAT changed (so the pair doesn't apply)
+check_pair() {
+    if [[ ! -f "$golden_dir/$1" ]] || ! cmp -s "$1" "$golden_dir/$1"; then
+        return 2
+    fi
+    if ! cmp -s "$2" "$golden_dir/$2"; then
+        echo "                   ... wasm for $1 differs from the committed one."
+        return 1
+    fi
+}
+
 echo NEW PROJECT 4 TESTS
 
 # Loop through all the regular test file pairs
@@ -43,9 +66,9 @@ for i in $(seq -w 01 $test_count); do
         echo "Compilation of test $i to WAT format SUCCESSFUL."
     fi
 
-    # Double check that WAT file was generated; convert it to WASM
+    # Double check that WAT file was generated; encode the WASM directly too
     if [[ -f "$wat_file" ]]; then
-        wat2wasm "$wat_file"
+        ../Project4 --emit=wasm "$code_file" > "$wasm_file"
     else
         echo "File '$wat_file' does not exist."
         continue
@@ -65,7 +88,57 @@ for i in $(seq -w 01 $test_count); do
     else
         echo "File '$wasm_file' does not exist."
     fi
+
+    check_pair "$wat_file" "$wasm_file"
+    case $? in
+        0) ((pair_count++)) ;;
+        2) ((pair_changed_count++)) ;;
+    esac
+
+    # Independently check the WAT with wat2wasm (when installed); its binary
+    # must be byte-for-byte the same as what Project4 encoded directly
+    if command -v wat2wasm > /dev/null; then
+        if wat2wasm "$wat_file" -o "$wasm_file.wat2wasm" && cmp -s "$wasm_file" "$wasm_file.wat2wasm"; then
+            ((wat2wasm_count++))
+        else
+            echo "                   ... wat2wasm output for $wat_file differs."
+        fi
+        rm -f "$wasm_file.wat2wasm"
+    fi
+done
+
+echo ---
+echo BATCH Testing
+
+# Compile every regular test in one batch; the results must match the single-file outputs
+batch_pass_count=0
+batch_dir=$(mktemp -d)
+../Project4 --batch -o "$batch_dir" test-??.tube > /dev/null
+for i in $(seq -w 01 $test_count); do
+    if cmp -s "$batch_dir/test-${i}.wat" "test-${i}.wat"; then
+        ((batch_pass_count++))
+    else
+        echo "Batch output for test $i differs."
+    fi
 done
+rm -rf "$batch_dir"
+
+echo ---
+echo CACHE Testing
+
+# Compile every regular test twice through a function cache; the second time
+# every function's code comes from the cache, and must still match
+cache_pass_count=0
+cache_dir=$(mktemp -d)
+for i in $(seq -w 01 $test_count); do
+    ../Project4 --cache-dir "$cache_dir" "test-${i}.tube" > /dev/null 2>&1
+    if ../Project4 --cache-dir "$cache_dir" "test-${i}.tube" 2> /dev/null | cmp -s - "test-${i}.wat"; then
+        ((cache_pass_count++))
+    else
+        echo "Cached output for test $i differs."
+    fi
+done
+rm -rf "$cache_dir"
 
 echo ---
 echo PROJECT 3 Testing
@@ -94,9 +167,9 @@ for i in $(seq -w 01 $P3_test_count); do
         echo "Compilation of P3 test $i to WAT format SUCCESSFUL."
     fi
 
-    # Double check that WAT file was generated; convert it to WASM
+    # Double check that WAT file was generated; encode the WASM directly too
     if [[ -f "$wat_file" ]]; then
-        wat2wasm "$wat_file"
+        ../Project4 --emit=wasm "$code_file" > "$wasm_file"
     else
         echo "File '$wat_file' does not exist."
         continue
@@ -116,6 +189,23 @@ for i in $(seq -w 01 $P3_test_count); do
     else
         echo "File '$wasm_file' does not exist."
     fi
+
+    check_pair "$wat_file" "$wasm_file"
+    case $? in
+        0) ((P3_pair_count++)) ;;
+        2) ((P3_pair_changed_count++)) ;;
+    esac
+
+    # Independently check the WAT with wat2wasm (when installed); its binary
+    # must be byte-for-byte the same as what Project4 encoded directly
+    if command -v wat2wasm > /dev/null; then
+        if wat2wasm "$wat_file" -o "$wasm_file.wat2wasm" && cmp -s "$wasm_file" "$wasm_file.wat2wasm"; then
+            ((P3_wat2wasm_count++))
+        else
+            echo "                   ... wat2wasm output for $wat_file differs."
+        fi
+        rm -f "$wasm_file.wat2wasm"
+    fi
 done
 
 echo ---
@@ -127,16 +217,19 @@ for i in $(seq -w 01 $error_test_count); do
     code_file="test-error-${i}.tube"
     wat_file="output-error-${i}.wat"
 
-    # Generate the output file for Project4
+    # Generate the output file for Project4 (as text, and as a binary module)
     if [[ -f "../Project4" && -f "$code_file" ]]; then
         ../Project4 "$code_file"
+        wat_status=$?
+        ../Project4 --emit=wasm "$code_file" > /dev/null 2>&1
+        wasm_status=$?
     else
         echo "Executable ../Project4 or code file $code_file does not exist."
         continue
     fi
 
-    # Check the return code
-    if [ $? -ne 0 ]; then
+    # Check the return codes: both must report the error
+    if [ $wat_status -ne 0 ] && [ $wasm_status -ne 0 ]; then
         echo "Error test $i ... Passed!"
         ((error_pass_count++))
     else
@@ -177,8 +270,24 @@ echo ---
 echo "Of $test_count regular test files..."
 echo "...generated $wat_count WAT files"
 echo "...converted $wasm_count WAT files to wasm files for testing."
+echo "...matched the committed WAT and wasm on $pair_count of them ($pair_changed_count with new WAT)."
+if command -v wat2wasm > /dev/null; then
+    echo "...matched wat2wasm on $wat2wasm_count of them."
+else
+    echo "SKIP: wat2wasm is not installed, so the WAT files were not checked with it."
+fi
+echo "...matched $batch_pass_count of them when compiled as one batch."
+echo "...matched $cache_pass_count of them when compiled from the function cache."
 echo "Of $P3_test_count Project 3 tests (that need to still work)..."
 echo "...generated $P3_wat_count WAT files"
 echo "...converted $P3_wasm_count WAT files to wasm files for testing."
+echo "...matched the committed WAT and wasm on $P3_pair_count of them ($P3_pair_changed_count with new WAT)."
+if command -v wat2wasm > /dev/null; then
+    echo "...matched wat2wasm on $P3_wat2wasm_count of them."
+else
+    echo "SKIP: wat2wasm is not installed, so the Project 3 WAT files were not checked with it."
+fi
 echo "Passed $error_pass_count of $error_test_count error tests (Failed $error_fail_count)"
 echo "Passed $P3_error_pass_count of $P3_error_test_count Project 3 error tests (Failed $P3_error_fail_count)"
+
+rm -rf "$golden_dir"
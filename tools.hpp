@@ -1,16 +1,27 @@
 #pragma once
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <sstream>
 #include "lexer.hpp"
+
+// Thrown by Error() to abandon compiling the current program.  what() is the
+// complete message, exactly as it should be printed (e.g., "ERROR (line 3): ...").
+// Nothing exits the process, so one process can compile many programs.
+class CompileError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
 // Helper function that take a line number and any number of additional args
-// that it uses to write an error message and terminate the program.
+// that it uses to build an error message and abandon compilation.
 template <typename... Ts>
-void Error(size_t line_num, Ts... message) {
-  std::cerr << "ERROR (line " << line_num <<  "): ";
-  (std::cerr << ... << std::forward<Ts>(message)) << std::endl;
-  exit(1);
+[[noreturn]] void Error(size_t line_num, Ts... message) {
+  std::stringstream ss;
+  ss << "ERROR (line " << line_num <<  "): ";
+  (ss << ... << std::forward<Ts>(message));
+  throw CompileError(ss.str());
 }
 
 // Helper that converts everything passed to it into a single, concatenated string.
@@ -30,8 +41,9 @@ bool IsOneOf(T value) {
 }
 
 template <typename... Ts>
-void Error(Ts... message) {
-  std::cerr << "ERROR: " ;
-  (std::cerr << ... << std::forward<Ts>(message)) << std::endl;
-  exit(1);
-}
\ No newline at end of file
+[[noreturn]] void Error(Ts... message) {
+  std::stringstream ss;
+  ss << "ERROR: " ;
+  (ss << ... << std::forward<Ts>(message));
+  throw CompileError(ss.str());
+}